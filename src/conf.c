@@ -0,0 +1,241 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <glob.h>
+
+#include "conf.h"
+#include "logging.h"
+
+void conf_init(struct redis_config *c)
+{
+    memset(c, 0x00, sizeof(struct redis_config));
+    c->port = -1;
+    strcpy(c->save, "3600 1 300 100 60 10000");
+    strcpy(c->dir, ".");
+    strcpy(c->dbfilename, "dump.rdb");
+    strcpy(c->appendfilename, "appendonly.aof");
+    strcpy(c->appenddirname, "appendonlydir");
+}
+
+// Split a line into arguments in place, as redis-server does.
+// "double" and 'single' quoted arguments keep their spaces.
+static int conf_split(char *line, char **argv, int max)
+{
+    char *p = line, *w;
+    char quote;
+    int argc = 0;
+
+    while(argc < max)
+    {
+        while(*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+            p++;
+
+        if(*p == '\0' || (argc == 0 && *p == '#'))
+            break;
+
+        argv[argc++] = w = p;
+
+        if(*p == '"' || *p == '\'')
+        {
+            quote = *p++;
+            while(*p != '\0' && *p != quote)
+            {
+                if(quote == '"' && *p == '\\' && p[1] != '\0')
+                    p++;
+                *w++ = *p++;
+            }
+            if(*p == quote)
+                p++;
+        }else
+        {
+            while(*p != '\0' && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+                *w++ = *p++;
+        }
+
+        if(*p != '\0')
+            p++;
+        *w = '\0';
+    }
+
+    return argc;
+}
+
+static void conf_copy(char *dst, size_t size, const char *src)
+{
+    strncpy(dst, src, size-1);
+    dst[size-1] = '\0';
+}
+
+// Bytes of a memory directive, units are as of redis-server.
+// 1k is 1000 and 1kb is 1024, case insensitive.
+uint64_t conf_memory(const char *val)
+{
+    char *end;
+    uint64_t n = strtoull(val, &end, 10);
+
+    if(*end == '\0' || strcasecmp(end, "b") == 0)
+        return n;
+    else if(strcasecmp(end, "k") == 0)
+        return n * 1000;
+    else if(strcasecmp(end, "kb") == 0)
+        return n * 1024;
+    else if(strcasecmp(end, "m") == 0)
+        return n * 1000 * 1000;
+    else if(strcasecmp(end, "mb") == 0)
+        return n * 1024 * 1024;
+    else if(strcasecmp(end, "g") == 0)
+        return n * 1000 * 1000 * 1000;
+    else if(strcasecmp(end, "gb") == 0)
+        return n * 1024 * 1024 * 1024;
+
+    return 0;
+}
+
+// Without bind, redis-server listens on every interface.
+int conf_bind_any(const struct redis_config *c)
+{
+    int i;
+
+    if(c->bind_count == 0)
+        return 1;
+
+    for(i = 0; i < c->bind_count; i++)
+    {
+        if(strcmp(c->bind[i], "*") == 0 || strcmp(c->bind[i], "0.0.0.0") == 0 ||
+                strcmp(c->bind[i], "::") == 0 || strcmp(c->bind[i], "::*") == 0)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int conf_bind_has(const struct redis_config *c, const char *addr)
+{
+    int i;
+
+    for(i = 0; i < c->bind_count; i++)
+    {
+        if(strcmp(c->bind[i], addr) == 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+static int conf_file(struct redis_config *c, const char *path, int depth);
+
+// save lines add up, the first one replaces the default and save "" clears them.
+static void conf_save(struct redis_config *c, int argc, char **argv)
+{
+    size_t len;
+    int i;
+
+    if(!c->save_set || argv[1][0] == '\0')
+        c->save[0] = '\0';
+    c->save_set = 1;
+
+    for(i = 1; i < argc && argv[i][0] != '\0'; i++)
+    {
+        len = strlen(c->save);
+        snprintf(c->save + len, sizeof(c->save) - len, "%s%s", len ? " " : "", argv[i]);
+    }
+}
+
+// include takes a glob pattern since redis 7, files are read in order.
+static void conf_include(struct redis_config *c, const char *pattern, int depth)
+{
+    glob_t g;
+    size_t i;
+
+    if(depth >= CONF_INCLUDE_DEPTH)
+    {
+        log_warn("Conf: include is nested too deep, %s", pattern);
+        return;
+    }
+
+    if(glob(pattern, 0, NULL, &g) != 0)
+    {
+        log_warn("Conf: cannot include %s", pattern);
+        return;
+    }
+
+    for(i = 0; i < g.gl_pathc; i++)
+        conf_file(c, g.gl_pathv[i], depth + 1);
+
+    globfree(&g);
+}
+
+static void conf_directive(struct redis_config *c, int argc, char **argv, int depth)
+{
+    int i;
+
+    if(argc < 2)
+        return;
+
+    if(strcasecmp(argv[0], "include") == 0)
+        conf_include(c, argv[1], depth);
+    else if(strcasecmp(argv[0], "port") == 0)
+        c->port = atoi(argv[1]);
+    else if(strcasecmp(argv[0], "bind") == 0)
+    {
+        c->bind_count = 0;
+        for(i = 1; i < argc && c->bind_count < CONF_BIND_MAX; i++)
+            conf_copy(c->bind[c->bind_count++], CONF_ADDR_MAX, argv[i][0] == '-' ? argv[i]+1 : argv[i]);
+    }
+    else if(strcasecmp(argv[0], "unixsocket") == 0)
+        conf_copy(c->unixsocket, sizeof(c->unixsocket), argv[1]);
+    else if(strcasecmp(argv[0], "requirepass") == 0)
+        conf_copy(c->requirepass, sizeof(c->requirepass), argv[1]);
+    else if(strcasecmp(argv[0], "save") == 0)
+        conf_save(c, argc, argv);
+    else if(strcasecmp(argv[0], "maxmemory") == 0)
+        c->maxmemory = conf_memory(argv[1]);
+    else if(strcasecmp(argv[0], "dir") == 0)
+        conf_copy(c->dir, sizeof(c->dir), argv[1]);
+    else if(strcasecmp(argv[0], "dbfilename") == 0)
+        conf_copy(c->dbfilename, sizeof(c->dbfilename), argv[1]);
+    else if(strcasecmp(argv[0], "appendonly") == 0)
+        c->appendonly = strcasecmp(argv[1], "yes") == 0;
+    else if(strcasecmp(argv[0], "appendfilename") == 0)
+        conf_copy(c->appendfilename, sizeof(c->appendfilename), argv[1]);
+    else if(strcasecmp(argv[0], "appenddirname") == 0)
+        conf_copy(c->appenddirname, sizeof(c->appenddirname), argv[1]);
+    else if(strcasecmp(argv[0], "pidfile") == 0)
+        conf_copy(c->pidfile, sizeof(c->pidfile), argv[1]);
+    else if(strcasecmp(argv[0], "logfile") == 0)
+        conf_copy(c->logfile, sizeof(c->logfile), argv[1]);
+}
+
+// Returns -1 when the file cannot be read, c keeps what was read so far.
+int conf_load(struct redis_config *c, const char *path)
+{
+    return conf_file(c, path, 0);
+}
+
+static int conf_file(struct redis_config *c, const char *path, int depth)
+{
+    FILE *fp;
+    char line[CONF_LINE_MAX];
+    char *argv[CONF_ARGS_MAX];
+    int argc;
+
+    fp = fopen(path, "r");
+    if(fp == NULL)
+    {
+        log_warn("Conf: cannot open %s, %s", path, strerror(errno));
+        return -1;
+    }
+
+    while(fgets(line, sizeof(line), fp) != NULL)
+    {
+        argc = conf_split(line, argv, CONF_ARGS_MAX);
+        conf_directive(c, argc, argv, depth);
+    }
+
+    fclose(fp);
+    return 0;
+}
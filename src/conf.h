@@ -0,0 +1,52 @@
+#ifndef _CONF_H_
+#define _CONF_H_
+
+#include <stdint.h>
+#include <limits.h>
+#include <sys/un.h>
+
+#define CONF_ARGS_MAX       20
+#define CONF_LINE_MAX       4096
+#define CONF_INCLUDE_DEPTH  16
+#define CONF_BIND_MAX       16
+#define CONF_ADDR_MAX       64
+#define CONF_PASS_MAX       512
+#define CONF_FILE_MAX       (PATH_MAX - 16)  // room for a suffix of the standby
+
+// Settings of redis.conf that zoodis cares about.
+// Directives not in the file keep the default of redis-server.
+struct redis_config
+{
+    // -1 when not in the file
+    int port;
+
+    // bind addresses, "-" prefix of optional ones is removed
+    char bind[CONF_BIND_MAX][CONF_ADDR_MAX];
+    int bind_count;
+
+    char unixsocket[sizeof(((struct sockaddr_un*)0)->sun_path)];
+    char requirepass[CONF_PASS_MAX];
+    uint64_t maxmemory;
+
+    // save points as "SECONDS CHANGES ...", "" when disabled
+    char save[256];
+    int save_set;
+
+    char dir[PATH_MAX];
+    char dbfilename[NAME_MAX+1];
+    int appendonly;
+    char appendfilename[NAME_MAX+1];
+    char appenddirname[NAME_MAX+1];
+
+    // "" when not in the file, logfile "" is stdout too
+    char pidfile[CONF_FILE_MAX];
+    char logfile[CONF_FILE_MAX];
+};
+
+void conf_init(struct redis_config *c);
+int conf_load(struct redis_config *c, const char *path);
+int conf_bind_any(const struct redis_config *c);
+int conf_bind_has(const struct redis_config *c, const char *addr);
+uint64_t conf_memory(const char *val);
+
+#endif // _CONF_H_
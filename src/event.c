@@ -0,0 +1,118 @@
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "event.h"
+#include "logging.h"
+#include "nalloc.h"
+
+struct event_loop* event_loop_create(int size)
+{
+    struct event_loop *el;
+    int fd;
+
+    fd = epoll_create1(EPOLL_CLOEXEC);
+    if(fd < 0)
+    {
+        log_err("Event: cannot create epoll. %s", strerror(errno));
+        return NULL;
+    }
+
+    el = ncalloc(sizeof(struct event_loop));
+    el->epfd = fd;
+    el->size = size > 0 ? size : DEFAULT_EVENT_SIZE;
+    el->events = ncalloc(sizeof(struct epoll_event) * el->size);
+
+    return el;
+}
+
+void event_loop_free(struct event_loop *el)
+{
+    if(el == NULL)
+        return;
+
+    close(el->epfd);
+    nalloc_free(el->events);
+    nalloc_free(el);
+}
+
+void event_init(struct event *ev, int fd, event_proc proc, void *data)
+{
+    ev->fd = fd;
+    ev->mask = EVENT_NONE;
+    ev->proc = proc;
+    ev->data = data;
+}
+
+static int event_ctl(struct event_loop *el, int op, struct event *ev, uint32_t mask)
+{
+    struct epoll_event ee;
+
+    memset(&ee, 0x00, sizeof(struct epoll_event));
+    ee.events = mask;
+    ee.data.ptr = ev;
+
+    if(epoll_ctl(el->epfd, op, ev->fd, &ee) < 0)
+    {
+        log_warn("Event: epoll_ctl failed. op:%d fd:%d %s", op, ev->fd, strerror(errno));
+        return -1;
+    }
+
+    ev->mask = mask;
+    return 0;
+}
+
+int event_add(struct event_loop *el, struct event *ev, uint32_t mask)
+{
+    return event_ctl(el, EPOLL_CTL_ADD, ev, mask);
+}
+
+int event_mod(struct event_loop *el, struct event *ev, uint32_t mask)
+{
+    if(ev->mask == mask)
+        return 0;
+
+    return event_ctl(el, EPOLL_CTL_MOD, ev, mask);
+}
+
+int event_del(struct event_loop *el, struct event *ev)
+{
+    if(ev->fd < 0)
+        return 0;
+
+    // a closed fd is removed from epoll by the kernel already.
+    if(epoll_ctl(el->epfd, EPOLL_CTL_DEL, ev->fd, NULL) < 0 && errno != EBADF && errno != ENOENT)
+    {
+        log_warn("Event: epoll_ctl failed. op:%d fd:%d %s", EPOLL_CTL_DEL, ev->fd, strerror(errno));
+        return -1;
+    }
+
+    ev->mask = EVENT_NONE;
+    return 0;
+}
+
+// Wait for events at most timeout_msec and dispatch them.
+// Returns number of dispatched events, or -1.
+int event_poll(struct event_loop *el, int timeout_msec)
+{
+    struct event *ev;
+    int i, n;
+
+    n = epoll_wait(el->epfd, el->events, el->size, timeout_msec);
+    if(n < 0)
+    {
+        if(errno == EINTR)
+            return 0;
+
+        log_err("Event: epoll_wait failed. %s", strerror(errno));
+        return -1;
+    }
+
+    for(i = 0; i < n; i++)
+    {
+        ev = (struct event*) el->events[i].data.ptr;
+        ev->proc(el, ev, el->events[i].events);
+    }
+
+    return n;
+}
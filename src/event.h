@@ -0,0 +1,43 @@
+#ifndef _EVENT_H_
+#define _EVENT_H_
+
+#include <stdint.h>
+#include <sys/epoll.h>
+
+#define EVENT_NONE      0x00
+#define EVENT_READ      EPOLLIN
+#define EVENT_WRITE     EPOLLOUT
+
+#define DEFAULT_EVENT_SIZE  256
+
+struct event_loop;
+struct event;
+
+typedef void (*event_proc)(struct event_loop *el, struct event *ev, uint32_t mask);
+
+// Registered file descriptor. Owned by the caller, usually embedded in
+// the structure it belongs to, and handed back to proc as it is.
+struct event
+{
+    int         fd;
+    uint32_t    mask;
+    event_proc  proc;
+    void        *data;
+};
+
+struct event_loop
+{
+    int epfd;
+    int size;
+    struct epoll_event *events;
+};
+
+struct event_loop* event_loop_create(int size);
+void event_loop_free(struct event_loop *el);
+void event_init(struct event *ev, int fd, event_proc proc, void *data);
+int event_add(struct event_loop *el, struct event *ev, uint32_t mask);
+int event_mod(struct event_loop *el, struct event *ev, uint32_t mask);
+int event_del(struct event_loop *el, struct event *ev);
+int event_poll(struct event_loop *el, int timeout_msec);
+
+#endif // _EVENT_H_
@@ -0,0 +1 @@
+#include "hist.h"
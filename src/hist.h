@@ -0,0 +1,161 @@
+#ifndef _HIST_H_
+#define _HIST_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include "utime.h"
+
+// Log-linear (HDR style) histogram of usec values in fixed memory.
+// Values below HIST_SUB are exact, above them every power of two is split
+// into HIST_SUB/2 buckets, so the relative error is under 2^-(HIST_SUB_BITS-1).
+#define HIST_SUB_BITS       6
+#define HIST_SUB            (1 << HIST_SUB_BITS)
+#define HIST_HALF           (HIST_SUB >> 1)
+#define HIST_MAX_SHIFT      (32 - HIST_SUB_BITS)
+#define HIST_BUCKETS        (HIST_SUB + HIST_MAX_SHIFT * HIST_HALF)
+
+// Rolling window is HIST_RING slots of period seconds each.
+#define HIST_RING           6
+
+struct hist
+{
+    uint64_t count;
+    uint64_t max;
+    uint32_t counts[HIST_BUCKETS];
+};
+
+struct hist_ring
+{
+    int period;             // sec
+    int cur;
+    utime_t start;
+    struct hist slot[HIST_RING];
+};
+
+static inline int hist_index(uint64_t v)
+{
+    int msb, shift;
+
+    if(v > UINT32_MAX)
+        v = UINT32_MAX;
+
+    if(v < HIST_SUB)
+        return (int)v;
+
+    msb = 63 - __builtin_clzll(v);
+    shift = msb - HIST_SUB_BITS + 1;
+    return HIST_SUB + (shift - 1) * HIST_HALF + (int)((v >> shift) - HIST_HALF);
+}
+
+// Highest value which falls in bucket idx.
+static inline uint64_t hist_value(int idx)
+{
+    int shift;
+
+    if(idx < HIST_SUB)
+        return (uint64_t)idx;
+
+    shift = (idx - HIST_SUB) / HIST_HALF + 1;
+    return ((uint64_t)((idx - HIST_SUB) % HIST_HALF + HIST_HALF + 1) << shift) - 1;
+}
+
+static inline void hist_reset(struct hist *h)
+{
+    memset(h, 0x00, sizeof(struct hist));
+}
+
+static inline void hist_record(struct hist *h, uint64_t v)
+{
+    h->counts[hist_index(v)]++;
+    h->count++;
+    if(v > h->max)
+        h->max = v;
+}
+
+static inline void hist_merge(struct hist *dst, const struct hist *src)
+{
+    int i;
+
+    if(src->count == 0)
+        return;
+
+    for(i = 0; i < HIST_BUCKETS; i++)
+        dst->counts[i] += src->counts[i];
+
+    dst->count += src->count;
+    if(src->max > dst->max)
+        dst->max = src->max;
+}
+
+// Value at quantile q (0.0 ~ 1.0), never above the recorded max.
+static inline uint64_t hist_percentile(const struct hist *h, double q)
+{
+    uint64_t rank, seen = 0;
+    int i;
+
+    if(h->count == 0)
+        return 0;
+
+    rank = (uint64_t)(q * h->count + 0.5);
+    if(rank < 1)
+        rank = 1;
+
+    for(i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += h->counts[i];
+        if(seen >= rank)
+            return hist_value(i) < h->max ? hist_value(i) : h->max;
+    }
+
+    return h->max;
+}
+
+static inline void hist_ring_init(struct hist_ring *r, int period, utime_t now)
+{
+    memset(r, 0x00, sizeof(struct hist_ring));
+    r->period = period > 0 ? period : 1;
+    r->start = now;
+}
+
+// Move to the slot of now, clearing slots of skipped periods.
+// Returns 1 when at least one period has been closed.
+static inline int hist_ring_rotate(struct hist_ring *r, utime_t now)
+{
+    utime_t period = (utime_t)r->period * 1000000;
+    int n = 0;
+
+    while(now >= r->start + period)
+    {
+        r->cur = (r->cur + 1) % HIST_RING;
+        hist_reset(&r->slot[r->cur]);
+        r->start += period;
+
+        // idle for longer than the whole ring
+        if(++n >= HIST_RING)
+        {
+            r->start = now;
+            break;
+        }
+    }
+
+    return n > 0;
+}
+
+static inline void hist_ring_record(struct hist_ring *r, utime_t now, uint64_t v)
+{
+    hist_ring_rotate(r, now);
+    hist_record(&r->slot[r->cur], v);
+}
+
+// Merge every slot, the last HIST_RING periods.
+static inline void hist_ring_merge(const struct hist_ring *r, struct hist *out)
+{
+    int i;
+
+    hist_reset(out);
+    for(i = 0; i < HIST_RING; i++)
+        hist_merge(out, &r->slot[i]);
+}
+
+#endif // _HIST_H_
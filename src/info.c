@@ -0,0 +1,84 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "info.h"
+
+#define INFO_KEY(_k_)   _k_, sizeof(_k_)-1
+
+static int info_key(const char *line, size_t len, const char *key, size_t key_len)
+{
+    return len > key_len && line[key_len] == ':' && memcmp(line, key, key_len) == 0;
+}
+
+static void info_line(struct redis_info *info, const char *line, size_t len)
+{
+    char val[64];
+    const char *v = memchr(line, ':', len);
+    size_t vlen;
+
+    if(v == NULL)
+        return;
+
+    v++;
+    vlen = len - (v - line);
+    if(vlen >= sizeof(val))
+        vlen = sizeof(val)-1;
+
+    memcpy(val, v, vlen);
+    val[vlen] = '\0';
+
+    if(info_key(line, len, INFO_KEY("role")))
+    {
+        strncpy(info->role, val, INFO_ROLE_SIZE-1);
+        info->role[INFO_ROLE_SIZE-1] = '\0';
+    }
+    else if(info_key(line, len, INFO_KEY("connected_clients")))
+        info->connected_clients = strtoll(val, NULL, 10);
+    else if(info_key(line, len, INFO_KEY("used_memory")))
+        info->used_memory = strtoll(val, NULL, 10);
+    else if(info_key(line, len, INFO_KEY("instantaneous_ops_per_sec")))
+        info->instantaneous_ops_per_sec = strtoll(val, NULL, 10);
+    else if(info_key(line, len, INFO_KEY("master_repl_offset")))
+        info->master_repl_offset = strtoll(val, NULL, 10);
+    else if(info_key(line, len, INFO_KEY("slave_repl_offset")))
+        info->slave_repl_offset = strtoll(val, NULL, 10);
+    else if(info_key(line, len, INFO_KEY("master_link_status")))
+        info->master_link_up = strcmp(val, "up") == 0;
+    else if(info_key(line, len, INFO_KEY("loading")))
+        info->loading = atoi(val);
+    else if(info_key(line, len, INFO_KEY("loading_loaded_perc")))
+        info->loading_loaded_perc = strtod(val, NULL);
+    else if(info_key(line, len, INFO_KEY("loading_eta_seconds")))
+        info->loading_eta_seconds = strtoll(val, NULL, 10);
+}
+
+// Parse body of INFO bulk reply, "key:value" lines.
+// Fields of sections not in the reply keep their previous value.
+void info_parse(struct redis_info *info, const char *data, size_t len)
+{
+    const char *p = data, *end = data + len, *eol;
+
+    while(p < end)
+    {
+        eol = memchr(p, '\n', end - p);
+        if(eol == NULL)
+            eol = end;
+
+        if(eol > p && *p != '#')
+            info_line(info, p, (eol > p && eol[-1] == '\r') ? eol - p - 1 : eol - p);
+
+        p = eol + 1;
+    }
+
+    info->update_time = utime_mono();
+}
+
+// First element of ROLE reply.
+void info_set_role(struct redis_info *info, const struct mstr *role)
+{
+    size_t len = role->len < INFO_ROLE_SIZE ? role->len : INFO_ROLE_SIZE-1;
+
+    memcpy(info->role, role->data, len);
+    info->role[len] = '\0';
+    info->update_time = utime_mono();
+}
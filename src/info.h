@@ -0,0 +1,33 @@
+#ifndef _INFO_H_
+#define _INFO_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "utime.h"
+#include "mstr.h"
+
+#define INFO_ROLE_SIZE      16
+
+// State of redis-server, collected from INFO and ROLE replies.
+struct redis_info
+{
+    utime_t update_time;
+
+    char role[INFO_ROLE_SIZE];
+    int64_t connected_clients;
+    int64_t used_memory;
+    int64_t instantaneous_ops_per_sec;
+    int64_t master_repl_offset;
+    int64_t slave_repl_offset;
+    int master_link_up;
+
+    int loading;
+    double loading_loaded_perc;
+    int64_t loading_eta_seconds;
+};
+
+void info_parse(struct redis_info *info, const char *data, size_t len);
+void info_set_role(struct redis_info *info, const struct mstr *role);
+
+#endif // _INFO_H_
@@ -0,0 +1,716 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <zookeeper/zookeeper.h>
+
+#include "utime.h"
+#include "libzoodis.h"
+
+#define ZC_PATH_MAX         1024
+#define ZC_CACHELINE        64
+
+struct zc_retired
+{
+    struct zc_retired *next;
+    struct zc_snapshot *snap;
+    uint64_t at;        // utime_mono() when replaced
+    uint64_t epoch;     // of zc when replaced
+};
+
+// epoch is that of zc when the reader took its snapshot, 0 when it holds
+// none. A line of its own, readers store it on every lookup.
+struct zc_reader
+{
+    uint64_t epoch;
+    struct zc *c;
+    struct zc_reader *next;
+} __attribute__((aligned(ZC_CACHELINE)));
+
+// All but snap and epoch is under lock. Completions and watchers run on the thread
+// of zookeeper_mt, and of the expired handle for a while after a session
+// expiry, so they take it too.
+struct zc
+{
+    struct zc_snapshot *snap;
+    uint64_t epoch;         // advanced by each replacement, from 1
+    pthread_mutex_t lock;
+    uint64_t version;
+    struct zc_retired *retired;
+    struct zc_retired **retired_tail;
+    struct zc_reader *readers;
+
+    zhandle_t *zh;
+    zhandle_t *expired;     // closed on the next expiry or by zc_close()
+    char *hosts;
+    char *path;
+    int timeout;
+    int gen;                // handle generation, stale completions ignored
+    int closing;
+
+    // children of path, name is NULL when left out
+    struct zc_node *entries;
+    int count;
+
+    // a refresh reads the children, then the data of each into fresh
+    int busy;
+    int dirty;
+    int failed;     // a read was lost, the snapshot is kept
+    int pending;
+    struct zc_node *fresh;
+    int fresh_count;
+};
+
+struct zc_ctx
+{
+    struct zc *c;
+    int gen;
+    int index;      // in fresh, -1 for the update of one node
+    char name[];
+};
+
+static void zc_refresh(struct zc *c);
+static void zc_watcher(zhandle_t *zh, int type, int state, const char *path, void *data);
+
+static int zc_node_cmp(const void *a, const void *b)
+{
+    return strcmp(((const struct zc_node*)a)->name, ((const struct zc_node*)b)->name);
+}
+
+// One block, the node array followed by the strings.
+static struct zc_snapshot* zc_build(const struct zc_node *nodes, int count)
+{
+    struct zc_snapshot *s;
+    size_t size, len;
+    char *p;
+    int i, n = 0;
+
+    size = 0;
+    for(i = 0; i < count; i++)
+    {
+        if(nodes[i].name == NULL)
+            continue;
+
+        size += strlen(nodes[i].name) + 1 + nodes[i].data_len + 1;
+        n++;
+    }
+
+    s = malloc(sizeof(*s) + n * sizeof(struct zc_node) + size);
+    if(s == NULL)
+        return NULL;
+
+    s->version = 0;
+    s->count = n;
+    p = (char*)&s->nodes[n];
+
+    for(i = 0, n = 0; i < count; i++)
+    {
+        if(nodes[i].name == NULL)
+            continue;
+
+        len = strlen(nodes[i].name) + 1;
+        memcpy(p, nodes[i].name, len);
+        s->nodes[n].name = p;
+        p += len;
+
+        if(nodes[i].data_len > 0)
+            memcpy(p, nodes[i].data, nodes[i].data_len);
+        p[nodes[i].data_len] = '\0';
+        s->nodes[n].data = p;
+        s->nodes[n].data_len = nodes[i].data_len;
+        p += nodes[i].data_len + 1;
+        n++;
+    }
+
+    qsort(s->nodes, s->count, sizeof(struct zc_node), zc_node_cmp);
+    return s;
+}
+
+// A reader holding a snapshot replaced at epoch E took it at an epoch
+// below E. The retired of epochs up to the oldest epoch readers hold are
+// free. Retired oldest first, so it stops at the first one still held or
+// within the grace.
+static void zc_reclaim(struct zc *c, uint64_t now)
+{
+    struct zc_retired *r;
+    struct zc_reader *rd;
+    uint64_t min = UINT64_MAX, e;
+
+    for(rd = c->readers; rd != NULL; rd = rd->next)
+    {
+        e = __atomic_load_n(&rd->epoch, __ATOMIC_SEQ_CST);
+        if(e != 0 && e < min)
+            min = e;
+    }
+
+    while((r = c->retired) != NULL && r->epoch <= min && now - r->at >= (uint64_t)ZC_GRACE_MSEC * 1000)
+    {
+        c->retired = r->next;
+        if(c->retired == NULL)
+            c->retired_tail = &c->retired;
+        free(r->snap);
+        free(r);
+    }
+}
+
+// Readers may still hold the old snapshot, it is freed by zc_reclaim().
+static int zc_swap(struct zc *c, struct zc_snapshot *s)
+{
+    struct zc_retired *r;
+    uint64_t now = utime_mono();
+
+    r = malloc(sizeof(*r));
+    if(r == NULL)
+    {
+        free(s);
+        return -1;
+    }
+
+    s->version = ++c->version;
+    r->snap = c->snap;
+    r->at = now;
+    r->next = NULL;
+    *c->retired_tail = r;
+    c->retired_tail = &r->next;
+
+    // the epoch after the store, readers of the new one store no lower.
+    __atomic_store_n(&c->snap, s, __ATOMIC_SEQ_CST);
+    r->epoch = __atomic_add_fetch(&c->epoch, 1, __ATOMIC_SEQ_CST);
+
+    zc_reclaim(c, now);
+    return 0;
+}
+
+static void zc_commit(struct zc *c)
+{
+    struct zc_snapshot *s = zc_build(c->entries, c->count);
+
+    if(s != NULL)
+        zc_swap(c, s);
+}
+
+static void zc_entries_free(struct zc_node *nodes, int count)
+{
+    int i;
+
+    for(i = 0; i < count; i++)
+    {
+        free((char*)nodes[i].name);
+        free((char*)nodes[i].data);
+    }
+    free(nodes);
+}
+
+static void zc_fresh_free(struct zc *c)
+{
+    zc_entries_free(c->fresh, c->fresh_count);
+    c->fresh = NULL;
+    c->fresh_count = 0;
+    c->pending = 0;
+}
+
+static int zc_suffix(const char *s, const char *suffix)
+{
+    size_t l = strlen(s), sl = strlen(suffix);
+
+    return l >= sl && strcmp(s + l - sl, suffix) == 0;
+}
+
+// Nodes zoodis keeps beside the instance nodes of --zoo-path.
+static int zc_skip_name(const char *name)
+{
+    return zc_suffix(name, ".quarantined") || strcmp(name, "master") == 0
+        || strcmp(name, "election") == 0;
+}
+
+// An ephemeral node of a Redis that answers. With --zoo-nodedata-loading
+// the node of a loading Redis is there too, tagged in its data.
+static int zc_healthy(const char *data, int data_len, const struct Stat *stat)
+{
+    if(stat->ephemeralOwner == 0)
+        return 0;
+
+    if(data != NULL && data_len > 0 && (memmem(data, data_len, " loading=", 9) != NULL
+                || memmem(data, data_len, "\xa7loading", 8) != NULL))
+        return 0;
+
+    return 1;
+}
+
+static struct zc_ctx* zc_ctx_new(struct zc *c, int index, const char *name)
+{
+    struct zc_ctx *ctx;
+
+    ctx = malloc(sizeof(*ctx) + strlen(name) + 1);
+    if(ctx == NULL)
+        return NULL;
+
+    ctx->c = c;
+    ctx->gen = c->gen;
+    ctx->index = index;
+    strcpy(ctx->name, name);
+    return ctx;
+}
+
+static int zc_stale(struct zc_ctx *ctx)
+{
+    return ctx->c->closing || ctx->gen != ctx->c->gen;
+}
+
+static int zc_set_node(struct zc_node *n, const char *name, const char *value, int value_len)
+{
+    char *data;
+
+    if(value_len < 0)
+        value_len = 0;
+
+    data = malloc(value_len + 1);
+    if(data == NULL)
+        return -1;
+
+    if(value_len > 0)
+        memcpy(data, value, value_len);
+    data[value_len] = '\0';
+
+    if(n->name == NULL)
+    {
+        n->name = strdup(name);
+        if(n->name == NULL)
+        {
+            free(data);
+            return -1;
+        }
+    }
+
+    free((char*)n->data);
+    n->data = data;
+    n->data_len = value_len;
+    return 0;
+}
+
+static void zc_unset_node(struct zc_node *n)
+{
+    free((char*)n->name);
+    free((char*)n->data);
+    n->name = NULL;
+    n->data = NULL;
+    n->data_len = 0;
+}
+
+static void zc_refresh_done(struct zc *c)
+{
+    if(c->failed)
+    {
+        // read again once connected
+        zc_fresh_free(c);
+        c->busy = 0;
+        return;
+    }
+
+    zc_entries_free(c->entries, c->count);
+    c->entries = c->fresh;
+    c->count = c->fresh_count;
+    c->fresh = NULL;
+    c->fresh_count = 0;
+
+    zc_commit(c);
+
+    c->busy = 0;
+    if(c->dirty)
+        zc_refresh(c);
+}
+
+static void zc_data_completion(int rc, const char *value, int value_len, const struct Stat *stat, const void *data)
+{
+    struct zc_ctx *ctx = (struct zc_ctx*)data;
+    struct zc *c = ctx->c;
+    struct zc_node *n = NULL;
+    int i;
+
+    pthread_mutex_lock(&c->lock);
+
+    if(zc_stale(ctx))
+        goto out;
+
+    if(ctx->index >= 0)
+    {
+        if(rc == ZOK && zc_healthy(value, value_len, stat))
+            zc_set_node(&c->fresh[ctx->index], ctx->name, value, value_len);
+        else if(rc != ZOK && rc != ZNONODE)
+            c->failed = 1;
+
+        if(--c->pending == 0)
+            zc_refresh_done(c);
+        goto out;
+    }
+
+    for(i = 0; i < c->count; i++)
+    {
+        if(c->entries[i].name != NULL && strcmp(c->entries[i].name, ctx->name) == 0)
+        {
+            n = &c->entries[i];
+            break;
+        }
+    }
+
+    if(rc != ZOK && rc != ZNONODE)
+        goto out;
+
+    // left out before, as loading, read the list again with it
+    if(n == NULL)
+    {
+        if(rc == ZOK && zc_healthy(value, value_len, stat))
+            zc_refresh(c);
+        goto out;
+    }
+
+    if(rc == ZOK && zc_healthy(value, value_len, stat))
+        zc_set_node(n, ctx->name, value, value_len);
+    else
+        zc_unset_node(n);
+
+    zc_commit(c);
+
+out:
+    pthread_mutex_unlock(&c->lock);
+    free(ctx);
+}
+
+static void zc_aget(struct zc *c, int index, const char *name)
+{
+    char path[ZC_PATH_MAX];
+    struct zc_ctx *ctx;
+
+    snprintf(path, sizeof(path), "%s/%s", c->path, name);
+
+    if((ctx = zc_ctx_new(c, index, name)) == NULL
+            || zoo_awget(c->zh, path, zc_watcher, c, zc_data_completion, ctx) != ZOK)
+    {
+        free(ctx);
+        if(index >= 0 && --c->pending == 0)
+            zc_refresh_done(c);
+    }
+}
+
+static void zc_exists_completion(int rc, const struct Stat *stat, const void *data)
+{
+}
+
+static void zc_children_completion(int rc, const struct String_vector *strings, const void *data)
+{
+    struct zc_ctx *ctx = (struct zc_ctx*)data;
+    struct zc *c = ctx->c;
+    int i;
+
+    pthread_mutex_lock(&c->lock);
+
+    if(zc_stale(ctx))
+        goto out;
+
+    if(rc == ZNONODE)
+    {
+        // no --zoo-path yet, read it when created
+        zoo_awexists(c->zh, c->path, zc_watcher, c, zc_exists_completion, NULL);
+        zc_refresh_done(c);
+        goto out;
+    }
+
+    // strings is NULL on any other error
+    if(rc == ZOK)
+        c->fresh = calloc(strings->count ? strings->count : 1, sizeof(struct zc_node));
+    if(rc != ZOK || c->fresh == NULL)
+    {
+        // read again once connected
+        c->busy = 0;
+        goto out;
+    }
+    c->fresh_count = strings->count;
+
+    // one more, so no get done inline ends the refresh early
+    c->pending = 1;
+    for(i = 0; i < strings->count; i++)
+    {
+        if(zc_skip_name(strings->data[i]))
+            continue;
+
+        c->pending++;
+        zc_aget(c, i, strings->data[i]);
+    }
+
+    if(--c->pending == 0)
+        zc_refresh_done(c);
+
+out:
+    pthread_mutex_unlock(&c->lock);
+    free(ctx);
+}
+
+// Reads the children of path, then their data, and publishes them.
+static void zc_refresh(struct zc *c)
+{
+    struct zc_ctx *ctx;
+
+    if(c->closing || c->zh == NULL)
+        return;
+
+    if(c->busy)
+    {
+        c->dirty = 1;
+        return;
+    }
+
+    c->busy = 1;
+    c->dirty = 0;
+    c->failed = 0;
+
+    if((ctx = zc_ctx_new(c, -1, "")) == NULL
+            || zoo_awget_children(c->zh, c->path, zc_watcher, c, zc_children_completion, ctx) != ZOK)
+    {
+        free(ctx);
+        c->busy = 0;
+    }
+}
+
+static zhandle_t* zc_init(struct zc *c)
+{
+    return zookeeper_init(c->hosts, zc_watcher, c->timeout, 0, c, 0);
+}
+
+static void zc_watcher(zhandle_t *zh, int type, int state, const char *path, void *data)
+{
+    struct zc *c = (struct zc*)data;
+    zhandle_t *old = NULL;
+    size_t plen = strlen(c->path);
+    struct zc_ctx *ctx;
+
+    pthread_mutex_lock(&c->lock);
+
+    if(c->closing || zh != c->zh)
+        goto out;
+
+    if(type == ZOO_SESSION_EVENT)
+    {
+        if(state == ZOO_CONNECTED_STATE)
+        {
+            zc_refresh(c);
+        }else if(state == ZOO_EXPIRED_SESSION_STATE)
+        {
+            // the snapshot is kept until the new session reads it again
+            old = c->expired;
+            c->expired = zh;
+            c->gen++;
+            c->busy = 0;
+            zc_fresh_free(c);
+            c->zh = zc_init(c);
+        }
+    }else if(type == ZOO_CHILD_EVENT || type == ZOO_CREATED_EVENT)
+    {
+        zc_refresh(c);
+    }else if(type == ZOO_CHANGED_EVENT && strncmp(path, c->path, plen) == 0 && path[plen] == '/')
+    {
+        if(c->busy)
+        {
+            c->dirty = 1;
+        }else if((ctx = zc_ctx_new(c, -1, path + plen + 1)) != NULL)
+        {
+            if(zoo_awget(c->zh, path, zc_watcher, c, zc_data_completion, ctx) != ZOK)
+                free(ctx);
+        }
+    }
+
+out:
+    pthread_mutex_unlock(&c->lock);
+
+    // not from its own thread, and not under lock its completions take
+    if(old != NULL)
+        zookeeper_close(old);
+}
+
+struct zc* zc_new(void)
+{
+    struct zc *c;
+
+    c = calloc(1, sizeof(*c));
+    if(c == NULL)
+        return NULL;
+
+    c->snap = zc_build(NULL, 0);
+    if(c->snap == NULL)
+    {
+        free(c);
+        return NULL;
+    }
+
+    c->epoch = 1;
+    c->retired_tail = &c->retired;
+    pthread_mutex_init(&c->lock, NULL);
+    return c;
+}
+
+struct zc* zc_open(const char *hosts, const char *path, int timeout)
+{
+    struct zc *c;
+    size_t len = strlen(path);
+
+    if(path[0] != '/' || len + 2 >= ZC_PATH_MAX)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if((c = zc_new()) == NULL)
+        return NULL;
+
+    c->hosts = strdup(hosts);
+    c->path = strdup(path);
+    c->timeout = timeout;
+
+    if(c->hosts == NULL || c->path == NULL)
+    {
+        zc_close(c);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    // "/Redis/" watches the same children as "/Redis"
+    if(len > 1 && c->path[len - 1] == '/')
+        c->path[len - 1] = '\0';
+
+    pthread_mutex_lock(&c->lock);
+    c->zh = zc_init(c);
+    pthread_mutex_unlock(&c->lock);
+
+    if(c->zh == NULL)
+    {
+        zc_close(c);
+        return NULL;
+    }
+
+    return c;
+}
+
+void zc_close(struct zc *c)
+{
+    zhandle_t *zh, *old;
+
+    if(c == NULL)
+        return;
+
+    pthread_mutex_lock(&c->lock);
+    c->closing = 1;
+    zh = c->zh;
+    old = c->expired;
+    c->zh = NULL;
+    c->expired = NULL;
+    pthread_mutex_unlock(&c->lock);
+
+    if(zh != NULL)
+        zookeeper_close(zh);
+    if(old != NULL)
+        zookeeper_close(old);
+
+    zc_fresh_free(c);
+    zc_entries_free(c->entries, c->count);
+    zc_reclaim(c, UINT64_MAX);
+    free(c->snap);
+    free(c->hosts);
+    free(c->path);
+    pthread_mutex_destroy(&c->lock);
+    free(c);
+}
+
+int zc_publish(struct zc *c, const struct zc_node *nodes, int count)
+{
+    struct zc_snapshot *s;
+    int ret;
+
+    s = zc_build(nodes, count);
+    if(s == NULL)
+        return -1;
+
+    pthread_mutex_lock(&c->lock);
+    ret = zc_swap(c, s);
+    pthread_mutex_unlock(&c->lock);
+
+    return ret;
+}
+
+struct zc_reader* zc_reader_new(struct zc *c)
+{
+    struct zc_reader *r;
+
+    if(posix_memalign((void**)&r, ZC_CACHELINE, sizeof(*r)) != 0)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    r->epoch = 0;
+    r->c = c;
+
+    pthread_mutex_lock(&c->lock);
+    r->next = c->readers;
+    c->readers = r;
+    pthread_mutex_unlock(&c->lock);
+
+    return r;
+}
+
+// What it held may be freed now, not only by the next replacement.
+void zc_reader_free(struct zc_reader *r)
+{
+    struct zc *c;
+    struct zc_reader **p;
+
+    if(r == NULL)
+        return;
+
+    c = r->c;
+    pthread_mutex_lock(&c->lock);
+    for(p = &c->readers; *p != NULL; p = &(*p)->next)
+    {
+        if(*p == r)
+        {
+            *p = r->next;
+            break;
+        }
+    }
+    zc_reclaim(c, utime_mono());
+    pthread_mutex_unlock(&c->lock);
+
+    free(r);
+}
+
+// The epoch is stored before the snapshot is loaded. zc_reclaim() either
+// sees it, or runs before it and the load sees the replacement. An epoch
+// read is never newer than the snapshot loaded after it.
+const struct zc_snapshot* zc_acquire(struct zc_reader *r)
+{
+    struct zc *c = r->c;
+
+    __atomic_store_n(&r->epoch, __atomic_load_n(&c->epoch, __ATOMIC_ACQUIRE), __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&c->snap, __ATOMIC_SEQ_CST);
+}
+
+void zc_release(struct zc_reader *r)
+{
+    __atomic_store_n(&r->epoch, 0, __ATOMIC_RELEASE);
+}
+
+const struct zc_node* zc_find(const struct zc_snapshot *s, const char *name)
+{
+    struct zc_node key;
+
+    key.name = name;
+    return bsearch(&key, s->nodes, s->count, sizeof(struct zc_node), zc_node_cmp);
+}
+
+const struct zc_node* zc_pick(const struct zc_snapshot *s, uint64_t hash)
+{
+    if(s->count == 0)
+        return NULL;
+
+    return &s->nodes[hash % s->count];
+}
@@ -0,0 +1,64 @@
+#ifndef _LIBZOODIS_H_
+#define _LIBZOODIS_H_
+
+#include <stdint.h>
+
+// Client side discovery of the redis-servers zoodis registers under
+// --zoo-path. The children and their data are watched by the thread of
+// zookeeper_mt, which publishes an immutable snapshot of them. Readers
+// take it by a pointer load and a store of their epoch, with no lock and
+// no zookeeper read.
+//
+//   struct zc *c = zc_open("zk1:2181,zk2:2181", "/Redis", 5000);
+//   struct zc_reader *r = zc_reader_new(c);        // once per thread
+//   const struct zc_snapshot *s = zc_acquire(r);
+//   const struct zc_node *n = zc_pick(s, hash(key));
+//   ...
+//   zc_release(r);
+//
+// A snapshot replaced is freed once no reader holds it, by a later
+// replacement, and never before ZC_GRACE_MSEC. A reader holds one
+// snapshot at a time, from zc_acquire() to zc_release().
+
+#define ZC_GRACE_MSEC       1000
+
+// A healthy node, its ephemeral is there. data is as zoodis wrote it,
+// --zoo-nodedata text or msgpack, and NUL terminated.
+struct zc_node
+{
+    const char *name;
+    const char *data;
+    int data_len;
+};
+
+// nodes are sorted by name. version counts the snapshots published.
+struct zc_snapshot
+{
+    uint64_t version;
+    int count;
+    struct zc_node nodes[];
+};
+
+struct zc;
+struct zc_reader;
+
+// Watches PATH of the ensemble HOSTS, NULL with errno on failure. The
+// snapshot is empty until the first one is read.
+struct zc* zc_open(const char *hosts, const char *path, int timeout);
+void zc_close(struct zc *c);
+
+// Without zookeeper, nodes are published by the caller.
+struct zc* zc_new(void);
+int zc_publish(struct zc *c, const struct zc_node *nodes, int count);
+
+// A reader of one thread, freed before zc_close(). NULL on failure.
+struct zc_reader* zc_reader_new(struct zc *c);
+void zc_reader_free(struct zc_reader *r);
+
+const struct zc_snapshot* zc_acquire(struct zc_reader *r);
+void zc_release(struct zc_reader *r);
+
+const struct zc_node* zc_find(const struct zc_snapshot *s, const char *name);
+const struct zc_node* zc_pick(const struct zc_snapshot *s, uint64_t hash);
+
+#endif // _LIBZOODIS_H_
@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "libzoodis.h"
+#include "utime.h"
+
+// Lookup throughput of libzoodis snapshots while a writer publishes new
+// node lists, against the same lookups under a pthread rwlock.
+//
+//   ]$ make libzoodis_bench && ./libzoodis_bench [MSEC] [REFRESH_USEC]
+
+#define BENCH_NODES     64
+#define BENCH_THREADS   8
+
+struct bench
+{
+    struct zc *c;
+
+    // the rwlock baseline, a plain array replaced under the write lock
+    pthread_rwlock_t lock;
+    struct zc_node *nodes;
+    int count;
+
+    int rwlock;
+    int stop;
+    int refresh_usec;
+    uint64_t publishes;
+};
+
+struct bench_reader
+{
+    pthread_t tid;
+    struct bench *b;
+    uint64_t lookups;
+    uint64_t sum;
+};
+
+static struct zc_node bench_nodes[BENCH_NODES];
+
+static void bench_make_nodes(void)
+{
+    char buf[64];
+    int i;
+
+    for(i = 0; i < BENCH_NODES; i++)
+    {
+        snprintf(buf, sizeof(buf), "node-%04d", i);
+        bench_nodes[i].name = strdup(buf);
+        snprintf(buf, sizeof(buf), "1 addr=10.0.%d.%d:6379", i / 250, i % 250 + 1);
+        bench_nodes[i].data = strdup(buf);
+        bench_nodes[i].data_len = strlen(buf);
+    }
+}
+
+static void* bench_read(void *arg)
+{
+    struct bench_reader *r = (struct bench_reader*)arg;
+    struct bench *b = r->b;
+    struct zc_reader *zr = zc_reader_new(b->c);
+    const struct zc_snapshot *s;
+    const struct zc_node *n;
+    uint64_t i = 0, sum = 0;
+
+    while(!__atomic_load_n(&b->stop, __ATOMIC_RELAXED))
+    {
+        i++;
+        if(b->rwlock)
+        {
+            pthread_rwlock_rdlock(&b->lock);
+            n = &b->nodes[(i * 0x9e3779b97f4a7c15ULL) % b->count];
+            sum += n->data[n->data_len - 1];
+            pthread_rwlock_unlock(&b->lock);
+        }else
+        {
+            s = zc_acquire(zr);
+            n = zc_pick(s, i * 0x9e3779b97f4a7c15ULL);
+            sum += n->data[n->data_len - 1];
+            zc_release(zr);
+        }
+    }
+
+    zc_reader_free(zr);
+
+    r->lookups = i;
+    r->sum = sum;
+    return NULL;
+}
+
+// Publishes the list with one node left out in turn, as nodes come and go.
+static void* bench_write(void *arg)
+{
+    struct bench *b = (struct bench*)arg;
+    struct zc_node nodes[BENCH_NODES], *copy, *old;
+    uint64_t i = 0;
+    int j, n;
+
+    while(!__atomic_load_n(&b->stop, __ATOMIC_RELAXED))
+    {
+        for(j = 0, n = 0; j < BENCH_NODES; j++)
+        {
+            if(j != (int)(i % BENCH_NODES))
+                nodes[n++] = bench_nodes[j];
+        }
+
+        if(b->rwlock)
+        {
+            copy = malloc(n * sizeof(struct zc_node));
+            memcpy(copy, nodes, n * sizeof(struct zc_node));
+
+            pthread_rwlock_wrlock(&b->lock);
+            old = b->nodes;
+            b->nodes = copy;
+            b->count = n;
+            pthread_rwlock_unlock(&b->lock);
+            free(old);
+        }else
+        {
+            zc_publish(b->c, nodes, n);
+        }
+
+        i++;
+        if(b->refresh_usec)
+            usleep(b->refresh_usec);
+    }
+
+    b->publishes = i;
+    return NULL;
+}
+
+static void bench_run(const char *name, int rwlock, int threads, int msec, int refresh_usec)
+{
+    struct bench b;
+    struct bench_reader r[BENCH_THREADS];
+    pthread_t writer;
+    uint64_t lookups = 0;
+    utime_t stime, etime;
+    double sec;
+    int i;
+
+    memset(&b, 0, sizeof(b));
+    b.c = zc_new();
+    pthread_rwlock_init(&b.lock, NULL);
+    b.nodes = malloc(BENCH_NODES * sizeof(struct zc_node));
+    memcpy(b.nodes, bench_nodes, sizeof(bench_nodes));
+    b.count = BENCH_NODES;
+    b.rwlock = rwlock;
+    b.refresh_usec = refresh_usec;
+    zc_publish(b.c, bench_nodes, BENCH_NODES);
+
+    stime = utime_time();
+    for(i = 0; i < threads; i++)
+    {
+        r[i].b = &b;
+        pthread_create(&r[i].tid, NULL, bench_read, &r[i]);
+    }
+    pthread_create(&writer, NULL, bench_write, &b);
+
+    usleep(msec * 1000);
+    __atomic_store_n(&b.stop, 1, __ATOMIC_RELAXED);
+
+    pthread_join(writer, NULL);
+    for(i = 0; i < threads; i++)
+    {
+        pthread_join(r[i].tid, NULL);
+        lookups += r[i].lookups;
+    }
+    etime = utime_time();
+
+    sec = (etime - stime) / 1000000.0;
+    printf("%-16s %2d threads %12.0f lookups/s %10.0f refreshes/s\n", name, threads,
+            lookups / sec, b.publishes / sec);
+
+    zc_close(b.c);
+    pthread_rwlock_destroy(&b.lock);
+    free(b.nodes);
+}
+
+int main(int argc, char **argv)
+{
+    int msec = argc > 1 ? atoi(argv[1]) : 1000;
+    int refresh_usec = argc > 2 ? atoi(argv[2]) : 100;
+    int threads;
+
+    bench_make_nodes();
+    printf("%d nodes, %d msec per run, refresh every %d usec\n", BENCH_NODES, msec, refresh_usec);
+
+    for(threads = 1; threads <= BENCH_THREADS; threads *= 2)
+    {
+        bench_run("snapshot", 0, threads, msec, refresh_usec);
+        bench_run("rwlock", 1, threads, msec, refresh_usec);
+    }
+
+    return 0;
+}
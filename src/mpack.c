@@ -0,0 +1,116 @@
+#include <string.h>
+
+#include "mpack.h"
+
+void mpack_init(struct mpack *m, void *buf, size_t size)
+{
+    m->buf = buf;
+    m->size = size;
+    m->len = 0;
+    m->error = 0;
+}
+
+static unsigned char* mpack_reserve(struct mpack *m, size_t len)
+{
+    unsigned char *p;
+
+    if(m->error || m->size - m->len < len)
+    {
+        m->error = 1;
+        return NULL;
+    }
+
+    p = m->buf + m->len;
+    m->len += len;
+    return p;
+}
+
+// type byte followed by V in LEN bytes, big endian.
+static void mpack_head(struct mpack *m, unsigned char type, uint64_t v, int len)
+{
+    unsigned char *p = mpack_reserve(m, 1 + len);
+    int i;
+
+    if(p == NULL)
+        return;
+
+    p[0] = type;
+    for(i = len; i > 0; i--, v >>= 8)
+        p[i] = (unsigned char)(v & 0xff);
+}
+
+void mpack_map(struct mpack *m, uint32_t count)
+{
+    if(count < 16)
+        mpack_head(m, 0x80 | count, 0, 0);
+    else if(count <= UINT16_MAX)
+        mpack_head(m, 0xde, count, 2);
+    else
+        mpack_head(m, 0xdf, count, 4);
+}
+
+void mpack_str(struct mpack *m, const char *str, size_t len)
+{
+    unsigned char *p;
+
+    if(len < 32)
+        mpack_head(m, 0xa0 | len, 0, 0);
+    else if(len <= UINT8_MAX)
+        mpack_head(m, 0xd9, len, 1);
+    else if(len <= UINT16_MAX)
+        mpack_head(m, 0xda, len, 2);
+    else
+        mpack_head(m, 0xdb, len, 4);
+
+    p = mpack_reserve(m, len);
+    if(p != NULL)
+        memcpy(p, str, len);
+}
+
+void mpack_cstr(struct mpack *m, const char *str)
+{
+    mpack_str(m, str, strlen(str));
+}
+
+// the smallest encoding of V.
+void mpack_int(struct mpack *m, int64_t v)
+{
+    if(v >= 0)
+    {
+        if(v < 128)
+            mpack_head(m, (unsigned char)v, 0, 0);
+        else if(v <= UINT8_MAX)
+            mpack_head(m, 0xcc, v, 1);
+        else if(v <= UINT16_MAX)
+            mpack_head(m, 0xcd, v, 2);
+        else if(v <= UINT32_MAX)
+            mpack_head(m, 0xce, v, 4);
+        else
+            mpack_head(m, 0xcf, v, 8);
+    }else
+    {
+        if(v >= -32)
+            mpack_head(m, (unsigned char)(0xe0 | (v + 32)), 0, 0);
+        else if(v >= INT8_MIN)
+            mpack_head(m, 0xd0, (uint8_t)v, 1);
+        else if(v >= INT16_MIN)
+            mpack_head(m, 0xd1, (uint16_t)v, 2);
+        else if(v >= INT32_MIN)
+            mpack_head(m, 0xd2, (uint32_t)v, 4);
+        else
+            mpack_head(m, 0xd3, (uint64_t)v, 8);
+    }
+}
+
+void mpack_double(struct mpack *m, double v)
+{
+    uint64_t bits;
+
+    memcpy(&bits, &v, sizeof(bits));
+    mpack_head(m, 0xcb, bits, 8);
+}
+
+void mpack_nil(struct mpack *m)
+{
+    mpack_head(m, 0xc0, 0, 0);
+}
@@ -0,0 +1,26 @@
+#ifndef _MPACK_H_
+#define _MPACK_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Encoder of the MessagePack subset node data needs, maps, strings,
+// integers, floats and nil. It writes into a buffer of the caller,
+// error is set once it is full and later values are dropped.
+struct mpack
+{
+    unsigned char *buf;
+    size_t size;
+    size_t len;
+    int error;
+};
+
+void mpack_init(struct mpack *m, void *buf, size_t size);
+void mpack_map(struct mpack *m, uint32_t count);
+void mpack_str(struct mpack *m, const char *str, size_t len);
+void mpack_cstr(struct mpack *m, const char *str);
+void mpack_int(struct mpack *m, int64_t v);
+void mpack_double(struct mpack *m, double v);
+void mpack_nil(struct mpack *m);
+
+#endif // _MPACK_H_
@@ -1,2 +1,164 @@
 #include "nalloc.h"
 
+size_t nalloc_memory = 0;
+int _nalloc_thread_safe = 0;
+__thread struct nalloc_cache nalloc_cache;
+
+#ifndef HAVE_ATOMIC
+pthread_mutex_t nalloc_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif // HAVE_ATOMIC
+
+// Free lists shared by the threads, refilling and taking the overflow of
+// their caches half a cache at a time. Always locked, a thread may
+// allocate before nalloc_thread_safe() is set.
+struct nalloc_shared
+{
+    pthread_mutex_t lock;
+    struct nalloc_free *list;
+    int count;
+    int max;
+};
+
+static struct nalloc_shared nalloc_shared[NALLOC_CLASSES];
+static pthread_once_t nalloc_once = PTHREAD_ONCE_INIT;
+static pthread_key_t nalloc_key;
+
+static void nalloc_cache_exit(void *arg);
+
+static void nalloc_setup(void)
+{
+    int i;
+
+    for(i = 0; i < NALLOC_CLASSES; i++)
+    {
+        pthread_mutex_init(&nalloc_shared[i].lock, NULL);
+        nalloc_shared[i].max = NALLOC_SHARED_BYTES / nalloc_class_size(i);
+    }
+
+    // hands the cache of an exiting thread over to the shared lists
+    pthread_key_create(&nalloc_key, nalloc_cache_exit);
+}
+
+static void nalloc_cache_init(struct nalloc_cache *c)
+{
+    int i, max;
+
+    pthread_once(&nalloc_once, nalloc_setup);
+
+    for(i = 0; i < NALLOC_CLASSES; i++)
+    {
+        max = NALLOC_CACHE_BYTES / nalloc_class_size(i);
+        if(max > NALLOC_CACHE_MAX) max = NALLOC_CACHE_MAX;
+        if(max < 2) max = 2;
+        c->max[i] = max;
+    }
+
+    pthread_setspecific(nalloc_key, c);
+}
+
+// Moves count blocks from the head of the cache list of cls to the shared
+// one, and frees what the shared list has no room for.
+static void nalloc_give(struct nalloc_cache *c, unsigned cls, int count)
+{
+    struct nalloc_shared *s = &nalloc_shared[cls];
+    struct nalloc_free *head, *last, *f;
+    int n;
+
+    if(count <= 0) return;
+
+    head = last = c->list[cls];
+    for(n = 1; n < count; n++)
+        last = last->next;
+    c->list[cls] = last->next;
+    c->count[cls] -= count;
+    last->next = NULL;
+
+    pthread_mutex_lock(&s->lock);
+    n = s->max - s->count;
+    if(n > count) n = count;
+    if(n > 0)
+    {
+        s->count += n;
+        for(last = head; --n > 0;)
+            last = last->next;
+        f = last->next;
+        last->next = s->list;
+        s->list = head;
+        head = f;
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    while(head != NULL)
+    {
+        f = head;
+        head = head->next;
+        free(f);
+    }
+}
+
+static void nalloc_cache_exit(void *arg)
+{
+    struct nalloc_cache *c = arg;
+    int i;
+
+    for(i = 0; i < NALLOC_CLASSES; i++)
+        nalloc_give(c, i, c->count[i]);
+}
+
+struct nalloc* nalloc_refill(unsigned cls, size_t size)
+{
+    struct nalloc_cache *c = &nalloc_cache;
+    struct nalloc_shared *s;
+    struct nalloc_free *f, *head;
+    int n;
+
+    if(cls >= NALLOC_CLASSES)
+        return malloc(size + sizeof(struct nalloc));
+
+    if(c->max[cls] == 0)
+        nalloc_cache_init(c);
+
+    // half a cache from the shared list, or a new block
+    s = &nalloc_shared[cls];
+    pthread_mutex_lock(&s->lock);
+    head = s->list;
+    for(n = 0, f = NULL; s->list != NULL && n < c->max[cls] / 2; n++)
+    {
+        f = s->list;
+        s->list = f->next;
+    }
+    s->count -= n;
+    pthread_mutex_unlock(&s->lock);
+
+    if(n == 0)
+        return malloc(nalloc_class_size(cls));
+
+    f->next = c->list[cls];
+    c->list[cls] = head->next;
+    c->count[cls] += n - 1;
+    return (struct nalloc*)head;
+}
+
+void nalloc_release(struct nalloc *na)
+{
+    struct nalloc_cache *c = &nalloc_cache;
+    struct nalloc_free *f = (struct nalloc_free*)na;
+    unsigned cls = (unsigned)na->cls;
+
+    if(cls >= NALLOC_CLASSES)
+    {
+        free(na);
+        return;
+    }
+
+    if(c->max[cls] == 0)
+        nalloc_cache_init(c);
+
+    // the cache is full, half of it goes to the shared list
+    if(c->count[cls] >= c->max[cls])
+        nalloc_give(c, cls, c->count[cls] / 2);
+
+    f->next = c->list[cls];
+    c->list[cls] = f;
+    c->count[cls]++;
+}
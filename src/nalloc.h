@@ -15,12 +15,38 @@
 #define NALLOC_MAX   (UINT32_MAX-sizeof(uint32_t))
 #endif // NALLOC_64
 
+// Blocks up to NALLOC_CLASS_MAX, header included, are rounded up to a size
+// class: 16, 32, then two classes per power of two (48, 64, 96, 128 ...).
+// Freed blocks are kept on a free list of their class, in a cache of the
+// thread first, then on a list shared by all threads, so most allocations
+// never reach malloc(). Larger blocks are malloc()'ed as they are.
+#define NALLOC_CLASSES      24
+#define NALLOC_LARGE        NALLOC_CLASSES
+#define NALLOC_CLASS_MAX    (64*1024)
+#define NALLOC_CACHE_MAX    64              // blocks per class in a thread cache
+#define NALLOC_CACHE_BYTES  (256*1024)      // and bytes
+#define NALLOC_SHARED_BYTES (1024*1024)     // per class on the shared lists
+
 struct nalloc
 {
     NALLOC_SIZE     size;
+    NALLOC_SIZE     cls;    // size class, NALLOC_LARGE when malloc()'ed
     unsigned char   data[];
 };
 
+// A block while it is on a free list.
+struct nalloc_free
+{
+    struct nalloc_free *next;
+};
+
+struct nalloc_cache
+{
+    struct nalloc_free *list[NALLOC_CLASSES];
+    int count[NALLOC_CLASSES];
+    int max[NALLOC_CLASSES];    // 0 until nalloc_cache_init()
+};
+
 typedef void*    nptr;
 
 #define HAVE_ATOMIC
@@ -51,13 +77,18 @@ typedef void*    nptr;
         else nalloc_memory -= _x_; \
     }while(0)
 
-static size_t nalloc_memory = 0;
-static int _nalloc_thread_safe = 0;
+// Shared by every translation unit, defined in nalloc.c.
+extern size_t nalloc_memory;
+extern int _nalloc_thread_safe;
+extern __thread struct nalloc_cache nalloc_cache;
 
 #ifndef HAVE_ATOMIC
-static pthread_mutex_t nalloc_lock = PTHREAD_MUTEX_INITIALIZER;
+extern pthread_mutex_t nalloc_lock;
 #endif // HAVE_ATOMIC
 
+struct nalloc* nalloc_refill(unsigned cls, size_t size);
+void nalloc_release(struct nalloc *na);
+
 static inline void nalloc_default_oos(size_t size)
 {
     fprintf(stderr, "Nalloc, out of memroy, size %zu\n", size);
@@ -77,11 +108,32 @@ static inline void nalloc_default_oom(size_t size)
 static void (*nalloc_default_oos_handler)(size_t) = nalloc_default_oos;
 static void (*nalloc_default_oom_handler)(size_t) = nalloc_default_oom;
 
+// Class of a block of size bytes, header included.
+static inline unsigned nalloc_class(size_t size)
+{
+    unsigned lg;
+
+    if(size <= 16) return 0;
+    if(size <= 32) return 1;
+    if(size > NALLOC_CLASS_MAX) return NALLOC_LARGE;
+
+    // 2^lg < size <= 2^(lg+1), then the lower or the upper half
+    lg = 63 - __builtin_clzll((unsigned long long)size - 1);
+    return 2 * (lg - 5) + 2 + (size > ((size_t)3 << (lg - 1)));
+}
+
+static inline size_t nalloc_class_size(unsigned cls)
+{
+    if(cls < 2) return (size_t)16 << cls;
+
+    return (size_t)(3 + (cls & 1)) << ((cls - 2) / 2 + 4);
+}
+
 static inline nptr nalloc_ptr(nptr ptr)
 {
     if(ptr == NULL) return NULL;
 
-    return (void*)ptr-(sizeof(NALLOC_SIZE));
+    return (void*)ptr-sizeof(struct nalloc);
 }
 
 static inline size_t nalloc_ptr_size(nptr ptr)
@@ -92,14 +144,53 @@ static inline size_t nalloc_ptr_size(nptr ptr)
     return (size_t)na->size;
 }
 
+// Block of size bytes of data, from the thread cache when it has one.
+static inline struct nalloc* nalloc_block(size_t size)
+{
+    unsigned cls = nalloc_class(size + sizeof(struct nalloc));
+    struct nalloc_free *f;
+    struct nalloc *na;
+
+    if(cls < NALLOC_CLASSES && (f = nalloc_cache.list[cls]) != NULL)
+    {
+        nalloc_cache.list[cls] = f->next;
+        nalloc_cache.count[cls]--;
+        na = (struct nalloc*)f;
+    }else
+    {
+        na = nalloc_refill(cls, size);
+        if(na == NULL)
+        {
+            nalloc_default_oom_handler(size);
+            return NULL;
+        }
+    }
+
+    na->size = (NALLOC_SIZE)size;
+    na->cls = (NALLOC_SIZE)cls;
+    return na;
+}
+
 static inline void nalloc_free(nptr ptr)
 {
     if(ptr == NULL) return;
 
     size_t size;
+    unsigned cls;
     struct nalloc *na = nalloc_ptr(ptr);
+    struct nalloc_free *f = (struct nalloc_free*)na;
+
     size = (size_t)na->size;
-    free((void*) na);
+    cls = (unsigned)na->cls;
+    if(cls < NALLOC_CLASSES && nalloc_cache.count[cls] < nalloc_cache.max[cls])
+    {
+        f->next = nalloc_cache.list[cls];
+        nalloc_cache.list[cls] = f;
+        nalloc_cache.count[cls]++;
+    }else
+    {
+        nalloc_release(na);
+    }
     NALLOC_MEM_SUB(size);
 #ifdef DEBUG
     fprintf(stdout, "Nalloc, freed %zu, Allocated %zu\n", size, nalloc_memory);
@@ -118,10 +209,8 @@ static inline nptr nalloc(size_t size)
     }
 
     struct nalloc *na;
-    na = malloc(size+sizeof(NALLOC_SIZE));
-    if(na == NULL) nalloc_default_oom_handler(size);
-
-    na->size = (NALLOC_SIZE)size;
+    na = nalloc_block(size);
+    if(na == NULL) return NULL;
 
     NALLOC_MEM_ADD((size_t)na->size);
 
@@ -142,9 +231,9 @@ static inline nptr ncalloc(size_t size)
     }
 
     struct nalloc *na;
-    na = calloc(size+sizeof(NALLOC_SIZE), 1);
-    if(na == NULL) nalloc_default_oom_handler(size);
-    na->size = (NALLOC_SIZE)size;
+    na = nalloc_block(size);
+    if(na == NULL) return NULL;
+    memset(na->data, 0, size);
     NALLOC_MEM_ADD((size_t)na->size);
 #ifdef DEBUG
     fprintf(stdout, "Ncalloc, ncalloc %zu, Allocated %zu\n", size, nalloc_memory);
@@ -153,6 +242,9 @@ static inline nptr ncalloc(size_t size)
     return (void*)na->data;
 }
 
+// Resized in place while size still fits the class of the block, so a
+// buffer grown step by step is copied once per class, and shrinking never
+// copies. Large blocks are left to realloc().
 static inline nptr nrealloc(nptr ptr, size_t size)
 {
     if(size > NALLOC_MAX)
@@ -161,22 +253,46 @@ static inline nptr nrealloc(nptr ptr, size_t size)
         return NULL;
     }
 
-    void *n = nalloc(size);
-
     if(ptr == NULL)
-        return n;
+        return nalloc(size);
 
-    size_t old_size = nalloc_ptr_size(ptr);
+    if(size == 0)
+    {
+        nalloc_free(ptr);
+        return NULL;
+    }
+
+    struct nalloc *na = nalloc_ptr(ptr);
+    size_t old_size = (size_t)na->size;
+    unsigned cls = (unsigned)na->cls;
+    void *n;
 
-    if(old_size > size)
+    if(cls < NALLOC_CLASSES && size + sizeof(struct nalloc) <= nalloc_class_size(cls))
     {
-        memcpy(n, ptr, size);
+        na->size = (NALLOC_SIZE)size;
+        n = ptr;
+    }else if(cls == NALLOC_LARGE && nalloc_class(size + sizeof(struct nalloc)) == NALLOC_LARGE)
+    {
+        na = realloc(na, size + sizeof(struct nalloc));
+        if(na == NULL)
+        {
+            nalloc_default_oom_handler(size);
+            return NULL;
+        }
+        na->size = (NALLOC_SIZE)size;
+        n = (void*)na->data;
     }else
     {
-        memcpy(n, ptr, old_size);
+        n = nalloc(size);
+        memcpy(n, ptr, old_size > size ? size : old_size);
+        nalloc_free(ptr);
+        return n;
     }
 
-    nalloc_free(ptr);
+    if(size > old_size)
+        NALLOC_MEM_ADD(size - old_size);
+    else
+        NALLOC_MEM_SUB(old_size - size);
 #ifdef DEBUG
     fprintf(stdout, "Nalloc, nrealloc %zu, Allocated %zu\n", size, nalloc_memory);
     fflush(stderr);
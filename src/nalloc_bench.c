@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "nalloc.h"
+#include "utime.h"
+
+// Allocation throughput of nalloc against plain malloc, for the small
+// strings and buffers zoodis churns through, with threads allocating at
+// the same time, and for buffers grown by realloc.
+//
+//   ]$ make nalloc_bench && ./nalloc_bench [OPS]
+
+#define BENCH_SLOTS     1024
+#define BENCH_THREADS   4
+#define BENCH_GROW_MAX  (16*1024)
+#define BENCH_GROW_STEP 64
+
+struct bench_alloc
+{
+    const char *name;
+    void* (*alloc)(size_t size);
+    void (*free)(void *ptr);
+    void* (*realloc)(void *ptr, size_t size);
+};
+
+struct bench_thread
+{
+    pthread_t tid;
+    const struct bench_alloc *a;
+    size_t max_size;
+    int ops;
+};
+
+static void* bench_nalloc(size_t size)
+{
+    return nalloc(size);
+}
+
+static void bench_nalloc_free(void *ptr)
+{
+    nalloc_free(ptr);
+}
+
+static void* bench_nrealloc(void *ptr, size_t size)
+{
+    return nrealloc(ptr, size);
+}
+
+static const struct bench_alloc bench_allocs[] =
+{
+    {"nalloc", bench_nalloc, bench_nalloc_free, bench_nrealloc},
+    {"malloc", malloc, free, realloc},
+};
+
+static inline uint32_t bench_rand(uint32_t *x)
+{
+    *x ^= *x << 13;
+    *x ^= *x >> 17;
+    *x ^= *x << 5;
+    return *x;
+}
+
+// Replaces a random slot of a working set with a block of random size up
+// to max_size, as strings and replies come and go.
+static void* bench_churn(void *arg)
+{
+    struct bench_thread *t = (struct bench_thread*)arg;
+    const struct bench_alloc *a = t->a;
+    void *slots[BENCH_SLOTS];
+    uint32_t x = 2463534242U + (uint32_t)(uintptr_t)t;
+    uint32_t r;
+    size_t size;
+    int i;
+
+    memset(slots, 0, sizeof(slots));
+    for(i = 0; i < t->ops; i++)
+    {
+        r = bench_rand(&x);
+        size = 1 + (r >> 10) % t->max_size;
+        if(slots[r % BENCH_SLOTS] != NULL)
+            a->free(slots[r % BENCH_SLOTS]);
+        slots[r % BENCH_SLOTS] = a->alloc(size);
+        *(char*)slots[r % BENCH_SLOTS] = (char)i;
+    }
+
+    for(i = 0; i < BENCH_SLOTS; i++)
+    {
+        if(slots[i] != NULL)
+            a->free(slots[i]);
+    }
+
+    return NULL;
+}
+
+static void bench_churn_run(const struct bench_alloc *a, size_t max_size, int threads, int ops)
+{
+    struct bench_thread t[BENCH_THREADS];
+    utime_t stime, etime;
+    double sec;
+    int i;
+
+    stime = utime_time();
+    for(i = 0; i < threads; i++)
+    {
+        memset(&t[i], 0, sizeof(t[i]));
+        t[i].a = a;
+        t[i].max_size = max_size;
+        t[i].ops = ops;
+        pthread_create(&t[i].tid, NULL, bench_churn, &t[i]);
+    }
+    for(i = 0; i < threads; i++)
+        pthread_join(t[i].tid, NULL);
+    etime = utime_time();
+
+    sec = (etime - stime) / 1000000.0;
+    printf("%-8s churn <= %-5zu %2d threads %12.0f allocs/s\n", a->name, max_size,
+            threads, (double)ops * threads / sec);
+}
+
+// A reply buffer grown BENCH_GROW_STEP bytes at a time, then dropped.
+static void bench_grow_run(const struct bench_alloc *a, int ops)
+{
+    utime_t stime, etime;
+    size_t size;
+    double sec;
+    int i, n = 0;
+    char *buf;
+
+    stime = utime_time();
+    for(i = 0; n < ops; i++)
+    {
+        buf = NULL;
+        for(size = BENCH_GROW_STEP; size <= BENCH_GROW_MAX; size += BENCH_GROW_STEP, n++)
+        {
+            buf = a->realloc(buf, size);
+            buf[size - 1] = (char)i;
+        }
+        a->free(buf);
+    }
+    etime = utime_time();
+
+    sec = (etime - stime) / 1000000.0;
+    printf("%-8s grow  <= %-5d  1 thread  %12.0f reallocs/s\n", a->name, BENCH_GROW_MAX, n / sec);
+}
+
+int main(int argc, char **argv)
+{
+    int ops = argc > 1 ? atoi(argv[1]) : 10000000;
+    int threads;
+    size_t i;
+
+    printf("%d ops per thread, %d slots\n", ops, BENCH_SLOTS);
+
+    for(threads = 1; threads <= BENCH_THREADS; threads *= 2)
+    {
+        for(i = 0; i < sizeof(bench_allocs) / sizeof(bench_allocs[0]); i++)
+            bench_churn_run(&bench_allocs[i], 256, threads, ops);
+    }
+
+    for(i = 0; i < sizeof(bench_allocs) / sizeof(bench_allocs[0]); i++)
+        bench_churn_run(&bench_allocs[i], 4096, 1, ops);
+
+    for(i = 0; i < sizeof(bench_allocs) / sizeof(bench_allocs[0]); i++)
+        bench_grow_run(&bench_allocs[i], ops);
+
+    return 0;
+}
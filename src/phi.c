@@ -0,0 +1,74 @@
+#include <string.h>
+#include <math.h>
+
+#include "phi.h"
+
+void phi_init(struct phi *d, double min_std, double pause)
+{
+    memset(d, 0x00, sizeof(struct phi));
+    d->min_std = min_std;
+    d->pause = pause;
+}
+
+// Forget the history, as of a restarted redis-server.
+void phi_reset(struct phi *d)
+{
+    phi_init(d, d->min_std, d->pause);
+}
+
+void phi_heartbeat(struct phi *d, utime_t now, utime_t rtt)
+{
+    double interval;
+
+    d->rtt = d->rtt == 0 ? rtt / 1000.0 : d->rtt * 0.9 + rtt / 1000.0 * 0.1;
+
+    if(d->last != 0 && now > d->last)
+    {
+        interval = (now - d->last) / 1000.0;
+
+        if(d->count == PHI_WINDOW)
+        {
+            d->sum -= d->intervals[d->pos];
+            d->sum_sq -= d->intervals[d->pos] * d->intervals[d->pos];
+        }else
+        {
+            d->count++;
+        }
+
+        d->intervals[d->pos] = interval;
+        d->pos = (d->pos + 1) % PHI_WINDOW;
+        d->sum += interval;
+        d->sum_sq += interval * interval;
+    }
+
+    d->last = now;
+}
+
+// Suspicion level at now, -log10 of the probability that a heartbeat
+// arrives later than this. Normal distribution of the window, with the
+// logistic approximation of its CDF. A slow network (rtt) widens it,
+// and the acceptable pause shifts it.
+double phi_value(const struct phi *d, utime_t now)
+{
+    double t, mean, var, std, y, e;
+
+    if(!phi_ready(d) || now <= d->last)
+        return 0.0;
+
+    t = (now - d->last) / 1000.0;
+    mean = d->sum / d->count;
+    var = d->sum_sq / d->count - mean * mean;
+    mean += d->pause;
+    std = var > 0 ? sqrt(var) : 0;
+
+    if(std < d->min_std + d->rtt)
+        std = d->min_std + d->rtt;
+
+    y = (t - mean) / std;
+    e = exp(-y * (1.5976 + 0.070566 * y * y));
+
+    if(t > mean)
+        return -log10(e / (1.0 + e));
+    else
+        return -log10(1.0 - 1.0 / (1.0 + e));
+}
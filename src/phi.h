@@ -0,0 +1,45 @@
+#ifndef _PHI_H_
+#define _PHI_H_
+
+#include "utime.h"
+
+// Phi accrual failure detector, as of Hayashibara et al.
+// Inter-arrival times of successful probes are kept in a sliding window,
+// phi is the suspicion level that the next one is not going to arrive.
+#define PHI_WINDOW          100
+#define PHI_MIN_SAMPLES     3
+
+struct phi
+{
+    // arrival of the last heartbeat, utime_mono() usec. 0 before the first one
+    utime_t last;
+
+    // inter-arrival times, msec
+    double intervals[PHI_WINDOW];
+    int count;
+    int pos;
+    double sum;
+    double sum_sq;
+
+    // moving average of probe round trip time, msec
+    double rtt;
+
+    // lower bound of standard deviation, msec
+    double min_std;
+
+    // delay of a heartbeat that is not suspicious yet, msec
+    double pause;
+};
+
+void phi_init(struct phi *d, double min_std, double pause);
+void phi_reset(struct phi *d);
+void phi_heartbeat(struct phi *d, utime_t now, utime_t rtt);
+double phi_value(const struct phi *d, utime_t now);
+
+// Enough history for phi_value() to mean something.
+static inline int phi_ready(const struct phi *d)
+{
+    return d->count >= PHI_MIN_SAMPLES;
+}
+
+#endif // _PHI_H_
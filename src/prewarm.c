@@ -0,0 +1,242 @@
+#define _GNU_SOURCE
+
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+
+#include "prewarm.h"
+#include "logging.h"
+
+static void prewarm_event(struct event_loop *el, struct event *ev, uint32_t mask);
+
+static int prewarm_path(char *path, const char *dir, const char *name)
+{
+    return snprintf(path, PATH_MAX, "%s/%s", dir, name) < PATH_MAX;
+}
+
+// Files redis-server is going to load. The AOF when appendonly is yes,
+// every file of appenddirname since redis 7, else the RDB.
+int prewarm_files(const struct redis_config *c, char paths[][PATH_MAX], int max)
+{
+    char dir[PATH_MAX];
+    struct dirent *de;
+    struct stat st;
+    DIR *dp;
+    int count = 0;
+
+    if(!c->appendonly)
+    {
+        if(max > 0 && prewarm_path(paths[count], c->dir, c->dbfilename))
+            count++;
+        return count;
+    }
+
+    if(prewarm_path(dir, c->dir, c->appenddirname) && (dp = opendir(dir)) != NULL)
+    {
+        while((de = readdir(dp)) != NULL && count < max)
+        {
+            if(de->d_name[0] == '.')
+                continue;
+
+            if(prewarm_path(paths[count], dir, de->d_name) &&
+                    stat(paths[count], &st) == 0 && S_ISREG(st.st_mode))
+            {
+                count++;
+            }
+        }
+        closedir(dp);
+        return count;
+    }
+
+    if(max > 0 && prewarm_path(paths[count], c->dir, c->appendfilename))
+        count++;
+
+    return count;
+}
+
+// Take the next chunk. Returns 0 when nothing is left.
+static int prewarm_next(struct prewarm *pw, int *fd, off_t *offset, size_t *len)
+{
+    int res = 0;
+
+    pthread_mutex_lock(&pw->lock);
+    while(pw->file < pw->file_count && pw->offset >= pw->sizes[pw->file])
+    {
+        pw->file++;
+        pw->offset = 0;
+    }
+
+    if(pw->file < pw->file_count)
+    {
+        *fd = pw->fds[pw->file];
+        *offset = pw->offset;
+        *len = pw->sizes[pw->file] - pw->offset;
+        if(*len > PREWARM_CHUNK)
+            *len = PREWARM_CHUNK;
+        pw->offset += *len;
+        res = 1;
+    }
+    pthread_mutex_unlock(&pw->lock);
+
+    return res;
+}
+
+static void* prewarm_thread(void *arg)
+{
+    struct prewarm *pw = (struct prewarm*) arg;
+    uint64_t one = 1;
+    off_t offset;
+    size_t len;
+    int fd, last;
+
+    while(prewarm_next(pw, &fd, &offset, &len))
+    {
+        // readahead() waits for the pages, fadvise only queues them.
+        if(readahead(fd, offset, len) < 0)
+            posix_fadvise(fd, offset, len, POSIX_FADV_WILLNEED);
+
+        pthread_mutex_lock(&pw->lock);
+        pw->bytes += len;
+        pthread_mutex_unlock(&pw->lock);
+    }
+
+    pthread_mutex_lock(&pw->lock);
+    last = --pw->running == 0;
+    pthread_mutex_unlock(&pw->lock);
+
+    if(last && write(pw->ev.fd, &one, sizeof(one)) < 0)
+        log_err("Prewarm: cannot notify main loop. %s", strerror(errno));
+
+    return NULL;
+}
+
+static void prewarm_close(struct prewarm *pw)
+{
+    int i;
+
+    for(i = 0; i < pw->file_count; i++)
+        close(pw->fds[i]);
+
+    if(pw->ev.fd >= 0)
+    {
+        event_del(pw->el, &pw->ev);
+        close(pw->ev.fd);
+        pw->ev.fd = -1;
+    }
+}
+
+// Warm paths with threads, proc is called by the main loop when done.
+// Missing files are skipped. Returns -1 when there is nothing to warm,
+// proc is not called then.
+int prewarm_start(struct event_loop *el, struct prewarm *pw, char paths[][PATH_MAX], int count,
+        int threads, prewarm_proc proc, void *data)
+{
+    struct stat st;
+    int i, fd;
+
+    memset(pw, 0x00, sizeof(struct prewarm));
+    pw->el = el;
+    pw->proc = proc;
+    pw->data = data;
+    pw->start_time = utime_mono();
+    event_init(&pw->ev, -1, prewarm_event, pw);
+
+    for(i = 0; i < count && pw->file_count < PREWARM_FILES_MAX; i++)
+    {
+        fd = open(paths[i], O_RDONLY|O_CLOEXEC);
+        if(fd < 0)
+        {
+            log_debug("Prewarm: skip %s, %s", paths[i], strerror(errno));
+            continue;
+        }
+
+        if(fstat(fd, &st) < 0 || st.st_size == 0)
+        {
+            close(fd);
+            continue;
+        }
+
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        pw->fds[pw->file_count] = fd;
+        pw->sizes[pw->file_count++] = st.st_size;
+        pw->total += st.st_size;
+    }
+
+    if(pw->file_count == 0)
+        return -1;
+
+    pw->ev.fd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+    if(pw->ev.fd < 0 || event_add(el, &pw->ev, EVENT_READ) < 0)
+    {
+        log_err("Prewarm: cannot create eventfd. %s", strerror(errno));
+        prewarm_close(pw);
+        return -1;
+    }
+
+    if(threads < 1)
+        threads = 1;
+    if(threads > PREWARM_THREADS_MAX)
+        threads = PREWARM_THREADS_MAX;
+
+    pthread_mutex_init(&pw->lock, NULL);
+    pw->running = threads;
+
+    for(i = 0; i < threads; i++)
+    {
+        if(pthread_create(&pw->threads[i], NULL, prewarm_thread, pw) != 0)
+        {
+            log_err("Prewarm: cannot create thread. %s", strerror(errno));
+            break;
+        }
+        pw->thread_count++;
+    }
+
+    if(pw->thread_count == 0)
+    {
+        pw->running = 0;
+        pthread_mutex_destroy(&pw->lock);
+        prewarm_close(pw);
+        return -1;
+    }
+
+    // threads never started are finished already.
+    pthread_mutex_lock(&pw->lock);
+    pw->running -= threads - pw->thread_count;
+    i = pw->running;
+    pthread_mutex_unlock(&pw->lock);
+
+    if(i == 0)
+    {
+        uint64_t one = 1;
+        if(write(pw->ev.fd, &one, sizeof(one)) < 0)
+            log_err("Prewarm: cannot notify main loop. %s", strerror(errno));
+    }
+
+    pw->active = 1;
+    return 0;
+}
+
+static void prewarm_event(struct event_loop *el, struct event *ev, uint32_t mask)
+{
+    struct prewarm *pw = (struct prewarm*) ev->data;
+    uint64_t value;
+    int i;
+
+    if(read(ev->fd, &value, sizeof(value)) < 0)
+        return;
+
+    for(i = 0; i < pw->thread_count; i++)
+        pthread_join(pw->threads[i], NULL);
+
+    pthread_mutex_destroy(&pw->lock);
+    pw->end_time = utime_mono();
+    pw->active = 0;
+    prewarm_close(pw);
+
+    pw->proc(pw);
+}
@@ -0,0 +1,63 @@
+#ifndef _PREWARM_H_
+#define _PREWARM_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "event.h"
+#include "utime.h"
+#include "conf.h"
+
+#define PREWARM_FILES_MAX       64
+#define PREWARM_THREADS_MAX     32
+#define DEFAULT_PREWARM_THREADS 4
+#define PREWARM_CHUNK           (16*1024*1024)
+
+struct prewarm;
+
+typedef void (*prewarm_proc)(struct prewarm *pw);
+
+// Reads the dataset of redis-server into the page cache before it is
+// started. Threads take PREWARM_CHUNK sized pieces of the files and
+// readahead() them, the main loop is told by an eventfd when all are done.
+struct prewarm
+{
+    struct event_loop *el;
+    struct event ev;
+
+    int fds[PREWARM_FILES_MAX];
+    off_t sizes[PREWARM_FILES_MAX];
+    int file_count;
+    uint64_t total;
+
+    // next chunk to take, and bytes warmed
+    pthread_mutex_t lock;
+    int file;
+    off_t offset;
+    uint64_t bytes;
+
+    pthread_t threads[PREWARM_THREADS_MAX];
+    int thread_count;
+    int running;
+
+    // from prewarm_start() until proc is called
+    int active;
+
+    utime_t start_time;
+    utime_t end_time;
+
+    prewarm_proc proc;
+    void *data;
+};
+
+int prewarm_files(const struct redis_config *c, char paths[][PATH_MAX], int max);
+int prewarm_start(struct event_loop *el, struct prewarm *pw, char paths[][PATH_MAX], int count,
+        int threads, prewarm_proc proc, void *data);
+
+static inline int prewarm_active(const struct prewarm *pw)
+{
+    return pw->active;
+}
+
+#endif // _PREWARM_H_
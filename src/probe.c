@@ -0,0 +1,320 @@
+#define _GNU_SOURCE
+
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include "probe.h"
+#include "logging.h"
+#include "nalloc.h"
+
+static void probe_event(struct event_loop *el, struct event *ev, uint32_t mask);
+static void probe_timeout(struct timer_wheel *tw, struct timer *t);
+
+void probe_init(struct probe *p, struct timer_wheel *tw, const struct sockaddr *addr, socklen_t addr_len, probe_proc proc, void *data)
+{
+    memset(p, 0x00, sizeof(struct probe));
+    p->tw = tw;
+    memcpy(&p->addr, addr, addr_len);
+    p->addr_len = addr_len;
+    p->stat = PROBE_STAT_IDLE;
+    p->proc = proc;
+    p->data = data;
+    event_init(&p->ev, -1, probe_event, p);
+    timer_init(&p->timer, probe_timeout, p);
+}
+
+const char* probe_res_str(enum probe_res res)
+{
+    switch(res)
+    {
+    case PROBE_RES_OK:
+        return "ok";
+    case PROBE_RES_ERROR:
+        return "error";
+    case PROBE_RES_TIMEOUT:
+        return "timeout";
+    case PROBE_RES_CLOSED:
+        return "closed";
+    }
+
+    return "unknown";
+}
+
+void probe_close(struct event_loop *el, struct probe *p)
+{
+    if(p->ev.fd >= 0)
+    {
+        event_del(el, &p->ev);
+        close(p->ev.fd);
+        p->ev.fd = -1;
+    }
+
+    p->stat = PROBE_STAT_IDLE;
+    timer_del(p->tw, &p->timer);
+}
+
+static void probe_done(struct event_loop *el, struct probe *p, enum probe_res res)
+{
+    if(res == PROBE_RES_OK)
+    {
+        // keep the connection for the next probe, and watch only hang up.
+        event_mod(el, &p->ev, EVENT_NONE);
+        p->stat = PROBE_STAT_IDLE;
+        timer_del(p->tw, &p->timer);
+    }else
+    {
+        probe_close(el, p);
+    }
+
+    p->proc(p, res);
+}
+
+static void probe_phase(struct probe *p, enum probe_stat stat, int timeout)
+{
+    p->stat = stat;
+    timer_add(p->tw, &p->timer, timeout);
+}
+
+// Parse what arrived since the last read.
+// Returns 1 when every reply of the request is in the buffer,
+// 0 when more data is needed, -1 on protocol error.
+static int probe_reply_complete(struct probe *p)
+{
+    struct resp_token tok;
+    enum resp_res res;
+
+    resp_feed(&p->parser, p->buf, p->buf_len);
+
+    while(p->reply_count < p->req_count)
+    {
+        res = resp_next(&p->parser, &tok);
+        if(res == RESP_AGAIN)
+            return 0;
+        if(res == RESP_ERROR)
+            return -1;
+        if(tok.last)
+            p->reply_count++;
+    }
+
+    return 1;
+}
+
+static void probe_read(struct event_loop *el, struct probe *p)
+{
+    ssize_t res;
+
+    while(1)
+    {
+        if(p->buf_len >= p->buf_size)
+        {
+            if(p->buf_size >= PROBE_BUF_MAX)
+            {
+                log_warn("Probe: reply is longer than %d bytes.", PROBE_BUF_MAX);
+                probe_done(el, p, PROBE_RES_ERROR);
+                return;
+            }
+
+            p->buf_size = p->buf_size ? p->buf_size * 2 : PROBE_BUF_SIZE;
+            p->buf = nrealloc(p->buf, p->buf_size);
+        }
+
+        res = read(p->ev.fd, p->buf + p->buf_len, p->buf_size - p->buf_len);
+        if(res < 0)
+        {
+            if(errno == EINTR)
+                continue;
+
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+
+            log_warn("Probe: read failed, %s", strerror(errno));
+            probe_done(el, p, PROBE_RES_ERROR);
+            return;
+        }else if(res == 0)
+        {
+            probe_done(el, p, PROBE_RES_CLOSED);
+            return;
+        }
+
+        p->buf_len += res;
+
+        res = probe_reply_complete(p);
+        if(res < 0)
+        {
+            log_warn("Probe: protocol error, %.*s", (int)(p->buf_len > 64 ? 64 : p->buf_len), p->buf);
+            probe_done(el, p, PROBE_RES_ERROR);
+            return;
+        }else if(res > 0)
+        {
+            p->recv_time = utime_mono();
+            probe_done(el, p, PROBE_RES_OK);
+            return;
+        }
+    }
+}
+
+static void probe_write(struct event_loop *el, struct probe *p)
+{
+    ssize_t res;
+
+    while(p->req_pos < p->req_len)
+    {
+        res = send(p->ev.fd, p->req + p->req_pos, p->req_len - p->req_pos, MSG_NOSIGNAL);
+        if(res < 0)
+        {
+            if(errno == EINTR)
+                continue;
+
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                event_mod(el, &p->ev, EVENT_WRITE);
+                return;
+            }
+
+            log_warn("Probe: write failed, %s", strerror(errno));
+            probe_done(el, p, PROBE_RES_ERROR);
+            return;
+        }
+
+        p->req_pos += res;
+    }
+
+    probe_phase(p, PROBE_STAT_READING, p->read_timeout);
+    event_mod(el, &p->ev, EVENT_READ);
+}
+
+static void probe_send(struct event_loop *el, struct probe *p)
+{
+    p->req_pos = 0;
+    p->buf_len = 0;
+    p->reply_count = 0;
+    resp_init(&p->parser);
+    p->send_time = utime_mono();
+    probe_phase(p, PROBE_STAT_WRITING, p->write_timeout);
+    probe_write(el, p);
+}
+
+static void probe_connected(struct event_loop *el, struct probe *p)
+{
+    int err = 0;
+    socklen_t len = sizeof(err);
+
+    if(getsockopt(p->ev.fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+        err = errno;
+
+    if(err != 0)
+    {
+        log_debug("Probe: cannot connect redis server, %s", strerror(err));
+        probe_done(el, p, PROBE_RES_ERROR);
+        return;
+    }
+
+    probe_send(el, p);
+}
+
+static void probe_event(struct event_loop *el, struct event *ev, uint32_t mask)
+{
+    struct probe *p = (struct probe*) ev->data;
+
+    switch(p->stat)
+    {
+    case PROBE_STAT_IDLE:
+        // readable or hang up between probes, the connection is useless.
+        probe_close(el, p);
+        break;
+
+    case PROBE_STAT_CONNECTING:
+        probe_connected(el, p);
+        break;
+
+    case PROBE_STAT_WRITING:
+        if(mask & (EPOLLERR|EPOLLHUP))
+            probe_done(el, p, PROBE_RES_ERROR);
+        else
+            probe_write(el, p);
+        break;
+
+    case PROBE_STAT_READING:
+        probe_read(el, p);
+        break;
+    }
+}
+
+// Send req of req_count pipelined commands and wait for all the replies,
+// proc is called with the result. Returns -1 when a probe is already in flight.
+int probe_start(struct event_loop *el, struct probe *p, const char *req, size_t req_len, int req_count)
+{
+    int fd;
+
+    if(probe_in_flight(p))
+        return -1;
+
+    p->req = req;
+    p->req_len = req_len;
+    p->req_count = req_count;
+    p->start_time = utime_mono();
+
+    if(p->ev.fd >= 0)
+    {
+        probe_send(el, p);
+        return 0;
+    }
+
+    fd = socket(p->addr.ss_family, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+    if(fd < 0)
+    {
+        log_warn("Probe: cannot open socket for check redis server. %s", strerror(errno));
+        p->proc(p, PROBE_RES_ERROR);
+        return 0;
+    }
+
+    p->ev.fd = fd;
+    if(event_add(el, &p->ev, EVENT_WRITE) < 0)
+    {
+        probe_done(el, p, PROBE_RES_ERROR);
+        return 0;
+    }
+
+    probe_phase(p, PROBE_STAT_CONNECTING, p->connect_timeout);
+
+    if(connect(fd, (struct sockaddr*)&p->addr, p->addr_len) < 0)
+    {
+        if(errno == EINPROGRESS)
+            return 0;
+
+        log_debug("Probe: cannot connect redis server, %s", strerror(errno));
+        probe_done(el, p, PROBE_RES_ERROR);
+        return 0;
+    }
+
+    probe_send(el, p);
+    return 0;
+}
+
+// Fail the probe when the deadline of its current phase passed.
+static void probe_timeout(struct timer_wheel *tw, struct timer *t)
+{
+    struct probe *p = (struct probe*) t->data;
+
+    if(!probe_in_flight(p))
+        return;
+
+    switch(p->stat)
+    {
+    case PROBE_STAT_CONNECTING:
+        log_warn("Probe: connect timeout (%d msec).", p->connect_timeout);
+        break;
+    case PROBE_STAT_WRITING:
+        log_warn("Probe: write timeout (%d msec).", p->write_timeout);
+        break;
+    case PROBE_STAT_READING:
+        log_warn("Probe: redis could not response in time (timeout:%d msec).", p->read_timeout);
+        break;
+    default:
+        break;
+    }
+
+    probe_done(tw->el, p, PROBE_RES_TIMEOUT);
+}
@@ -0,0 +1,109 @@
+#ifndef _PROBE_H_
+#define _PROBE_H_
+
+#include <sys/socket.h>
+
+#include "event.h"
+#include "timer.h"
+#include "utime.h"
+#include "resp.h"
+
+#define PROBE_BUF_SIZE      1024
+#define PROBE_BUF_MAX       (1024*1024)
+
+enum probe_stat
+{
+    // no request in flight, connection may be kept
+    PROBE_STAT_IDLE,
+
+    // non-blocking connect() in progress
+    PROBE_STAT_CONNECTING,
+
+    // request is being written
+    PROBE_STAT_WRITING,
+
+    // waiting for the reply
+    PROBE_STAT_READING,
+};
+
+enum probe_res
+{
+    PROBE_RES_OK,
+
+    // connection or socket error, connection is closed
+    PROBE_RES_ERROR,
+
+    // a deadline passed, connection is closed
+    PROBE_RES_TIMEOUT,
+
+    // closed by redis-server
+    PROBE_RES_CLOSED,
+};
+
+struct probe;
+
+typedef void (*probe_proc)(struct probe *p, enum probe_res res);
+
+// One health check connection to a redis-server.
+// Connect, write and read have their own deadline, a probe never blocks.
+struct probe
+{
+    enum probe_stat stat;
+    struct event ev;
+    struct timer_wheel *tw;
+
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+
+    // deadlines in msec of each phase
+    int connect_timeout;
+    int write_timeout;
+    int read_timeout;
+
+    // deadline of current phase, pending while in flight
+    struct timer timer;
+    utime_t start_time;     // utime_mono(), as are the others
+    utime_t send_time;
+    utime_t recv_time;
+
+    // pipelined request and number of replies it expects
+    const char *req;
+    size_t req_len;
+    size_t req_pos;
+    int req_count;
+
+    // replies of all commands in the request, reused by every probe
+    char *buf;
+    size_t buf_size;
+    size_t buf_len;
+
+    // resumed on every read, counts complete replies
+    struct resp_parser parser;
+    int reply_count;
+
+    probe_proc proc;
+    void *data;
+};
+
+void probe_init(struct probe *p, struct timer_wheel *tw, const struct sockaddr *addr, socklen_t addr_len, probe_proc proc, void *data);
+int probe_start(struct event_loop *el, struct probe *p, const char *req, size_t req_len, int req_count);
+void probe_close(struct event_loop *el, struct probe *p);
+const char* probe_res_str(enum probe_res res);
+
+static inline int probe_in_flight(const struct probe *p)
+{
+    return p->stat != PROBE_STAT_IDLE;
+}
+
+// A kept connection, the next probe need not connect.
+static inline int probe_is_open(const struct probe *p)
+{
+    return p->ev.fd >= 0;
+}
+
+static inline utime_t probe_rtt(const struct probe *p)
+{
+    return p->recv_time - p->send_time;
+}
+
+#endif // _PROBE_H_
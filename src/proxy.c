@@ -0,0 +1,476 @@
+#define _GNU_SOURCE
+
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/un.h>
+
+#include "proxy.h"
+#include "logging.h"
+#include "nalloc.h"
+
+static void proxy_conn_event(struct event_loop *el, struct event *ev, uint32_t mask);
+static void proxy_conn_timeout(struct timer_wheel *tw, struct timer *t);
+
+// HOST is an IPv4 or IPv6 address, no name is resolved.
+int proxy_addr(const char *host, int port, struct sockaddr_storage *addr, socklen_t *addr_len)
+{
+    struct sockaddr_in *in = (struct sockaddr_in*) addr;
+    struct sockaddr_in6 *in6 = (struct sockaddr_in6*) addr;
+
+    memset(addr, 0, sizeof(struct sockaddr_storage));
+
+    if(port <= 0 || port > 65535)
+        return -1;
+
+    if(inet_pton(AF_INET, host, &in->sin_addr) == 1)
+    {
+        in->sin_family = AF_INET;
+        in->sin_port = htons(port);
+        *addr_len = sizeof(struct sockaddr_in);
+    }else if(inet_pton(AF_INET6, host, &in6->sin6_addr) == 1)
+    {
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = htons(port);
+        *addr_len = sizeof(struct sockaddr_in6);
+    }else
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+const char* proxy_addr_str(const struct sockaddr *addr, char *buf, size_t size)
+{
+    char ip[INET6_ADDRSTRLEN];
+
+    switch(addr->sa_family)
+    {
+    case AF_INET:
+        inet_ntop(AF_INET, &((struct sockaddr_in*)addr)->sin_addr, ip, sizeof(ip));
+        snprintf(buf, size, "%s:%d", ip, ntohs(((struct sockaddr_in*)addr)->sin_port));
+        break;
+    case AF_INET6:
+        inet_ntop(AF_INET6, &((struct sockaddr_in6*)addr)->sin6_addr, ip, sizeof(ip));
+        snprintf(buf, size, "[%s]:%d", ip, ntohs(((struct sockaddr_in6*)addr)->sin6_port));
+        break;
+    case AF_UNIX:
+        snprintf(buf, size, "%s", ((struct sockaddr_un*)addr)->sun_path);
+        break;
+    default:
+        snprintf(buf, size, "unknown");
+        break;
+    }
+
+    return buf;
+}
+
+static void proxy_pipe_init(struct proxy_pipe *pp)
+{
+    memset(pp, 0, sizeof(struct proxy_pipe));
+    pp->fds[0] = -1;
+    pp->fds[1] = -1;
+}
+
+static void proxy_pipe_close(struct proxy_pipe *pp)
+{
+    if(pp->fds[0] >= 0)
+        close(pp->fds[0]);
+    if(pp->fds[1] >= 0)
+        close(pp->fds[1]);
+    proxy_pipe_init(pp);
+}
+
+static int proxy_pipe_open(struct proxy_pipe *pp)
+{
+    if(pipe2(pp->fds, O_NONBLOCK|O_CLOEXEC) < 0)
+        return -1;
+
+    // a pipe of the default size holds a few reads of a busy client
+    fcntl(pp->fds[1], F_SETPIPE_SZ, PROXY_PIPE_SIZE);
+    return 0;
+}
+
+// Listener is read while there is a target and room for a connection.
+static void proxy_listen_update(struct proxy *px)
+{
+    int paused = px->target_len == 0 || px->conn_count >= px->max_conns;
+
+    if(paused == px->paused)
+        return;
+
+    event_mod(px->el, &px->ev, paused ? EVENT_NONE : EVENT_READ);
+    px->paused = paused;
+}
+
+static void proxy_conn_close(struct proxy_conn *c)
+{
+    struct proxy *px = c->px;
+
+    if(c->client.fd >= 0)
+    {
+        event_del(px->el, &c->client);
+        close(c->client.fd);
+        c->client.fd = -1;
+    }
+    if(c->server.fd >= 0)
+    {
+        event_del(px->el, &c->server);
+        close(c->server.fd);
+        c->server.fd = -1;
+    }
+    proxy_pipe_close(&c->up);
+    proxy_pipe_close(&c->down);
+    timer_del(px->tw, &c->timer);
+
+    if(c->prev != NULL)
+        c->prev->next = c->next;
+    else
+        px->conns = c->next;
+    if(c->next != NULL)
+        c->next->prev = c->prev;
+
+    px->conn_count--;
+
+    // events of the batch being dispatched may still point to it
+    c->next = px->closed;
+    px->closed = c;
+
+    proxy_listen_update(px);
+}
+
+// Frees the connections closed since, call it between event_poll().
+void proxy_reap(struct proxy *px)
+{
+    struct proxy_conn *c;
+
+    while((c = px->closed) != NULL)
+    {
+        px->closed = c->next;
+        nalloc_free(c);
+    }
+}
+
+// Moves what src has to dst through the pipe. Reads only into an empty
+// pipe, so EAGAIN of a read is an empty socket, never a full pipe.
+// Returns -1 on a connection error.
+static int proxy_pump(struct proxy_pipe *pp, int src, int dst)
+{
+    ssize_t res;
+
+    while(1)
+    {
+        if(pp->len > 0)
+        {
+            res = splice(pp->fds[0], NULL, dst, NULL, pp->len, SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+            if(res < 0)
+            {
+                if(errno == EINTR)
+                    continue;
+                if(errno == EAGAIN)
+                    return 0;
+                return -1;
+            }
+
+            pp->len -= res;
+            continue;
+        }
+
+        if(pp->eof)
+        {
+            if(!pp->shut)
+            {
+                shutdown(dst, SHUT_WR);
+                pp->shut = 1;
+            }
+            return 0;
+        }
+
+        res = splice(src, NULL, pp->fds[1], NULL, PROXY_PIPE_SIZE, SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+        if(res < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            if(errno == EAGAIN)
+                return 0;
+            return -1;
+        }else if(res == 0)
+        {
+            pp->eof = 1;
+            continue;
+        }
+
+        pp->len += res;
+    }
+}
+
+// Each socket is read while its direction has an empty pipe, and written
+// while the other direction has bytes in its pipe.
+static void proxy_conn_update(struct proxy_conn *c)
+{
+    struct event_loop *el = c->px->el;
+    uint32_t cmask, smask;
+
+    cmask = (!c->up.eof && c->up.len == 0 ? EVENT_READ : 0) | (c->down.len > 0 ? EVENT_WRITE : 0);
+    smask = (!c->down.eof && c->down.len == 0 ? EVENT_READ : 0) | (c->up.len > 0 ? EVENT_WRITE : 0);
+
+    event_mod(el, &c->client, cmask);
+    event_mod(el, &c->server, smask);
+}
+
+static void proxy_conn_pump(struct proxy_conn *c)
+{
+    if(proxy_pump(&c->up, c->client.fd, c->server.fd) < 0
+            || proxy_pump(&c->down, c->server.fd, c->client.fd) < 0)
+    {
+        log_debug("Proxy: connection closed, %s", strerror(errno));
+        proxy_conn_close(c);
+        return;
+    }
+
+    if(c->up.shut && c->down.shut)
+    {
+        proxy_conn_close(c);
+        return;
+    }
+
+    proxy_conn_update(c);
+}
+
+static void proxy_conn_connected(struct proxy_conn *c)
+{
+    int err = 0;
+    socklen_t len = sizeof(err);
+
+    if(getsockopt(c->server.fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+        err = errno;
+
+    if(err != 0)
+    {
+        log_warn("Proxy: cannot connect redis server, %s", strerror(err));
+        proxy_conn_close(c);
+        return;
+    }
+
+    c->connecting = 0;
+    timer_del(c->px->tw, &c->timer);
+    proxy_conn_pump(c);
+}
+
+static void proxy_conn_event(struct event_loop *el, struct event *ev, uint32_t mask)
+{
+    struct proxy_conn *c = (struct proxy_conn*) ev->data;
+
+    if(ev->fd < 0)
+        return;
+
+    if(c->connecting && ev == &c->client)
+        proxy_conn_close(c);    // hung up before the server answered
+    else if(c->connecting)
+        proxy_conn_connected(c);
+    else
+        proxy_conn_pump(c);
+}
+
+static void proxy_conn_timeout(struct timer_wheel *tw, struct timer *t)
+{
+    struct proxy_conn *c = (struct proxy_conn*) t->data;
+
+    log_warn("Proxy: connect timeout (%d msec).", c->px->connect_timeout);
+    proxy_conn_close(c);
+}
+
+static void proxy_nodelay(int fd)
+{
+    int on = 1;
+
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
+
+static void proxy_accept_one(struct proxy *px, int fd)
+{
+    struct proxy_conn *c;
+    int sfd;
+
+    c = ncalloc(sizeof(struct proxy_conn));
+    c->px = px;
+    event_init(&c->client, fd, proxy_conn_event, c);
+    event_init(&c->server, -1, proxy_conn_event, c);
+    timer_init(&c->timer, proxy_conn_timeout, c);
+    proxy_pipe_init(&c->up);
+    proxy_pipe_init(&c->down);
+
+    c->next = px->conns;
+    if(px->conns != NULL)
+        px->conns->prev = c;
+    px->conns = c;
+    px->conn_count++;
+
+    if(proxy_pipe_open(&c->up) < 0 || proxy_pipe_open(&c->down) < 0)
+    {
+        log_warn("Proxy: cannot open pipe. %s", strerror(errno));
+        proxy_conn_close(c);
+        return;
+    }
+
+    sfd = socket(px->target.ss_family, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+    if(sfd < 0)
+    {
+        log_warn("Proxy: cannot open socket. %s", strerror(errno));
+        proxy_conn_close(c);
+        return;
+    }
+    c->server.fd = sfd;
+
+    if(px->target.ss_family != AF_UNIX)
+    {
+        proxy_nodelay(fd);
+        proxy_nodelay(sfd);
+    }
+
+    // the client is not read until the server is connected
+    if(event_add(px->el, &c->client, EVENT_NONE) < 0 || event_add(px->el, &c->server, EVENT_WRITE) < 0)
+    {
+        proxy_conn_close(c);
+        return;
+    }
+
+    c->connecting = 1;
+    timer_add(px->tw, &c->timer, px->connect_timeout);
+
+    if(connect(sfd, (struct sockaddr*)&px->target, px->target_len) < 0 && errno != EINPROGRESS)
+    {
+        log_warn("Proxy: cannot connect redis server, %s", strerror(errno));
+        proxy_conn_close(c);
+    }
+}
+
+static void proxy_accept(struct event_loop *el, struct event *ev, uint32_t mask)
+{
+    struct proxy *px = (struct proxy*) ev->data;
+    int fd;
+
+    while(!px->paused)
+    {
+        fd = accept4(px->ev.fd, NULL, NULL, SOCK_NONBLOCK|SOCK_CLOEXEC);
+        if(fd < 0)
+        {
+            if(errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+
+            // out of descriptors, kept in the backlog until a connection
+            // is closed or the target changes
+            log_warn("Proxy: cannot accept. %s", strerror(errno));
+            event_mod(el, &px->ev, EVENT_NONE);
+            px->paused = 1;
+            return;
+        }
+
+        proxy_accept_one(px, fd);
+        proxy_listen_update(px);
+    }
+}
+
+// SPEC is [IP:]PORT, IP is DEFAULT_PROXY_IP when left out.
+int proxy_listen(struct proxy *px, struct event_loop *el, struct timer_wheel *tw, const char *spec)
+{
+    char host[INET6_ADDRSTRLEN + 2], buf[INET6_ADDRSTRLEN + 8];
+    const char *colon = strrchr(spec, ':');
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    size_t len;
+    int fd, on = 1;
+
+    if(colon == NULL)
+    {
+        strcpy(host, DEFAULT_PROXY_IP);
+        colon = spec - 1;
+    }else
+    {
+        // [::1]:6380
+        len = colon - spec;
+        if(len >= 2 && spec[0] == '[' && spec[len - 1] == ']')
+        {
+            spec++;
+            len -= 2;
+        }
+
+        if(len >= sizeof(host))
+            len = sizeof(host) - 1;
+        memcpy(host, spec, len);
+        host[len] = '\0';
+    }
+
+    if(proxy_addr(host, atoi(colon + 1), &addr, &addr_len) < 0)
+    {
+        log_err("Proxy: invalid listen address %s.", spec);
+        return -1;
+    }
+
+    fd = socket(addr.ss_family, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+    if(fd < 0)
+    {
+        log_err("Proxy: cannot open socket. %s", strerror(errno));
+        return -1;
+    }
+
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    if(bind(fd, (struct sockaddr*)&addr, addr_len) < 0 || listen(fd, PROXY_BACKLOG) < 0)
+    {
+        log_err("Proxy: cannot listen on %s. %s", proxy_addr_str((struct sockaddr*)&addr, buf, sizeof(buf)), strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    px->el = el;
+    px->tw = tw;
+    px->paused = 1;
+    px->max_conns = DEFAULT_PROXY_MAX_CONNS;
+    event_init(&px->ev, fd, proxy_accept, px);
+    if(event_add(el, &px->ev, EVENT_NONE) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    log_msg("Proxy: listening on %s.", proxy_addr_str((struct sockaddr*)&addr, buf, sizeof(buf)));
+    return 0;
+}
+
+// Forwards new connections to ADDR, none while ADDR is NULL. Connections
+// to the former target are closed, clients connect again to the new one.
+void proxy_target(struct proxy *px, const struct sockaddr *addr, socklen_t addr_len)
+{
+    char buf[128];
+
+    if(addr == NULL)
+        addr_len = 0;
+
+    if(addr_len == px->target_len && (addr_len == 0 || memcmp(addr, &px->target, addr_len) == 0))
+        return;
+
+    if(addr_len != 0)
+    {
+        log_warn("Proxy: forwarding to %s, %d connection(s) to the former target closed.",
+                proxy_addr_str(addr, buf, sizeof(buf)), px->conn_count);
+        memcpy(&px->target, addr, addr_len);
+    }else
+    {
+        log_warn("Proxy: no healthy redis server, %d connection(s) closed, not accepting.", px->conn_count);
+    }
+    px->target_len = addr_len;
+
+    while(px->conns != NULL)
+        proxy_conn_close(px->conns);
+
+    proxy_listen_update(px);
+}
@@ -0,0 +1,69 @@
+#ifndef _PROXY_H_
+#define _PROXY_H_
+
+#include <sys/socket.h>
+
+#include "event.h"
+#include "timer.h"
+
+#define DEFAULT_PROXY_IP            "127.0.0.1"
+#define DEFAULT_PROXY_MAX_CONNS     1000
+#define PROXY_BACKLOG               511
+#define PROXY_PIPE_SIZE             (64*1024)
+
+// One direction of a connection. Bytes are spliced from the socket into
+// the pipe and from the pipe into the other socket, never copied to user
+// space. len is what the pipe holds.
+struct proxy_pipe
+{
+    int fds[2];
+    size_t len;
+    int eof;        // read end of the source is closed
+    int shut;       // and the destination was shut down for writing
+};
+
+struct proxy;
+
+// A client connection and its connection to the target.
+struct proxy_conn
+{
+    struct proxy_conn *next;
+    struct proxy_conn *prev;
+    struct proxy *px;
+
+    struct event client;
+    struct event server;
+    int connecting;
+    struct timer timer;     // connect deadline
+
+    struct proxy_pipe up;   // client to server
+    struct proxy_pipe down; // server to client
+};
+
+// --proxy-listen, forwards client connections to the target zoodis
+// follows. Without a target the listener is paused, and connections to
+// a former target are closed.
+struct proxy
+{
+    struct event ev;
+    struct event_loop *el;
+    struct timer_wheel *tw;
+    int paused;
+
+    struct sockaddr_storage target;
+    socklen_t target_len;   // 0 without a target
+
+    struct proxy_conn *conns;
+    struct proxy_conn *closed;  // freed by proxy_reap()
+    int conn_count;
+    int max_conns;
+    int connect_timeout;    // msec
+};
+
+int proxy_listen(struct proxy *px, struct event_loop *el, struct timer_wheel *tw, const char *spec);
+void proxy_target(struct proxy *px, const struct sockaddr *addr, socklen_t addr_len);
+void proxy_reap(struct proxy *px);
+int proxy_addr(const char *host, int port, struct sockaddr_storage *addr, socklen_t *addr_len);
+const char* proxy_addr_str(const struct sockaddr *addr, char *buf, size_t size);
+
+#endif // _PROXY_H_
@@ -0,0 +1,202 @@
+#include <string.h>
+
+#include "resp.h"
+
+void resp_init(struct resp_parser *rp)
+{
+    memset(rp, 0x00, sizeof(struct resp_parser));
+}
+
+// Point the parser at buf, which holds everything fed so far, at the same
+// offsets as before. Call it after every read into the buffer.
+void resp_feed(struct resp_parser *rp, const char *buf, size_t len)
+{
+    rp->buf = buf;
+    rp->len = len;
+}
+
+static int resp_parse_int(const char *p, const char *end, int64_t *out)
+{
+    int64_t v = 0;
+    int neg = 0, d;
+
+    if(p < end && (*p == '-' || *p == '+'))
+    {
+        neg = (*p == '-');
+        p++;
+    }
+
+    if(p == end || end - p > 19)
+        return -1;
+
+    for(; p < end; p++)
+    {
+        if(*p < '0' || *p > '9')
+            return -1;
+
+        // 19 digits may still be beyond INT64_MAX
+        d = *p - '0';
+        if(v > (INT64_MAX - d) / 10)
+            return -1;
+        v = v * 10 + d;
+    }
+
+    *out = neg ? -v : v;
+    return 0;
+}
+
+// A scalar, or an empty aggregate, completed an element of the current
+// aggregate. Returns 1 when it completed a top level reply.
+static int resp_element_done(struct resp_parser *rp)
+{
+    struct resp_level *l;
+
+    while(rp->depth > 0)
+    {
+        l = &rp->stack[rp->depth-1];
+        if(--l->remain > 0)
+            return 0;
+
+        rp->depth--;
+
+        // attributes decorate the element that follows them,
+        // they are not an element of their parent.
+        if(l->attribute)
+            return 0;
+    }
+
+    return 1;
+}
+
+// Parse one token. On RESP_AGAIN nothing is consumed, feed more data and
+// call again. Aggregates are returned as a header token followed by their
+// elements in order.
+enum resp_res resp_next(struct resp_parser *rp, struct resp_token *tok)
+{
+    const char *p, *end, *line, *eol, *next;
+    int64_t n;
+
+    p = rp->buf + rp->pos;
+    end = rp->buf + rp->len;
+
+    if(end - p < 3)
+        return RESP_AGAIN;
+
+    eol = memchr(p+1, '\r', end - p - 1);
+    if(eol == NULL || eol + 1 >= end)
+        return RESP_AGAIN;
+
+    if(eol[1] != '\n')
+        return RESP_ERROR;
+
+    line = p + 1;
+    next = eol + 2;
+
+    tok->type = (enum resp_type) *p;
+    tok->depth = rp->depth;
+    tok->integer = 0;
+    tok->str.data = (nptr) line;
+    tok->str.len = eol - line;
+
+    switch(tok->type)
+    {
+    case RESP_STRING:
+    case RESP_ERR:
+    case RESP_DOUBLE:
+    case RESP_BIGNUM:
+        break;
+
+    case RESP_NULL:
+        tok->str.len = 0;
+        break;
+
+    case RESP_INTEGER:
+        if(resp_parse_int(line, eol, &tok->integer) < 0)
+            return RESP_ERROR;
+        break;
+
+    case RESP_BOOLEAN:
+        if(eol - line != 1 || (*line != 't' && *line != 'f'))
+            return RESP_ERROR;
+        tok->integer = (*line == 't');
+        break;
+
+    case RESP_BULK:
+    case RESP_BLOB_ERROR:
+    case RESP_VERBATIM:
+        if(resp_parse_int(line, eol, &n) < 0 || n < -1)
+            return RESP_ERROR;
+
+        tok->integer = n;
+        if(n == -1)
+        {
+            tok->type = RESP_NULL;
+            tok->str.len = 0;
+            break;
+        }
+
+        // n + 2 would overflow near INT64_MAX
+        if(n > end - next - 2)
+            return RESP_AGAIN;
+
+        if(next[n] != '\r' || next[n+1] != '\n')
+            return RESP_ERROR;
+
+        tok->str.data = (nptr) next;
+        tok->str.len = n;
+        next += n + 2;
+        break;
+
+    case RESP_ARRAY:
+    case RESP_MAP:
+    case RESP_SET:
+    case RESP_ATTRIBUTE:
+    case RESP_PUSH:
+        if(resp_parse_int(line, eol, &n) < 0 || n < -1 || n > INT64_MAX / 2)
+            return RESP_ERROR;
+
+        tok->integer = n;
+        tok->str.len = 0;
+
+        if(n > 0)
+        {
+            if(rp->depth >= RESP_MAX_DEPTH)
+                return RESP_ERROR;
+
+            rp->stack[rp->depth].remain = (tok->type == RESP_MAP || tok->type == RESP_ATTRIBUTE) ? n*2 : n;
+            rp->stack[rp->depth].attribute = (tok->type == RESP_ATTRIBUTE);
+            rp->depth++;
+            rp->pos = next - rp->buf;
+            tok->last = 0;
+            return RESP_OK;
+        }
+
+        if(n == -1)
+            tok->type = RESP_NULL;
+        break;
+
+    default:
+        // streamed strings and aggregates ("$?") are not supported
+        return RESP_ERROR;
+    }
+
+    rp->pos = next - rp->buf;
+    tok->last = (tok->type == RESP_ATTRIBUTE) ? 0 : resp_element_done(rp);
+    return RESP_OK;
+}
+
+// Skip the rest of the current top level reply.
+enum resp_res resp_skip(struct resp_parser *rp)
+{
+    struct resp_token tok;
+    enum resp_res res;
+
+    do
+    {
+        res = resp_next(rp, &tok);
+        if(res != RESP_OK)
+            return res;
+    }while(!tok.last);
+
+    return RESP_OK;
+}
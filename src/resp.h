@@ -0,0 +1,107 @@
+#ifndef _RESP_H_
+#define _RESP_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "mstr.h"
+
+#define RESP_MAX_DEPTH      16
+
+enum resp_res
+{
+    // a token has been parsed
+    RESP_OK,
+
+    // the buffer ends in the middle of a token, feed more data
+    RESP_AGAIN,
+
+    // protocol error, the connection can't be used anymore
+    RESP_ERROR,
+};
+
+enum resp_type
+{
+    // RESP2
+    RESP_STRING     = '+',
+    RESP_ERR        = '-',
+    RESP_INTEGER    = ':',
+    RESP_BULK       = '$',
+    RESP_ARRAY      = '*',
+
+    // RESP3
+    RESP_NULL       = '_',
+    RESP_DOUBLE     = ',',
+    RESP_BOOLEAN    = '#',
+    RESP_BLOB_ERROR = '!',
+    RESP_VERBATIM   = '=',
+    RESP_BIGNUM     = '(',
+    RESP_MAP        = '%',
+    RESP_SET        = '~',
+    RESP_ATTRIBUTE  = '|',
+    RESP_PUSH       = '>',
+};
+
+// One element of a reply. str points into the parser buffer, nothing is
+// copied, so it is valid as long as the buffer is not modified.
+struct resp_token
+{
+    enum resp_type type;
+
+    // nesting level of the token, 0 is a top level reply
+    int depth;
+
+    // payload of strings, errors, doubles and big numbers
+    struct mstr str;
+
+    // value of integers and booleans, number of elements of aggregates
+    // (pairs for maps and attributes), -1 for RESP2 null bulk and array
+    int64_t integer;
+
+    // 1 when this token completes a top level reply
+    int last;
+};
+
+struct resp_level
+{
+    int64_t remain;
+    int attribute;
+};
+
+// Incremental parser over a caller owned buffer. Offsets, not pointers, are
+// kept between calls, so the buffer may grow (and move) while a reply is
+// still incomplete. Parsing never allocates.
+struct resp_parser
+{
+    const char *buf;
+    size_t len;
+    size_t pos;
+
+    int depth;
+    struct resp_level stack[RESP_MAX_DEPTH];
+};
+
+void resp_init(struct resp_parser *rp);
+void resp_feed(struct resp_parser *rp, const char *buf, size_t len);
+enum resp_res resp_next(struct resp_parser *rp, struct resp_token *tok);
+enum resp_res resp_skip(struct resp_parser *rp);
+
+static inline int resp_is_error(const struct resp_token *tok)
+{
+    return tok->type == RESP_ERR || tok->type == RESP_BLOB_ERROR;
+}
+
+static inline int resp_is_aggregate(const struct resp_token *tok)
+{
+    return tok->type == RESP_ARRAY || tok->type == RESP_MAP || tok->type == RESP_SET ||
+        tok->type == RESP_ATTRIBUTE || tok->type == RESP_PUSH;
+}
+
+// Compare a string token with a C string.
+static inline int resp_str_eq(const struct resp_token *tok, const char *s)
+{
+    size_t len = strlen(s);
+    return tok->str.len == len && memcmp(tok->str.data, s, len) == 0;
+}
+
+#endif // _RESP_H_
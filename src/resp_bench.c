@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "resp.h"
+#include "utime.h"
+#include "nalloc.h"
+
+// Throughput of the RESP parser over a probe like reply stream,
+// parsed whole and fed in small chunks as partial reads do.
+//
+//   ]$ make resp_bench && ./resp_bench [ROUNDS]
+
+#define BENCH_REPLIES   1000
+
+static size_t bench_append(char *buf, size_t len, const char *s, size_t slen)
+{
+    memcpy(buf + len, s, slen);
+    return len + slen;
+}
+
+static size_t bench_appends(char *buf, size_t len, const char *s)
+{
+    return bench_append(buf, len, s, strlen(s));
+}
+
+static char* bench_corpus(size_t *out_len, int *out_replies)
+{
+    char info[4096], head[32], *buf;
+    size_t len = 0, info_len = 0;
+    int i, replies = 0;
+
+    for(i = 0; info_len < sizeof(info) - 64; i++)
+        info_len += snprintf(info + info_len, sizeof(info) - info_len, "field_%d:%d\r\n", i, i * 7919);
+
+    buf = nalloc(BENCH_REPLIES * (sizeof(info) + 256));
+
+    for(i = 0; i < BENCH_REPLIES; i++)
+    {
+        switch(i % 5)
+        {
+        case 0:
+            len = bench_appends(buf, len, "+PONG\r\n");
+            break;
+        case 1:
+            snprintf(head, sizeof(head), "$%zu\r\n", info_len);
+            len = bench_appends(buf, len, head);
+            len = bench_append(buf, len, info, info_len);
+            len = bench_appends(buf, len, "\r\n");
+            break;
+        case 2:
+            len = bench_appends(buf, len, "*3\r\n$6\r\nmaster\r\n:3129\r\n*2\r\n*3\r\n$9\r\n127.0.0.1\r\n$4\r\n6380\r\n$4\r\n3129\r\n*3\r\n$9\r\n127.0.0.1\r\n$4\r\n6381\r\n$4\r\n3128\r\n");
+            break;
+        case 3:
+            len = bench_appends(buf, len, "|1\r\n+ttl\r\n:3600\r\n%2\r\n+used_memory\r\n:1048576\r\n+role\r\n=10\r\ntxt:master\r\n");
+            break;
+        case 4:
+            len = bench_appends(buf, len, ":1024\r\n-LOADING Redis is loading the dataset in memory\r\n");
+            replies++;
+            break;
+        }
+        replies++;
+    }
+
+    *out_len = len;
+    *out_replies = replies;
+    return buf;
+}
+
+// Parse buf fed chunk bytes at a time, 0 means all at once.
+// Returns number of complete replies.
+static int bench_parse(const char *buf, size_t len, size_t chunk, uint64_t *tokens)
+{
+    struct resp_parser rp;
+    struct resp_token tok;
+    enum resp_res res;
+    size_t fed = chunk ? 0 : len;
+    int replies = 0;
+
+    resp_init(&rp);
+
+    while(1)
+    {
+        if(chunk)
+        {
+            fed = fed + chunk < len ? fed + chunk : len;
+        }
+        resp_feed(&rp, buf, fed);
+
+        while((res = resp_next(&rp, &tok)) == RESP_OK)
+        {
+            (*tokens)++;
+            if(tok.last)
+                replies++;
+        }
+
+        if(res == RESP_ERROR)
+            return -1;
+
+        if(fed == len)
+            break;
+    }
+
+    return replies;
+}
+
+static void bench_run(const char *name, const char *buf, size_t len, int expect, size_t chunk, int rounds)
+{
+    uint64_t tokens = 0;
+    utime_t stime, etime;
+    double sec;
+    int i;
+
+    stime = utime_time();
+    for(i = 0; i < rounds; i++)
+    {
+        if(bench_parse(buf, len, chunk, &tokens) != expect)
+        {
+            fprintf(stderr, "%s: wrong number of replies\n", name);
+            exit(1);
+        }
+    }
+    etime = utime_time();
+
+    sec = (etime - stime) / 1000000.0;
+    printf("%-16s %8.1f MB/s %10.0f replies/s %10.0f tokens/s\n", name,
+            (double)len * rounds / sec / (1024 * 1024), (double)expect * rounds / sec, tokens / sec);
+}
+
+int main(int argc, char **argv)
+{
+    int rounds = argc > 1 ? atoi(argv[1]) : 200;
+    int replies;
+    size_t len;
+    char *buf;
+
+    buf = bench_corpus(&len, &replies);
+    printf("corpus %zu bytes, %d replies, %d rounds\n", len, replies, rounds);
+
+    bench_run("whole buffer", buf, len, replies, 0, rounds);
+    bench_run("1460 byte reads", buf, len, replies, 1460, rounds);
+    bench_run("64 byte reads", buf, len, replies, 64, rounds);
+
+    nalloc_free(buf);
+    return 0;
+}
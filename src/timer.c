@@ -0,0 +1,257 @@
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/timerfd.h>
+
+#include "timer.h"
+#include "logging.h"
+#include "nalloc.h"
+
+static void timer_event(struct event_loop *el, struct event *ev, uint32_t mask);
+
+static void timer_list_init(struct timer *head)
+{
+    head->next = head;
+    head->prev = head;
+}
+
+static int timer_list_empty(const struct timer *head)
+{
+    return head->next == head;
+}
+
+static void timer_list_add(struct timer *head, struct timer *t)
+{
+    t->prev = head->prev;
+    t->next = head;
+    head->prev->next = t;
+    head->prev = t;
+}
+
+static void timer_list_del(struct timer *t)
+{
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->next = NULL;
+    t->prev = NULL;
+}
+
+struct timer_wheel* timer_wheel_create(struct event_loop *el)
+{
+    struct timer_wheel *tw;
+    int fd, i, j;
+
+    fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+    if(fd < 0)
+    {
+        log_err("Timer: cannot create timerfd. %s", strerror(errno));
+        return NULL;
+    }
+
+    tw = ncalloc(sizeof(struct timer_wheel));
+    tw->el = el;
+    tw->base = utime_mono();
+
+    for(i = 0; i < TIMER_ROOT_SIZE; i++)
+        timer_list_init(&tw->root[i]);
+
+    for(i = 0; i < TIMER_LEVELS; i++)
+        for(j = 0; j < TIMER_LEVEL_SIZE; j++)
+            timer_list_init(&tw->level[i][j]);
+
+    event_init(&tw->ev, fd, timer_event, tw);
+    if(event_add(el, &tw->ev, EVENT_READ) < 0)
+    {
+        close(fd);
+        nalloc_free(tw);
+        return NULL;
+    }
+
+    return tw;
+}
+
+void timer_wheel_free(struct timer_wheel *tw)
+{
+    if(tw == NULL)
+        return;
+
+    event_del(tw->el, &tw->ev);
+    close(tw->ev.fd);
+    nalloc_free(tw);
+}
+
+void timer_init(struct timer *t, timer_proc proc, void *data)
+{
+    memset(t, 0x00, sizeof(struct timer));
+    t->proc = proc;
+    t->data = data;
+}
+
+// Put t in the slot of its expire, relative to the next tick to run.
+static void timer_place(struct timer_wheel *tw, struct timer *t)
+{
+    uint64_t delta = t->expire - tw->tick;
+    int shift = TIMER_ROOT_BITS, i;
+
+    if(delta < TIMER_ROOT_SIZE)
+    {
+        timer_list_add(&tw->root[t->expire & TIMER_ROOT_MASK], t);
+        return;
+    }
+
+    for(i = 0; i < TIMER_LEVELS - 1; i++, shift += TIMER_LEVEL_BITS)
+    {
+        if(delta < (1ULL << (shift + TIMER_LEVEL_BITS)))
+            break;
+    }
+
+    timer_list_add(&tw->level[i][(t->expire >> shift) & TIMER_LEVEL_MASK], t);
+}
+
+static void timer_arm(struct timer_wheel *tw)
+{
+    struct itimerspec its;
+    uint64_t tick, msec;
+    int i;
+
+    memset(&its, 0x00, sizeof(struct itimerspec));
+
+    if(tw->count == 0)
+    {
+        tw->armed = 0;
+    }else
+    {
+        // first non-empty root slot before the next cascade, or the cascade.
+        tick = tw->tick;
+        for(i = 0; i < TIMER_ROOT_SIZE; i++, tick++)
+        {
+            if(!timer_list_empty(&tw->root[tick & TIMER_ROOT_MASK]))
+                break;
+            if(i > 0 && (tick & TIMER_ROOT_MASK) == 0)
+                break;
+        }
+
+        if(tw->armed == tick)
+            return;
+
+        tw->armed = tick;
+        msec = tick + 1;
+        its.it_value.tv_sec = (tw->base / 1000000) + msec / 1000;
+        its.it_value.tv_nsec = (tw->base % 1000000) * 1000 + (msec % 1000) * 1000000;
+        if(its.it_value.tv_nsec >= 1000000000)
+        {
+            its.it_value.tv_sec++;
+            its.it_value.tv_nsec -= 1000000000;
+        }
+    }
+
+    if(timerfd_settime(tw->ev.fd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+        log_err("Timer: timerfd_settime failed. %s", strerror(errno));
+}
+
+// Run t after msec milliseconds. A pending t is moved.
+void timer_add(struct timer_wheel *tw, struct timer *t, uint64_t msec)
+{
+    uint64_t now = timer_now(tw);
+
+    if(timer_pending(t))
+        timer_del(tw, t);
+
+    if(msec > TIMER_MAX_TICKS)
+        msec = TIMER_MAX_TICKS;
+
+    t->expire = now + msec;
+    if(t->expire < tw->tick)
+        t->expire = tw->tick;
+
+    timer_place(tw, t);
+    tw->count++;
+
+    if(tw->armed == 0 || t->expire < tw->armed)
+        timer_arm(tw);
+}
+
+void timer_del(struct timer_wheel *tw, struct timer *t)
+{
+    if(!timer_pending(t))
+        return;
+
+    timer_list_del(t);
+    tw->count--;
+}
+
+// Move timers of the current slot of level down to lower levels.
+// Returns index of the slot, 0 means the next level needs cascading too.
+static int timer_cascade(struct timer_wheel *tw, int level)
+{
+    struct timer head, *t;
+    int shift = TIMER_ROOT_BITS + level * TIMER_LEVEL_BITS;
+    int idx = (tw->tick >> shift) & TIMER_LEVEL_MASK;
+
+    if(timer_list_empty(&tw->level[level][idx]))
+        return idx;
+
+    // splice the slot out, then place each timer again.
+    head.next = tw->level[level][idx].next;
+    head.prev = tw->level[level][idx].prev;
+    head.next->prev = &head;
+    head.prev->next = &head;
+    timer_list_init(&tw->level[level][idx]);
+
+    while(!timer_list_empty(&head))
+    {
+        t = head.next;
+        timer_list_del(t);
+        timer_place(tw, t);
+    }
+
+    return idx;
+}
+
+static void timer_run(struct timer_wheel *tw, uint64_t now)
+{
+    struct timer *head, *t;
+    int level;
+
+    while(tw->tick <= now)
+    {
+        if(tw->count == 0)
+        {
+            tw->tick = now + 1;
+            break;
+        }
+
+        if((tw->tick & TIMER_ROOT_MASK) == 0)
+        {
+            for(level = 0; level < TIMER_LEVELS; level++)
+            {
+                if(timer_cascade(tw, level) != 0)
+                    break;
+            }
+        }
+
+        head = &tw->root[tw->tick & TIMER_ROOT_MASK];
+        while(!timer_list_empty(head))
+        {
+            t = head->next;
+            timer_list_del(t);
+            tw->count--;
+            t->proc(tw, t);
+        }
+
+        tw->tick++;
+    }
+}
+
+static void timer_event(struct event_loop *el, struct event *ev, uint32_t mask)
+{
+    struct timer_wheel *tw = (struct timer_wheel*) ev->data;
+    uint64_t expired;
+
+    if(read(ev->fd, &expired, sizeof(expired)) < 0 && errno != EAGAIN)
+        log_warn("Timer: read timerfd failed. %s", strerror(errno));
+
+    tw->armed = 0;
+    timer_run(tw, timer_now(tw));
+    timer_arm(tw);
+}
@@ -0,0 +1,73 @@
+#ifndef _TIMER_H_
+#define _TIMER_H_
+
+#include <stdint.h>
+
+#include "event.h"
+#include "utime.h"
+
+// Hierarchical timing wheel of 1 msec ticks driven by a timerfd.
+// Adding, removing and expiring a timer is O(1); the timerfd is armed for
+// the next non-empty slot only, so an idle wheel never wakes up.
+#define TIMER_ROOT_BITS     8
+#define TIMER_ROOT_SIZE     (1 << TIMER_ROOT_BITS)
+#define TIMER_ROOT_MASK     (TIMER_ROOT_SIZE - 1)
+#define TIMER_LEVEL_BITS    6
+#define TIMER_LEVEL_SIZE    (1 << TIMER_LEVEL_BITS)
+#define TIMER_LEVEL_MASK    (TIMER_LEVEL_SIZE - 1)
+#define TIMER_LEVELS        4
+#define TIMER_MAX_TICKS     ((1ULL << (TIMER_ROOT_BITS + TIMER_LEVELS * TIMER_LEVEL_BITS)) - 1)
+
+struct timer_wheel;
+struct timer;
+
+typedef void (*timer_proc)(struct timer_wheel *tw, struct timer *t);
+
+// Owned by the caller, usually embedded in the structure it belongs to.
+struct timer
+{
+    struct timer *next;
+    struct timer *prev;
+    uint64_t expire;
+    timer_proc proc;
+    void *data;
+};
+
+struct timer_wheel
+{
+    struct event_loop *el;
+    struct event ev;
+
+    // usec of monotonic clock at tick 0
+    utime_t base;
+
+    // next tick to run
+    uint64_t tick;
+
+    // tick the timerfd is armed for, 0 when disarmed
+    uint64_t armed;
+
+    int count;
+
+    struct timer root[TIMER_ROOT_SIZE];
+    struct timer level[TIMER_LEVELS][TIMER_LEVEL_SIZE];
+};
+
+struct timer_wheel* timer_wheel_create(struct event_loop *el);
+void timer_wheel_free(struct timer_wheel *tw);
+void timer_init(struct timer *t, timer_proc proc, void *data);
+void timer_add(struct timer_wheel *tw, struct timer *t, uint64_t msec);
+void timer_del(struct timer_wheel *tw, struct timer *t);
+
+static inline int timer_pending(const struct timer *t)
+{
+    return t->next != NULL;
+}
+
+// Milliseconds since the wheel was created.
+static inline uint64_t timer_now(const struct timer_wheel *tw)
+{
+    return (utime_mono() - tw->base) / 1000;
+}
+
+#endif // _TIMER_H_
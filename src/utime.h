@@ -4,6 +4,7 @@
 #include <sys/time.h>
 #include <stdint.h>
 #include <unistd.h>
+#include <time.h>
 
 #define utime_t     uint64_t
 
@@ -14,6 +15,14 @@ static inline const uint64_t utime_time()
 	return ((uint64_t)(t.tv_sec*1000000) + (uint64_t)t.tv_usec);
 }
 
+// @brief Get monotonic time in usec, not affected by clock changes
+static inline uint64_t utime_mono()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return ((uint64_t)t.tv_sec*1000000) + (uint64_t)(t.tv_nsec/1000);
+}
+
 // @brief Get cpu time
 static inline uint64_t utime_cpu()
 {
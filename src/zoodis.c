@@ -7,6 +7,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/signalfd.h>
 #include <fcntl.h>
 
 #include "zoodis.h"
@@ -16,14 +17,23 @@
 
 static struct zoodis zoodis;
 
+static void redis_check_timer(struct timer_wheel *tw, struct timer *t);
+static void redis_restart_timer(struct timer_wheel *tw, struct timer *t);
+static void redis_stop_timer(struct timer_wheel *tw, struct timer *t);
+static void redis_stop_reply(struct instance *inst, struct probe *p, enum probe_res res);
+static void redis_probe_setup(struct instance *inst);
+static void redis_promote_req(struct instance *inst);
+static void redis_promote_done(struct instance *inst, struct probe *p, enum probe_res res);
+static void redis_latency_timer(struct timer_wheel *tw, struct timer *t);
+static void zu_retry_timer(struct timer_wheel *tw, struct timer *t);
+static void instance_election_addr(struct zoodis *z, struct instance *inst);
+static void redis_replicaof_send(struct instance *inst);
+static void redis_replicaof_done(struct instance *inst, struct probe *p, enum probe_res res);
+
 int main(int argc, char *argv[])
 {
-    signal(SIGCHLD, signal_sigchld);
-    signal(SIGINT, signal_sigint);
-    signal(SIGPIPE, signal_sigint);
-    signal(SIGTERM, signal_sigint);
-    signal(SIGTSTP, signal_sigint);
-    signal(SIGHUP, signal_sigint);
+    // read from a signalfd by the main loop, see signal_init().
+    signal_block(SIG_BLOCK);
 
     log_level(_LOG_DEBUG);
 
@@ -33,16 +43,29 @@ int main(int argc, char *argv[])
     zoodis.zoo_timeout                  = DEFAULT_ZOO_TIMEOUT;
     zoodis.zoo_connect_wait_interval    = DEFAULT_ZOO_CONNECT_WAIT_INTERVAL;
 
-    zoodis.redis_port                   = DEFAULT_REDIS_PORT;
-    zoodis.redis_ip                     = mstr_alloc_dup(DEFAULT_REDIS_IP, strlen(DEFAULT_REDIS_IP));
+    zoodis.redis_port                   = 0;
+    zoodis.redis_ip                     = NULL;
     zoodis.redis_ping_interval          = DEFAULT_REDIS_PING_INTERVAL;
-    zoodis.redis_pong_timeout_sec       = DEFAULT_REDIS_PONG_TIMEOUT_SEC;
-    zoodis.redis_pong_timeout_usec      = DEFAULT_REDIS_PONG_TIMEOUT_USEC;
+    zoodis.redis_ping_jitter            = DEFAULT_REDIS_PING_JITTER;
+    zoodis.redis_ready_timeout          = DEFAULT_REDIS_READY_TIMEOUT;
+    zoodis.redis_loading_stall          = DEFAULT_REDIS_LOADING_STALL;
+    zoodis.redis_prewarm_threads        = DEFAULT_PREWARM_THREADS;
+    zoodis.redis_connect_timeout        = DEFAULT_REDIS_CONNECT_TIMEOUT;
+    zoodis.redis_write_timeout          = DEFAULT_REDIS_WRITE_TIMEOUT;
+    zoodis.redis_pong_timeout           = DEFAULT_REDIS_PONG_TIMEOUT;
+    zoodis.redis_stop_timeout           = DEFAULT_REDIS_STOP_TIMEOUT;
+    zoodis.restart_backoff_max          = DEFAULT_RESTART_BACKOFF_MAX;
+    zoodis.restart_budget               = DEFAULT_RESTART_BUDGET;
+    zoodis.restart_budget_window        = DEFAULT_RESTART_BUDGET_WINDOW;
+    zoodis.restart_quarantine           = DEFAULT_RESTART_QUARANTINE;
     zoodis.redis_max_fail_count         = DEFAULT_REDIS_MAX_FAIL_COUNT;
+    zoodis.failure_detector             = FAILURE_DETECTOR_COUNT;
+    zoodis.phi_threshold                = DEFAULT_PHI_THRESHOLD;
+    zoodis.zoo_nodedata_threshold       = DEFAULT_NODEDATA_THRESHOLD;
+    zoodis.zoo_batch_window             = DEFAULT_ZOO_BATCH_WINDOW;
+    zoodis.latency_window               = DEFAULT_LATENCY_WINDOW;
     zoodis.pid_file                     = NULL;
 
-    zoodis.redis_stat = REDIS_STAT_NONE;
-
     static struct option long_options[] =
     {
         {"help",                no_argument,        0,  'h'},
@@ -55,21 +78,64 @@ int main(int argc, char *argv[])
         {"redis-conf",          required_argument,  0,  'c'},
         {"redis-ip",            required_argument,  0,  'I'},
         {"redis-port",          required_argument,  0,  'r'},
+        {"redis-socket",        required_argument,  0,  'u'},
         {"redis-ping-interval", required_argument,  0,  's'},
+        {"redis-ping-jitter",   required_argument,  0,  'j'},
+        {"redis-ready-timeout", required_argument,  0,  'E'},
+        {"redis-loading-stall", required_argument,  0,  'S'},
+        {"redis-prewarm",       no_argument,        0,  'w'},
+        {"redis-prewarm-threads",required_argument, 0,  'A'},
         {"redis-max-fail-count",required_argument,  0,  'm'},
+        {"failure-detector",    required_argument,  0,  'D'},
+        {"phi-threshold",       required_argument,  0,  'T'},
+        {"redis-connect-timeout",required_argument, 0,  'C'},
+        {"redis-write-timeout", required_argument,  0,  'W'},
+        {"redis-pong-timeout",  required_argument,  0,  'P'},
+        {"redis-probe",         required_argument,  0,  'R'},
+        {"redis-shutdown",      required_argument,  0,  'O'},
+        {"redis-stop-timeout",  required_argument,  0,  'K'},
+        {"redis-standby-port",  required_argument,  0,  'B'},
+        {"redis-announce-ip",   required_argument,  0,  'a'},
+        {"restart-backoff-max", required_argument,  0,  'G'},
+        {"restart-budget",      required_argument,  0,  'Q'},
+        {"restart-quarantine",  required_argument,  0,  'U'},
+        {"latency-window",      required_argument,  0,  'L'},
+        {"instance",            required_argument,  0,  'N'},
+        {"instance-file",       required_argument,  0,  'F'},
         {"zoo-host",            required_argument,  0,  'z'},
         {"zoo-path",            required_argument,  0,  'p'},
         {"zoo-nodename",        required_argument,  0,  'n'},
         {"zoo-nodedata",        required_argument,  0,  'd'},
         {"zoo-timeout",         required_argument,  0,  't'},
+        {"zoo-retry-interval",  required_argument,  0,  'Y'},
+        {"zoo-nodedata-latency",no_argument,        0,  'y'},
+        {"zoo-nodedata-loading",no_argument,        0,  'x'},
+        {"zoo-session-file",    required_argument,  0,  'Z'},
+        {"zoo-nodedata-format", required_argument,  0,  'M'},
+        {"zoo-nodedata-threshold",required_argument,0,  'H'},
+        {"zoo-batch-window",    required_argument,  0,  'o'},
+        {"zoo-election",        no_argument,        0,  'e'},
+        {"proxy-listen",        required_argument,  0,  'X'},
         {0, 0, 0, 0}
     };
 
     enum zoo_res zres;
+    struct instance *inst;
+    int i;
+    const char *redis_probe = DEFAULT_REDIS_PROBE;
+    const char *redis_shutdown = DEFAULT_REDIS_SHUTDOWN;
+
+    // --instance and --instance-file are parsed after all the other
+    // options, because their default values come from those.
+    char **instance_specs = NULL;
+    int instance_spec_count = 0;
+    const char *instance_file = NULL;
 
     if(argc < 3)
         print_help(argv);
 
+    instance_specs = ncalloc(sizeof(char*) * argc);
+
     while (1)
     {
         /* getopt_long stores the option index here. */
@@ -104,7 +170,7 @@ int main(int argc, char *argv[])
                 zoodis.pid_file = check_pid_file(optarg);
 
             case 'i':
-                zoodis.keepalive_interval = check_option_int(optarg, DEFAULT_KEEPALIVE_INTERVAL);
+                zoodis.keepalive_interval = check_option_msec(optarg, DEFAULT_KEEPALIVE_INTERVAL, 1000);
                 break;
 
             case 'b':
@@ -123,14 +189,106 @@ int main(int argc, char *argv[])
                 zoodis.redis_ip = mstr_alloc_dup(optarg, strlen(optarg));
                 break;
 
+            case 'u':
+                zoodis.redis_socket = check_redis_socket(optarg);
+                break;
+
             case 's':
-                zoodis.redis_ping_interval = check_option_int(optarg, DEFAULT_REDIS_PING_INTERVAL);
+                zoodis.redis_ping_interval = check_option_msec(optarg, DEFAULT_REDIS_PING_INTERVAL, 1000);
+                break;
+
+            case 'j':
+                zoodis.redis_ping_jitter = atoi(optarg);
+                if(zoodis.redis_ping_jitter < 0 || zoodis.redis_ping_jitter > 100)
+                    zoodis.redis_ping_jitter = DEFAULT_REDIS_PING_JITTER;
+                break;
+
+            case 'E':
+                zoodis.redis_ready_timeout = check_option_msec(optarg, DEFAULT_REDIS_READY_TIMEOUT, 1);
+                break;
+
+            case 'S':
+                zoodis.redis_loading_stall = check_option_msec(optarg, DEFAULT_REDIS_LOADING_STALL, 1000);
+                break;
+
+            case 'w':
+                zoodis.redis_prewarm = 1;
+                break;
+
+            case 'A':
+                zoodis.redis_prewarm_threads = check_option_int(optarg, DEFAULT_PREWARM_THREADS);
                 break;
 
             case 'm':
                 zoodis.redis_max_fail_count = check_option_int(optarg, DEFAULT_REDIS_MAX_FAIL_COUNT);
                 break;
 
+            case 'D':
+                zoodis.failure_detector = check_failure_detector(optarg);
+                break;
+
+            case 'T':
+                zoodis.phi_threshold = atof(optarg);
+                if(zoodis.phi_threshold <= 0)
+                    zoodis.phi_threshold = DEFAULT_PHI_THRESHOLD;
+                break;
+
+            case 'C':
+                zoodis.redis_connect_timeout = check_option_int(optarg, DEFAULT_REDIS_CONNECT_TIMEOUT);
+                break;
+
+            case 'W':
+                zoodis.redis_write_timeout = check_option_int(optarg, DEFAULT_REDIS_WRITE_TIMEOUT);
+                break;
+
+            case 'P':
+                zoodis.redis_pong_timeout = check_option_int(optarg, DEFAULT_REDIS_PONG_TIMEOUT);
+                break;
+
+            case 'R':
+                redis_probe = optarg;
+                break;
+
+            case 'O':
+                redis_shutdown = optarg;
+                break;
+
+            case 'K':
+                zoodis.redis_stop_timeout = check_option_msec(optarg, DEFAULT_REDIS_STOP_TIMEOUT, 1000);
+                break;
+
+            case 'B':
+                zoodis.redis_standby_port = check_option_int(optarg, 0);
+                break;
+
+            case 'a':
+                zoodis.redis_announce_ip = mstr_alloc_dup(optarg, strlen(optarg));
+                break;
+
+            case 'G':
+                zoodis.restart_backoff_max = check_option_msec(optarg, DEFAULT_RESTART_BACKOFF_MAX, 1000);
+                break;
+
+            case 'Q':
+                check_restart_budget(&zoodis, optarg);
+                break;
+
+            case 'U':
+                zoodis.restart_quarantine = check_option_msec(optarg, DEFAULT_RESTART_QUARANTINE, 1000);
+                break;
+
+            case 'L':
+                zoodis.latency_window = check_option_int(optarg, DEFAULT_LATENCY_WINDOW);
+                break;
+
+            case 'N':
+                instance_specs[instance_spec_count++] = optarg;
+                break;
+
+            case 'F':
+                instance_file = optarg;
+                break;
+
             case 'z':
                 zoodis.zoo_host = check_zoo_host(optarg);
                 break;
@@ -151,71 +309,146 @@ int main(int argc, char *argv[])
                 zoodis.zoo_timeout = check_option_int(optarg, DEFAULT_ZOO_TIMEOUT);
                 break;
 
+            case 'Y':
+                zoodis.zoo_connect_wait_interval = check_option_msec(optarg, DEFAULT_ZOO_CONNECT_WAIT_INTERVAL, 1);
+                break;
+
+            case 'y':
+                zoodis.zoo_nodedata_latency = 1;
+                break;
+
+            case 'x':
+                zoodis.zoo_nodedata_loading = 1;
+                break;
+
+            case 'Z':
+                zoodis.zoo_session_file = optarg;
+                break;
+
+            case 'M':
+                zoodis.zoo_nodedata_format = check_nodedata_format(optarg);
+                break;
+
+            case 'H':
+                zoodis.zoo_nodedata_threshold = atoi(optarg);
+                if(zoodis.zoo_nodedata_threshold < 0)
+                    zoodis.zoo_nodedata_threshold = DEFAULT_NODEDATA_THRESHOLD;
+                break;
+
+            case 'o':
+                if(strcmp(optarg, "0") == 0)
+                    zoodis.zoo_batch_window = 0;
+                else
+                    zoodis.zoo_batch_window = check_option_msec(optarg, DEFAULT_ZOO_BATCH_WINDOW, 1);
+                break;
+
+            case 'e':
+                zoodis.zoo_election = 1;
+                break;
+
+            case 'X':
+                zoodis.proxy_listen = optarg;
+                break;
+
             default:
                 exit_proc(-1);
         }
     }
 
-
-    zoodis.zookeeper = check_zoo_options(&zoodis);
-
     if(zoodis.zoo_nodedata == NULL)
         zoodis.zoo_nodedata = mstr_alloc_dup(DEFAULT_ZOO_NODEDATA, strlen(DEFAULT_ZOO_NODEDATA));
 
-    check_redis_options(&zoodis);
+    check_redis_probe(&zoodis, redis_probe);
+    check_redis_shutdown(&zoodis, redis_shutdown);
 
-    if(zoodis.zookeeper)
+    for(i = 0; i < instance_spec_count; i++)
+        instance_add(&zoodis, instance_parse(&zoodis, instance_specs[i]));
+
+    if(instance_file != NULL)
+        instance_load_file(&zoodis, instance_file);
+
+    nalloc_free(instance_specs);
+
+    // without --instance options, the --redis-* options describe the only one.
+    if(zoodis.instance_count == 0)
+        instance_add(&zoodis, instance_alloc(&zoodis));
+
+    // instances hold datasets of their own, a proxy forwards to one.
+    if(zoodis.proxy_listen != NULL)
     {
-        zoodis.zoo_nodepath = mstr_concat(3, zoodis.zoo_path->data, "/", zoodis.zoo_nodename->data);
-        zu_set_log_level(log_level(0));
-        zu_set_log_stream(log_fd(stdout));
-        zres = zu_connect(&zoodis);
-        if(zres != ZOO_RES_OK)
+        if(zoodis.instance_count > 1)
         {
+            log_err("--proxy-listen with %d instances, use proxy= of --instance.", zoodis.instance_count);
             exit_proc(-1);
         }
+        zoodis.instances[0]->proxy_listen = zoodis.proxy_listen;
     }
 
-    log_msg("Start zoodis.");
+    zoodis.zookeeper = check_zoo_options(&zoodis);
 
-    exec_redis();
-    redis_health();
-    return 0;
-}
+    zoodis.el = event_loop_create(zoodis.instance_count * 2 + 1);
+    if(zoodis.el == NULL)
+        exit_proc(-1);
 
-void zu_con_watcher(zhandle_t *zh, int type, int state, const char *path, void *data)
-{
-    struct zoodis *z = (struct zoodis*) data;
-    log_info("Zookeeper: Connection status changed. type:%d state:%d", type, state);
+    zoodis.tw = timer_wheel_create(zoodis.el);
+    if(zoodis.tw == NULL)
+        exit_proc(-1);
+
+    if(signal_init(&zoodis) < 0)
+        exit_proc(-1);
+
+    // spread probes of instances, they should not fire in lockstep.
+    srandom((unsigned int)(getpid() ^ utime_time()));
 
-    if(state == ZOO_CONNECTED_STATE)
+    for(i = 0; i < zoodis.instance_count; i++)
     {
-        log_info("Zookeeper: connected.");
-        z->zoo_stat = ZOO_STAT_CONNECTED;
+        inst = zoodis.instances[i];
+        if(inst->redis_standby_port != 0)
+            instance_standby(inst);
+
+        instance_init(&zoodis, inst);
+        if(inst->standby != NULL)
+            instance_init(&zoodis, inst->standby);
     }
-}
 
-enum zoo_res zu_connect(struct zoodis *z)
-{
-    zhandle_t *zh = zookeeper_init(z->zoo_host->data, zu_con_watcher, z->zoo_timeout, z->zid, z, 0);
-    zoodis.zoo_stat = ZOO_STAT_CONNECTIONG;
+    for(i = 0; i < zoodis.instance_count; i++)
+    {
+        inst = zoodis.instances[i];
+        if(inst->proxy_listen == NULL)
+            continue;
 
-    log_info("Zookeeper: Trying to connect to zookeeper %s", z->zoo_host->data);
+        if(proxy_listen(&inst->proxy, zoodis.el, zoodis.tw, inst->proxy_listen) < 0)
+            exit_proc(-1);
+        inst->proxy.connect_timeout = zoodis.redis_connect_timeout;
+    }
 
-    if(!zh)
+    if(zoodis.zookeeper)
     {
-        log_err("Zookeeper: Cannot initialize zhandle.");
-        log_err("Zookeeper: -- %s", strerror(errno));
-        zoodis.zoo_stat = ZOO_STAT_NOT_CONNECTED;
-        return ZOO_RES_ERROR;
+        zu_set_log_level(log_level(0));
+        zu_set_log_stream(log_fd(stdout));
+        if(zu_queue_init(&zoodis) < 0)
+            exit_proc(-1);
+
+        zu_session_load(&zoodis);
+        zres = zu_connect(&zoodis);
+        if(zres != ZOO_RES_OK)
+        {
+            exit_proc(-1);
+        }
     }
 
-    z->zh = zh;
-    z->zid = zoo_client_id(zh);
+    log_msg("Start zoodis. %d instance(s).", zoodis.instance_count);
 
-    return ZOO_RES_OK;
-}
+    for(i = 0; i < zoodis.instance_count; i++)
+    {
+        redis_start(zoodis.instances[i]);
+        if(zoodis.instances[i]->standby != NULL)
+            redis_start(zoodis.instances[i]->standby);
+    }
 
+    redis_health();
+    return 0;
+}
 
 void set_logging(char *optarg)
 {
@@ -242,229 +475,12 @@ void set_logging(char *optarg)
 //    zu_set_log_level(log_level(0));
 }
 
-void zu_set_log_stream(FILE *fd)
-{
-    zoo_set_log_stream(fd);
-}
-
-void zu_set_log_level(int level)
-{
-
-    switch(level)
-    {
-    case _LOG_DEBUG:
-        zoo_set_debug_level(ZOO_LOG_LEVEL_DEBUG);
-        break;
-    case _LOG_INFO:
-        zoo_set_debug_level(ZOO_LOG_LEVEL_INFO);
-        break;
-    case _LOG_WARN:
-        zoo_set_debug_level(ZOO_LOG_LEVEL_WARN);
-        break;
-    case _LOG_ERR:
-        zoo_set_debug_level(ZOO_LOG_LEVEL_ERROR);
-        break;
-    default:
-        zoo_set_debug_level(ZOO_LOG_LEVEL_INFO);
-        break;
-    }
-}
-
-void zu_return_print(const char *f, int l, int ret)
-{
-    switch(ret)
-    {
-    case ZOK:
-        log_info("%s(%d) Zookeeper: OK.", f, l);
-        break;
-
-    case ZSYSTEMERROR:
-        log_err("%s(%d) Zookeeper: System error.", f, l);
-        break;
-
-    case ZRUNTIMEINCONSISTENCY:
-        log_err("%s(%d) Zookeeper: A runtime inconsistency was found.", f, l);
-        break;
-
-    case ZDATAINCONSISTENCY:
-        log_err("%s(%d) Zookeeper: A data inconsistency was found.", f, l);
-        break;
-
-    case ZCONNECTIONLOSS:
-        log_err("%s(%d) Zookeeper: Connection to the server has been lost.", f, l);
-        break;
-
-    case ZMARSHALLINGERROR:
-        log_err("%s(%d) Zookeeper: Error while marshalling or unmarshalling data.", f, l);
-        break;
-
-    case ZUNIMPLEMENTED:
-        log_err("%s(%d) Zookeeper: Operation is unimplemented.", f, l);
-        break;
-
-    case ZOPERATIONTIMEOUT:
-        log_err("%s(%d) Zookeeper: Operation timeout.", f, l);
-        break;
-
-    case ZBADARGUMENTS:
-        log_err("%s(%d) Zookeeper: Invalid arguments.", f, l);
-        break;
-
-    case ZINVALIDSTATE:
-        log_err("%s(%d) Zookeeper: Invliad zhandle state.", f, l);
-        break;
-
-    case ZAPIERROR:
-        log_err("%s(%d) Zookeeper: API errors.", f, l);
-        break;
-
-    case ZNONODE:
-        log_err("%s(%d) Zookeeper: Node does not exist.", f, l);
-        break;
-
-    case ZNOAUTH:
-        log_err("%s(%d) Zookeeper: Not authenticated.", f, l);
-        break;
-
-    case ZBADVERSION:
-        log_err("%s(%d) Zookeeper: Version conflict.", f, l);
-        break;
-
-    case ZNOCHILDRENFOREPHEMERALS:
-        log_err("%s(%d) Zookeeper: Ephemeral nodes may not have children.", f, l);
-        break;
-
-    case ZNODEEXISTS:
-        log_err("%s(%d) Zookeeper: The node already exists.", f, l);
-        break;
-
-    case ZNOTEMPTY:
-        log_err("%s(%d) Zookeeper: The node has children.", f, l);
-        break;
-
-    case ZSESSIONEXPIRED:
-        log_err("%s(%d) Zookeeper: The session has been expired by the server.", f, l);
-        break;
-
-    case ZINVALIDCALLBACK:
-        log_err("%s(%d) Zookeeper: Invalid callback specified.", f, l);
-        break;
-
-    case ZINVALIDACL:
-        log_err("%s(%d) Zookeeper: Invalid ACL specifie.", f, l);
-        break;
-
-    case ZAUTHFAILED:
-        log_err("%s(%d) Zookeeper: Client authentication faile.", f, l);
-        break;
-
-    case ZCLOSING:
-        log_err("%s(%d) Zookeeper: ZooKeeper is closin.", f, l);
-        break;
-
-    case ZNOTHING:
-        log_err("%s(%d) Zookeeper: (not error) no server responses to process.", f, l);
-        break;
-
-    case ZSESSIONMOVED:
-        log_err("%s(%d) Zookeeper: Session moved to another server, so operation is ignored.", f, l);
-        break;
-
-    default:
-        log_err("%s(%d) Zookeeper: Unknown error(%d)", f, l, ret);
-    }
-}
-
-enum zoo_res zu_ephemeral_update(struct zoodis *z)
-{
-    if(!zoodis.zookeeper)
-        return ZOO_RES_OK;
-
-    if(zoodis.zoo_stat != ZOO_STAT_CONNECTED)
-    {
-        log_err("Zookeeper: not connected yet. STAT:%d", zoodis.zoo_stat);
-        return ZOO_RES_ERROR;
-    }
-
-
-    if(zoodis.redis_stat == REDIS_STAT_OK)
-        return zu_create_ephemeral(z);
-    else
-        return zu_remove_ephemeral(z);
-}
-
-
-enum zoo_res zu_create_ephemeral(struct zoodis *z)
-{
-    int res;
-    int bufsize = 512;
-    char buffer[bufsize]; // no reason, added due to some of example, need to be done.
-    int buffer_len = bufsize;
-    memset(buffer, 0x00, bufsize);
-
-    res = zoo_get(z->zh, z->zoo_nodepath->data, 0, buffer, &buffer_len, 0);
-
-    if(res == ZOK)
-    {
-        if(buffer_len == z->zoo_nodedata->len && strncmp(z->zoo_nodedata->data, buffer, z->zoo_nodedata->len) == 0)
-        {
-            return ZOO_RES_OK;
-        }else
-        {
-            zu_remove_ephemeral(z);
-        }
-    }else if(res != ZOK && res != ZNONODE)
-    {
-        ZU_RETURN_PRINT(res);
-        if(res == ZINVALIDSTATE)
-        {
-            zookeeper_close(z->zh);
-            zoodis.zoo_stat = ZOO_STAT_NOT_CONNECTED;
-            z->zid = NULL;
-            log_warn("Zookeeper: error, trying to re-connect.");
-            zu_connect(z);
-        }
-        // exit_proc(-1);
-    }
-
-    res = zoo_create(z->zh, z->zoo_nodepath->data, z->zoo_nodedata->data, strlen(z->zoo_nodedata->data), &ZOO_READ_ACL_UNSAFE, ZOO_EPHEMERAL, buffer, sizeof(buffer)-1);
-    if(res != ZOK)
-    {
-        ZU_RETURN_PRINT(res);
-        if(res == ZINVALIDSTATE)
-        {
-            zookeeper_close(z->zh);
-            zoodis.zoo_stat = ZOO_STAT_NOT_CONNECTED;
-            z->zid = NULL;
-            log_warn("Zookeeper: error, trying to re-connect.");
-            zu_connect(z);
-        }
-    }
-
-    return ZOO_RES_OK;
-}
-
-enum zoo_res zu_remove_ephemeral(struct zoodis *z)
+static void zu_retry_timer(struct timer_wheel *tw, struct timer *t)
 {
-    int res;
-
-    res =  zoo_delete(z->zh, z->zoo_nodepath->data, -1);
-    
-    if(res != ZOK && res != ZNONODE)
-    {
-        ZU_RETURN_PRINT(res);
-        if(res == ZINVALIDSTATE)
-        {
-            zookeeper_close(z->zh);
-            zoodis.zoo_stat = ZOO_STAT_NOT_CONNECTED;
-            z->zid = NULL;
-            log_warn("Zookeeper: error, trying to re-connect.");
-            zu_connect(z);
-        }
-        //exit_proc(-1);
-    }
+    struct instance *inst = (struct instance*) t->data;
 
-    return ZOO_RES_OK;
+    log_info("Zookeeper: retry updating node. instance:%s", inst->name->data);
+    zu_ephemeral_update(&zoodis, inst);
 }
 
 struct mstr* check_redis_bin(char *optarg)
@@ -508,6 +524,26 @@ struct mstr* check_redis_bin(char *optarg)
     }
 }
 
+// The socket is created by redis-server, it need not exist yet.
+struct mstr* check_redis_socket(char *optarg)
+{
+    struct sockaddr_un un;
+
+    if(strlen(optarg) == 0)
+    {
+        log_err("path of redis-socket option must not be empty.");
+        exit_proc(-1);
+    }
+
+    if(strlen(optarg) >= sizeof(un.sun_path))
+    {
+        log_err("%s is longer than %zu, too long for a unix socket.", optarg, sizeof(un.sun_path)-1);
+        exit_proc(-1);
+    }
+
+    return mstr_alloc_dup(optarg, strlen(optarg));
+}
+
 struct mstr* check_redis_conf(char *optarg)
 {
     struct stat stat_bin;
@@ -570,406 +606,2296 @@ int check_option_int(char *optarg, int def)
         return def;
 }
 
-int check_keepalive_interval(char *optarg)
+// Interval in msec. "500ms" and "2s" are taken as is,
+// a bare number is in unit msec, as "3" of a seconds option.
+int check_option_msec(char *optarg, int def, int unit)
 {
-    int i = atoi(optarg);
-    if(i > 0)
-        return i;
+    char *end;
+    double d = strtod(optarg, &end);
+
+    if(strcmp(end, "ms") == 0)
+        unit = 1;
+    else if(strcmp(end, "s") == 0)
+        unit = 1000;
+    else if(*end != '\0')
+        return def;
+
+    d *= unit;
+    if(d >= 1 && d <= 0x7fffffff)
+        return (int)d;
     else
-        return DEFAULT_KEEPALIVE_INTERVAL;
+        return def;
 }
 
-struct mstr* check_zoo_host(char *optarg)
+static void redis_probe_append(struct redis_req *r, enum redis_cmd cmd, int argc, const char **argv)
 {
-    if(optarg == NULL || strlen(optarg) == 0)
-        return NULL;
-    return mstr_alloc_dup(optarg, strlen(optarg));
-}
+    char head[32];
+    struct mstr *req = r->data;
+    int i;
 
-struct mstr* check_zoo_path(char *optarg)
-{
-    if(optarg == NULL || strlen(optarg) == 0)
-        return NULL;
-    return mstr_alloc_dup(optarg, strlen(optarg));
-}
+    if(r->count >= REDIS_PROBE_MAX)
+    {
+        log_err("--redis-probe accepts %d commands at most.", REDIS_PROBE_MAX);
+        exit_proc(-1);
+    }
 
-struct mstr* check_zoo_nodename(char *optarg)
-{
-    if(optarg == NULL || strlen(optarg) == 0)
-        return NULL;
-    return mstr_alloc_dup(optarg, strlen(optarg));
-}
+    r->cmds[r->count++] = cmd;
 
-struct mstr* check_zoo_nodedata(char *optarg)
-{
-    if(optarg == NULL || strlen(optarg) == 0)
-        return NULL;
-    
-    return mstr_alloc_dup(optarg, strlen(optarg));
+    snprintf(head, sizeof(head), "*%d\r\n", argc);
+    r->data = mstr_concat(2, req == NULL ? "" : (char*)req->data, head);
+    if(req != NULL)
+        mstr_free_dup(req);
+
+    for(i = 0; i < argc; i++)
+    {
+        req = r->data;
+        snprintf(head, sizeof(head), "$%zu\r\n", strlen(argv[i]));
+        r->data = mstr_concat(4, (char*)req->data, head, argv[i], "\r\n");
+        mstr_free_dup(req);
+    }
 }
 
-int check_redis_options(struct zoodis *zoodis)
+// DST is SRC led by AUTH when PASS is not empty, or SRC as is.
+static void redis_req_auth(struct redis_req *dst, const struct redis_req *src, const char *pass)
 {
-    if(zoodis->redis_bin == NULL || zoodis->redis_conf == NULL)
+    const char *argv[2];
+    struct mstr *req;
+
+    if(pass[0] == '\0')
+    {
+        *dst = *src;
+        return;
+    }
+
+    memset(dst, 0x00, sizeof(struct redis_req));
+    argv[0] = "AUTH";
+    argv[1] = pass;
+    redis_probe_append(dst, REDIS_CMD_AUTH, 2, argv);
+    dst->auth_len = dst->data->len;
+
+    if(src->count + 1 > REDIS_PROBE_MAX)
     {
-        log_err("--redis-bin, --redis-conf are mandatory.");
+        log_err("--redis-probe accepts %d commands at most with AUTH.", REDIS_PROBE_MAX - 1);
         exit_proc(-1);
     }
 
-    if(zoodis->redis_port == 0)
-        zoodis->redis_port = DEFAULT_REDIS_PORT;
+    memcpy(dst->cmds + 1, src->cmds, sizeof(enum redis_cmd) * src->count);
+    dst->count += src->count;
 
-    memset(&zoodis->redis_addr, 0, sizeof(struct sockaddr_in));
+    req = dst->data;
+    dst->data = mstr_concat(2, (char*)req->data, (char*)src->data->data);
+    mstr_free_dup(req);
+}
 
-    zoodis->redis_addr.sin_family = AF_INET;
-    zoodis->redis_addr.sin_port = htons(zoodis->redis_port);
-    zoodis->redis_addr.sin_addr.s_addr = inet_addr(zoodis->redis_ip->data);
+// LIST is comma separated commands of a probe, all of them are pipelined.
+// ping, role, info and info:SECTION are allowed, as "ping,info:replication,role".
+static int redis_req_has(const struct redis_req *r, enum redis_cmd cmd)
+{
+    int i;
 
-    return 1;
+    for(i = 0; i < r->count; i++)
+        if(r->cmds[i] == cmd)
+            return 1;
+    return 0;
 }
 
-const char* check_pid_file(const char *pid_file)
+int check_redis_probe(struct zoodis *zoodis, const char *optarg)
 {
-    int fd, res;
-    pid_t pid = getpid();
-    struct flock flock;
+    char *buf, *save, *tok;
+    const char *argv[2];
 
+    argv[0] = "PING";
+    redis_probe_append(&zoodis->redis_probe_req, REDIS_CMD_PING, 1, argv);
 
-    zoodis.pid_fp = fopen(pid_file, "r+");
-    if(zoodis.pid_fp == NULL)
+    buf = nalloc_duplen((void*)optarg, strlen(optarg)+1);
+    for(tok = strtok_r(buf, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save))
     {
-        zoodis.pid_fp = fopen(pid_file, "w");
-        if(zoodis.pid_fp == NULL)
+        if(strcasecmp(tok, "ping") == 0)
         {
-            log_err("Cannot open pid file %s, %s", pid_file, strerror(errno));
-            exit_proc(-1);
-        }
+            continue;
+        }else if(strcasecmp(tok, "role") == 0)
+        {
+            argv[0] = "ROLE";
+            redis_probe_append(&zoodis->redis_probe_req, REDIS_CMD_ROLE, 1, argv);
+        }else if(strcasecmp(tok, "info") == 0)
+        {
+            argv[0] = "INFO";
+            redis_probe_append(&zoodis->redis_probe_req, REDIS_CMD_INFO, 1, argv);
+        }else if(strncasecmp(tok, "info:", 5) == 0 && tok[5] != '\0')
+        {
+            argv[0] = "INFO";
+            argv[1] = tok+5;
+            redis_probe_append(&zoodis->redis_probe_req, REDIS_CMD_INFO, 2, argv);
+        }else
+        {
+            log_err("Invalid --redis-probe command '%s'.", tok);
+            exit_proc(-1);
+        }
     }
+    nalloc_free(buf);
 
-    fd = fileno(zoodis.pid_fp);
-
-    memset(&flock, 0x00, sizeof(struct flock));
-    flock.l_type = F_WRLCK;
+    // the stats of msgpack node data come from INFO.
+    if(zoodis->zoo_nodedata_format == NODEDATA_MSGPACK && !redis_req_has(&zoodis->redis_probe_req, REDIS_CMD_INFO))
+    {
+        argv[0] = "INFO";
+        redis_probe_append(&zoodis->redis_probe_req, REDIS_CMD_INFO, 1, argv);
+    }
 
-    res = fcntl(fd, F_SETLK, &flock);
-    if(res < 0)
+    // candidates of --zoo-election claim their repl offset.
+    if(zoodis->zoo_election && !redis_req_has(&zoodis->redis_probe_req, REDIS_CMD_INFO))
     {
-        log_err("Another zoodis process is running. PID:%s", pid_file);
-        fclose(zoodis.pid_fp);
-        exit_proc(-1);
+        argv[0] = "INFO";
+        argv[1] = "replication";
+        redis_probe_append(&zoodis->redis_probe_req, REDIS_CMD_INFO, 2, argv);
     }
 
-    log_info("PID file %s", pid_file);
+    argv[0] = "PING";
+    redis_probe_append(&zoodis->redis_loading_req, REDIS_CMD_PING, 1, argv);
+    argv[0] = "INFO";
+    argv[1] = "persistence";
+    redis_probe_append(&zoodis->redis_loading_req, REDIS_CMD_INFO, 2, argv);
 
-    fseek(zoodis.pid_fp, 0L, SEEK_SET);
-    res = fprintf(zoodis.pid_fp, "%d", pid);
-    res = ftruncate(fd, (off_t)ftell(zoodis.pid_fp));
-    fflush(zoodis.pid_fp);
-    return pid_file;
+    // a standby is synced when its master link is up.
+    argv[0] = "PING";
+    redis_probe_append(&zoodis->redis_standby_req, REDIS_CMD_PING, 1, argv);
+    argv[0] = "INFO";
+    argv[1] = "replication";
+    redis_probe_append(&zoodis->redis_standby_req, REDIS_CMD_INFO, 2, argv);
+
+    return zoodis->redis_probe_req.count;
 }
 
-int check_zoo_options(struct zoodis *zoodis)
+// MODE is nosave, save or default. SHUTDOWN of default saves when
+// redis.conf has save points, as SIGTERM does.
+int check_redis_shutdown(struct zoodis *zoodis, const char *optarg)
 {
-    if(zoodis->zoo_host != NULL || zoodis->zoo_path != NULL || zoodis->zoo_nodename != NULL)
+    const char *argv[2];
+    int argc = 1;
+
+    argv[0] = "SHUTDOWN";
+    if(strcasecmp(optarg, "nosave") == 0)
+        argv[argc++] = "NOSAVE";
+    else if(strcasecmp(optarg, "save") == 0)
+        argv[argc++] = "SAVE";
+    else if(optarg[0] != '\0' && strcasecmp(optarg, "default") != 0)
     {
-        if(zoodis->zoo_host == NULL || zoodis->zoo_path == NULL || zoodis->zoo_nodename == NULL)
-        {
-            log_err("--zoo-host, --zoo-path and --zoo-nodename are mandatory for using zookeeper server.");
-            exit_proc(-1);
-        }
+        log_err("Invalid --redis-shutdown '%s', nosave, save or default.", optarg);
+        exit_proc(-1);
     }
 
-    if(zoodis->zoo_nodedata != NULL)
+    redis_probe_append(&zoodis->redis_shutdown_req, REDIS_CMD_SHUTDOWN, argc, argv);
+
+    // a standby has no dataset of its own, nor a failed primary it took over.
+    argv[1] = "NOSAVE";
+    redis_probe_append(&zoodis->redis_standby_shutdown_req, REDIS_CMD_SHUTDOWN, 2, argv);
+    return argc;
+}
+
+// N/SECONDS, at most N restarts in SECONDS. 0 for no limit.
+int check_restart_budget(struct zoodis *zoodis, const char *optarg)
+{
+    char *end;
+    long n = strtol(optarg, &end, 10);
+
+    if(n == 0 && *end == '\0')
     {
-        if(zoodis->zoo_host == NULL || zoodis->zoo_path == NULL || zoodis->zoo_nodename == NULL)
-        {
-            log_err("--zoo-host, --zoo-path and --zoo-nodename are mandatory for using zookeeper server.");
-            exit_proc(-1);
-        }
+        zoodis->restart_budget = 0;
+        return 0;
     }
 
-    if(zoodis->zoo_host == NULL || zoodis->zoo_path == NULL || zoodis->zoo_nodename == NULL)
+    if(n < 1 || n > RESTART_BUDGET_MAX || *end != '/')
     {
-        return 0;
+        log_err("Invalid --restart-budget '%s', N/SECONDS with N up to %d.", optarg, RESTART_BUDGET_MAX);
+        exit_proc(-1);
     }
-    
-    return 1;
+
+    zoodis->restart_budget = (int)n;
+    zoodis->restart_budget_window = check_option_msec(end+1, DEFAULT_RESTART_BUDGET_WINDOW, 1000);
+    return zoodis->restart_budget;
 }
 
-void print_version(char **argv)
+enum failure_detector check_failure_detector(const char *optarg)
 {
-    printf("Zoodis ver %s\n", ZOODIS_VERSION_STRING);
-    exit(0);
+    if(strcasecmp(optarg, "count") == 0)
+        return FAILURE_DETECTOR_COUNT;
+    else if(strcasecmp(optarg, "phi") == 0)
+        return FAILURE_DETECTOR_PHI;
+
+    log_err("Invalid --failure-detector '%s', count or phi.", optarg);
+    exit_proc(-1);
+    return FAILURE_DETECTOR_COUNT;
 }
 
+enum nodedata_format check_nodedata_format(const char *optarg)
+{
+    if(strcasecmp(optarg, "text") == 0)
+        return NODEDATA_TEXT;
+    else if(strcasecmp(optarg, "msgpack") == 0)
+        return NODEDATA_MSGPACK;
+
+    log_err("Invalid --zoo-nodedata-format '%s', text or msgpack.", optarg);
+    exit_proc(-1);
+    return NODEDATA_TEXT;
+}
 
-void print_help(char **argv)
+int check_keepalive_interval(char *optarg)
 {
-    printf("\n");
-    printf("Usage: %s --redis-bin=REDIS_SERVER_PATH --redis-conf=REDIS_CONF_PATH --redis-port=PORT [Options]\n", argv[0]);
-    printf("\n");
-    printf("    --redis-bin=PATH\n");
-    printf("                    Path of redis-server daemon.\n");
-    printf("    --redis-conf=PATH\n");
-    printf("                    Configure path of redis.\n");
-    printf("    --redis-port=PORT\n");
-    printf("                    Configure port of redis.\n");
-    printf("                    It's going to be used to health check.\n");
-    printf("Options\n");
-    printf("    --keepalive\n");
-    printf("                    Keep continue to restart redis-server when it's down.\n");
-    printf("    --keepalive-interval=SECOND\n");
-    printf("                    Restart interval time since catch down signal.\n");
-    printf("                    If not set this, default is 1 second.\n");
-    printf("                    This option works with keepalive option.\n");
-    printf("    --redis-ping-interval=SECONDS\n");
-    printf("                    Interval seconds while ping(health) check.\n");
-    printf("    --redis-max-fail-count=COUNT\n");
-    printf("                    Threshold for judging redis failure.\n");
-    printf("    --zoo-host=ZOOKEEPERHOSTS\n");
-    printf("                    Connection string for zookeeper server.\n");
-    printf("    --zoo-path=NODEPATH\n");
-    printf("                    Parent zookeeper path.\n");
-    printf("                    This option works with zoo-host option.\n");
-    printf("    --zoo-nodename=NODENAME\n");
-    printf("                    Create node name what is guarrentee redis-server alive\n");
-    printf("                    This option works with zoo-host and zoo-path option.\n");
-    printf("    --zoo-nodedata=NODEDATA\n");
-    printf("                    What data string in the zoo-nodename node.\n");
-    printf("                    Default is \"1\"\n");
-    printf("                    This option works with zoo-host and zoo-path option.\n");
-    printf("    --pid-file=PATH\n");
-    printf("                    Pid file path.\n");
-    printf("    --log-level=[DEBUG|INFO|WARN|ERROR]\n");
-    printf("                    Set logging level.\n");
-    printf("                    Default is WARN\n");
-    printf("    --version\n");
-    printf("                    Print version.\n");
-    printf("    --help\n");
-    printf("                    This message.\n");
-    exit(0);
+    int i = atoi(optarg);
+    if(i > 0)
+        return i;
+    else
+        return DEFAULT_KEEPALIVE_INTERVAL;
 }
 
-void exec_redis()
+struct mstr* check_zoo_host(char *optarg)
 {
-    pid_t pid;
+    if(optarg == NULL || strlen(optarg) == 0)
+        return NULL;
+    return mstr_alloc_dup(optarg, strlen(optarg));
+}
 
-    pid = fork();
+struct mstr* check_zoo_path(char *optarg)
+{
+    if(optarg == NULL || strlen(optarg) == 0)
+        return NULL;
+    return mstr_alloc_dup(optarg, strlen(optarg));
+}
 
-    if(pid < 0)
+struct mstr* check_zoo_nodename(char *optarg)
+{
+    if(optarg == NULL || strlen(optarg) == 0)
+        return NULL;
+    return mstr_alloc_dup(optarg, strlen(optarg));
+}
+
+// Bounded, node data with stats must fit a zookeeper op.
+struct mstr* check_zoo_nodedata(char *optarg)
+{
+    if(optarg == NULL || strlen(optarg) == 0)
+        return NULL;
+
+    if(strlen(optarg) > ZOO_NODEDATA_MAX)
     {
-        log_err("Redis: Failed forming process, %s", strerror(errno));
+        log_err("Invalid --zoo-nodedata, longer than %d bytes.", ZOO_NODEDATA_MAX);
         exit_proc(-1);
     }
 
-    if(pid == 0)
+    return mstr_alloc_dup(optarg, strlen(optarg));
+}
+
+int check_redis_options(struct instance *inst)
+{
+    if(inst->redis_bin == NULL || inst->redis_conf == NULL)
+    {
+        log_err("--redis-bin, --redis-conf are mandatory. instance:%s", inst->name->data);
+        exit_proc(-1);
+    }
+
+    memset(&inst->redis_addr, 0, sizeof(struct sockaddr_storage));
+
+    if(inst->redis_socket != NULL)
+    {
+        // unixsocket of redis.conf, no loopback TCP stack in the probe.
+        struct sockaddr_un *un = (struct sockaddr_un*) &inst->redis_addr;
+
+        un->sun_family = AF_UNIX;
+        memcpy(un->sun_path, inst->redis_socket->data, inst->redis_socket->len);
+        inst->redis_addr_len = offsetof(struct sockaddr_un, sun_path) + inst->redis_socket->len + 1;
+    }else
     {
-        if(execl(zoodis.redis_bin->data, zoodis.redis_bin->data, zoodis.redis_conf->data, NULL) < 0)
+        struct sockaddr_in *in = (struct sockaddr_in*) &inst->redis_addr;
+        struct sockaddr_in6 *in6 = (struct sockaddr_in6*) &inst->redis_addr;
+
+        if(inet_pton(AF_INET, inst->redis_ip->data, &in->sin_addr) == 1)
         {
-            log_err("Redis: failed to execute redis daemon. %s", strerror(errno));
+            in->sin_family = AF_INET;
+            in->sin_port = htons(inst->redis_port);
+            inst->redis_addr_len = sizeof(struct sockaddr_in);
+        }else if(inet_pton(AF_INET6, inst->redis_ip->data, &in6->sin6_addr) == 1)
+        {
+            in6->sin6_family = AF_INET6;
+            in6->sin6_port = htons(inst->redis_port);
+            inst->redis_addr_len = sizeof(struct sockaddr_in6);
+        }else
+        {
+            log_err("Invalid redis address %s. instance:%s", inst->redis_ip->data, inst->name->data);
+            exit_proc(-1);
         }
+    }
+
+    if(inst->primary != NULL)
+    {
+        redis_req_auth(&inst->redis_probe_req, &zoodis.redis_standby_req, inst->redis_config.requirepass);
+        redis_req_auth(&inst->redis_shutdown_req, &zoodis.redis_standby_shutdown_req, inst->redis_config.requirepass);
     }else
     {
-        zoodis.redis_pid = pid;
-        zoodis.redis_stat = REDIS_STAT_EXECUTED;
-        log_info("Redis: started redis daemon.");
-        sleep(DEFAULT_REDIS_SLEEP_AFTER_EXEC);
-        redis_health();
+        redis_req_auth(&inst->redis_probe_req, &zoodis.redis_probe_req, inst->redis_config.requirepass);
+        redis_req_auth(&inst->redis_shutdown_req, &zoodis.redis_shutdown_req, inst->redis_config.requirepass);
     }
+    redis_req_auth(&inst->redis_loading_req, &zoodis.redis_loading_req, inst->redis_config.requirepass);
 
-    return;
+    if(inst->redis_standby_port != 0)
+        redis_promote_req(inst);
+
+    redis_probe_setup(inst);
+    return 1;
 }
 
-void redis_kill()
+static void redis_probe_setup(struct instance *inst)
 {
-    if(zoodis.redis_pid != 0)
-    {
-        log_info("Redis: killing daemon. PID:%d", zoodis.redis_pid);
-        kill(zoodis.redis_pid, SIGTERM);
-        zoodis.redis_stat = REDIS_STAT_KILLING;
-        int stat;
-        pid_t pid;
-        pid = waitpid(zoodis.redis_pid, &stat, WNOHANG);
-        zoodis.redis_stat = REDIS_STAT_NONE;
-        zu_ephemeral_update(&zoodis);
-        log_info("Redis: down (pid:%d).", pid);
-        zoodis.redis_pid = 0;
-        signal(SIGCHLD, signal_sigchld);
-    }
+    probe_init(&inst->redis_probe, zoodis.tw, (struct sockaddr*)&inst->redis_addr, inst->redis_addr_len, redis_probe_done, inst);
+    inst->redis_probe.connect_timeout = zoodis.redis_connect_timeout;
+    inst->redis_probe.write_timeout = zoodis.redis_write_timeout;
+    inst->redis_probe.read_timeout = zoodis.redis_pong_timeout;
 }
 
-void signal_sigint(int sig)
+// The standby runs without persistence, see redis_exec_argv().
+// It is given back the persistence of redis.conf when promoted.
+static void redis_promote_req(struct instance *inst)
 {
-    signal(SIGCHLD, SIG_IGN);
-    log_debug("Signal: Received shutdown singal, NO:%d", sig);
-    log_info("Suspending zoodis,", sig);
-    zoodis.keepalive = 0;
-    if(zoodis.redis_stat == REDIS_STAT_EXECUTED ||
-            zoodis.redis_stat == REDIS_STAT_OK ||
-            zoodis.redis_stat == REDIS_STAT_ABNORMAL)
+    struct redis_config *c = &inst->redis_config;
+    struct redis_req r;
+    const char *argv[4];
+
+    memset(&r, 0x00, sizeof(struct redis_req));
+
+    argv[0] = "REPLICAOF";
+    argv[1] = "NO";
+    argv[2] = "ONE";
+    redis_probe_append(&r, REDIS_CMD_REPLICAOF, 3, argv);
+
+    argv[0] = "CONFIG";
+    argv[1] = "SET";
+    argv[2] = "dbfilename";
+    argv[3] = c->dbfilename;
+    redis_probe_append(&r, REDIS_CMD_CONFIG, 4, argv);
+
+    argv[2] = "save";
+    argv[3] = c->save;
+    redis_probe_append(&r, REDIS_CMD_CONFIG, 4, argv);
+
+    if(c->appendonly)
     {
-        redis_kill();
+        argv[2] = "appendonly";
+        argv[3] = "yes";
+        redis_probe_append(&r, REDIS_CMD_CONFIG, 4, argv);
     }
-    exit_proc(0);
+
+    redis_req_auth(&inst->redis_promote_req, &r, c->requirepass);
+    if(c->requirepass[0] != '\0')
+        mstr_free_dup(r.data);
 }
 
-void signal_sigchld(int sig)
+struct instance* instance_alloc(struct zoodis *z)
 {
-    int stat, pid;
-    pid = wait(&stat);
-    log_debug("Signal: received SIGCHLD PID:%d, REDIS_PID:%d", pid, zoodis.redis_pid);
-    if(zoodis.redis_pid == pid)
-    {
-        close(zoodis.redis_sock);
-        zoodis.redis_sock = 0;
-        zoodis.redis_stat = REDIS_STAT_NONE;
-        zu_ephemeral_update(&zoodis);
+    struct instance *inst = ncalloc(sizeof(struct instance));
+
+    inst->redis_stat    = REDIS_STAT_NONE;
+    inst->redis_port    = z->redis_port;
+    inst->redis_ip      = z->redis_ip;
+    inst->redis_socket  = z->redis_socket;
+    inst->redis_bin     = z->redis_bin;
+    inst->redis_conf    = z->redis_conf;
+    inst->redis_standby_port = z->redis_standby_port;
+    inst->zoo_path      = z->zoo_path;
+    inst->zoo_nodename  = z->zoo_nodename;
+    inst->zoo_nodedata  = z->zoo_nodedata;
+
+    return inst;
+}
+
+// Endpoint of the probe as redis-server listens, by redis.conf.
+// The unixsocket is preferred, port and bind override --redis-port and --redis-ip.
+void instance_endpoint(struct instance *inst)
+{
+    struct redis_config *c = &inst->redis_config;
+    int port;
 
-        log_err("Redis: daemon has been down. Please check redis log file.");
+    conf_init(c);
+    if(inst->redis_conf == NULL || conf_load(c, inst->redis_conf->data) < 0)
+    {
+        if(inst->redis_port == 0)
+            inst->redis_port = DEFAULT_REDIS_PORT;
+        if(inst->redis_ip == NULL)
+            inst->redis_ip = mstr_alloc_dup(DEFAULT_REDIS_IP, strlen(DEFAULT_REDIS_IP));
+        return;
+    }
 
-        if(!zoodis.keepalive)
+    if(c->unixsocket[0] != '\0')
+    {
+        if(inst->redis_socket != NULL && strcmp(inst->redis_socket->data, c->unixsocket) != 0)
         {
-            exit(-1);
+            log_warn("Redis: socket %s is not unixsocket %s of %s, probe the latter.",
+                    inst->redis_socket->data, c->unixsocket, inst->redis_conf->data);
         }
 
-        sleep(zoodis.keepalive_interval);
-        exec_redis();
+        if(inst->redis_socket == NULL || strcmp(inst->redis_socket->data, c->unixsocket) != 0)
+            inst->redis_socket = mstr_alloc_dup(c->unixsocket, strlen(c->unixsocket));
+    }else if(inst->redis_socket != NULL)
+    {
+        log_warn("Redis: %s has no unixsocket, probe TCP instead of %s.", inst->redis_conf->data, inst->redis_socket->data);
+        inst->redis_socket = NULL;
+    }
+
+    port = c->port < 0 ? DEFAULT_REDIS_PORT : c->port;
+    if(port == 0 && inst->redis_socket == NULL)
+        log_warn("Redis: %s has port 0 and no unixsocket, redis-server cannot be probed.", inst->redis_conf->data);
+
+    if(inst->redis_port != 0 && inst->redis_port != port)
+        log_warn("Redis: port %d is not port %d of %s, probe the latter.", inst->redis_port, port, inst->redis_conf->data);
+    inst->redis_port = port;
+
+    if(conf_bind_any(c))
+    {
+        if(inst->redis_ip == NULL)
+            inst->redis_ip = mstr_alloc_dup(DEFAULT_REDIS_IP, strlen(DEFAULT_REDIS_IP));
+    }else if(inst->redis_ip == NULL || !conf_bind_has(c, inst->redis_ip->data))
+    {
+        if(inst->redis_ip != NULL)
+        {
+            log_warn("Redis: %s does not bind %s, probe %s.", inst->redis_conf->data, inst->redis_ip->data, c->bind[0]);
+        }
+        inst->redis_ip = mstr_alloc_dup(c->bind[0], strlen(c->bind[0]));
     }
+
+    log_debug("Redis: %s, socket:%s bind:%s port:%d auth:%s maxmemory:%"PRIu64,
+            inst->redis_conf->data, inst->redis_socket != NULL ? (char*)inst->redis_socket->data : "-",
+            inst->redis_ip->data, inst->redis_port, c->requirepass[0] != '\0' ? "yes" : "no", c->maxmemory);
 }
 
-int redis_health_check()
+struct instance* instance_add(struct zoodis *z, struct instance *inst)
 {
-    int res;
-    char buf[1024];
-    fd_set rfdset;
-    struct timeval tval;
+    char buf[64];
+    int i;
+
+    instance_endpoint(inst);
 
-    utime_t stime, etime;
-    if(!zoodis.redis_sock)
+    if(inst->name == NULL)
     {
-        res = socket(PF_INET,SOCK_STREAM, 0);
-        if(res < 0)
+        if(inst->zoo_nodename != NULL)
         {
-            log_warn("Redis: cannot open socket for check redis server. %s", strerror(errno));
-            return 0;
+            inst->name = inst->zoo_nodename;
+        }else
+        {
+            if(inst->redis_socket != NULL)
+                snprintf(buf, sizeof(buf), "%s", (char*)inst->redis_socket->data);
+            else
+                snprintf(buf, sizeof(buf), "%s:%d", (char*)inst->redis_ip->data, inst->redis_port);
+            inst->name = mstr_alloc_dup(buf, strlen(buf));
         }
+    }
 
-        zoodis.redis_sock = res;
-
-        res = connect(zoodis.redis_sock, (struct sockaddr*)&zoodis.redis_addr, sizeof(struct sockaddr_in));
-        if(res < 0)
+    for(i = 0; i < z->instance_count; i++)
+    {
+        if(mstr_cmp(z->instances[i]->name, inst->name) == 0)
         {
-            log_warn("Redis: cannot connect redis server %s:%d, %s", DEFAULT_REDIS_IP, zoodis.redis_port, strerror(errno));
-            close(zoodis.redis_sock);
-            zoodis.redis_sock = 0;
-            return 0;
+            log_err("Instance %s is declared twice.", inst->name->data);
+            exit_proc(-1);
         }
     }
 
-    stime = utime_time();
-    res = write(zoodis.redis_sock, DEFAULT_REDIS_PING, strlen(DEFAULT_REDIS_PING));
-    if(res < 0)
+    z->instances = nrealloc(z->instances, sizeof(struct instance*) * (z->instance_count+1));
+    z->instances[z->instance_count++] = inst;
+
+    return inst;
+}
+
+// Probes, timers and node data of an instance, or a standby.
+void instance_init(struct zoodis *z, struct instance *inst)
+{
+    check_redis_options(inst);
+    hist_ring_init(&inst->redis_latency, (z->latency_window + HIST_RING - 1) / HIST_RING, utime_mono());
+    // a probe slower than usual but within its timeout is no failure.
+    phi_init(&inst->redis_phi, DEFAULT_PHI_MIN_STD, z->redis_pong_timeout);
+    instance_nodedata(z, inst);
+
+    timer_init(&inst->check_timer, redis_check_timer, inst);
+    timer_init(&inst->restart_timer, redis_restart_timer, inst);
+    timer_init(&inst->latency_timer, redis_latency_timer, inst);
+    timer_init(&inst->zoo_timer, zu_retry_timer, inst);
+    timer_init(&inst->stop_timer, redis_stop_timer, inst);
+    timer_add(z->tw, &inst->latency_timer, (uint64_t)inst->redis_latency.period * 1000);
+
+    if(z->zookeeper && z->zoo_election && inst->primary == NULL)
+        instance_election_addr(z, inst);
+}
+
+// Address replicas of another host are pointed to, when elected.
+static void instance_election_addr(struct zoodis *z, struct instance *inst)
+{
+    const char *ip = z->redis_announce_ip != NULL ? z->redis_announce_ip->data : inst->redis_ip->data;
+    char buf[128];
+
+    if(inst->redis_port == 0)
     {
-        log_warn("Redis: error while write(send) ping to redis server. %s", strerror(errno));
-        close(zoodis.redis_sock);
-        zoodis.redis_sock = 0;
-        return 0;
+        log_err("--zoo-election needs a TCP port of redis-server. instance:%s", inst->name->data);
+        exit_proc(-1);
     }
 
-    memset(buf, 0x00, 1024);
+    if(z->redis_announce_ip == NULL && (strcmp(ip, "127.0.0.1") == 0 || strcmp(ip, "::1") == 0))
+        log_warn("Redis: %s is not reachable by replicas of other hosts, see --redis-announce-ip. instance:%s", ip, inst->name->data);
 
-    FD_ZERO(&rfdset);
-    FD_SET(zoodis.redis_sock, &rfdset);
+    snprintf(buf, sizeof(buf), "%s:%d", ip, inst->redis_port);
+    inst->zoo_election_addr = mstr_alloc_dup(buf, strlen(buf));
+}
 
-    tval.tv_sec = zoodis.redis_pong_timeout_sec;
-    tval.tv_usec = zoodis.redis_pong_timeout_usec;;
+// Standby of INST, a replica of it on --redis-standby-port.
+// It is supervised as an instance of its own, but has no node.
+struct instance* instance_standby(struct instance *inst)
+{
+    struct instance *sb = ncalloc(sizeof(struct instance));
+    char buf[256];
 
-    res = select(zoodis.redis_sock+1, &rfdset, NULL, NULL, &tval);
-    if(res < 0)
+    if(inst->redis_port == 0 || inst->redis_standby_port == inst->redis_port)
     {
-        log_warn("Redis: redis could not response in time (timeout:%d.%d).", tval.tv_sec, tval.tv_usec);
-        close(zoodis.redis_sock);
-        zoodis.redis_sock = 0;
-        return 0;
-    }else
+        log_err("Standby port %d needs a TCP port of its primary other than it. instance:%s",
+                inst->redis_standby_port, inst->name->data);
+        exit_proc(-1);
+    }
+
+    snprintf(buf, sizeof(buf), "%s/standby", (char*)inst->name->data);
+    sb->name            = mstr_alloc_dup(buf, strlen(buf));
+    sb->redis_stat      = REDIS_STAT_NONE;
+    sb->redis_port      = inst->redis_standby_port;
+    sb->redis_ip        = inst->redis_ip;
+    sb->redis_bin       = inst->redis_bin;
+    sb->redis_conf      = inst->redis_conf;
+    sb->zoo_nodedata    = inst->zoo_nodedata;
+    sb->primary         = inst;
+    memcpy(&sb->redis_config, &inst->redis_config, sizeof(struct redis_config));
+
+    // redis-server replaces a unix socket in its way, the standby has its own.
+    if(inst->redis_socket != NULL)
     {
-        res = read(zoodis.redis_sock, buf, 1024);
-        etime = utime_time();
-        if(res < 0)
-        {
-            log_warn("Redis: test failed, %s", strerror(errno));
-            close(zoodis.redis_sock);
-            zoodis.redis_sock = 0;
-            return 0;
-        }else if(res == 0)
-        {
-            log_warn("Redis: test failed, connection closed.");
-            close(zoodis.redis_sock);
-            zoodis.redis_sock = 0;
-            return 0;
-        }else
-        {
-            if(strncmp(buf, DEFAULT_REDIS_PONG, 5) != 0)
-            {
-                log_warn("Redis: test failed, responsed not PONG, %.*s", res, buf);
-                return 0;
-            }else
-            {
-                utime_t elapsedTime = etime - stime;
-                log_info("Redis: test successed. Elapsed %"PRIu64" usec", elapsedTime);
-                return 1;
-            }
-        }
+        snprintf(buf, sizeof(buf), "%s.standby", (char*)inst->redis_socket->data);
+        sb->redis_socket = check_redis_socket(buf);
     }
+
+    inst->standby = sb;
+    return sb;
 }
 
-void redis_health()
+// SPEC is comma separated key=value pairs, as
+// name=cache-1,port=6380,conf=/path/redis-6380.conf,nodename=node-6380
+// Keys not in SPEC take the value of the matching --redis-*, --zoo-* option.
+struct instance* instance_parse(struct zoodis *z, char *spec)
 {
-    int res;
-    while(1)
+    struct instance *inst = instance_alloc(z);
+    char *buf, *save, *tok, *key, *val;
+
+    if(strlen(spec) >= INSTANCE_SPEC_MAX)
     {
-        /*
-        if(zoodis.zookeeper && zoodis.zoo_stat != ZOO_STAT_CONNECTED)
-        {
+        log_err("Instance spec is too long. %.32s...", spec);
+        exit_proc(-1);
+    }
+
+    buf = nalloc_duplen(spec, strlen(spec)+1);
+
+    for(tok = strtok_r(buf, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save))
+    {
+        while(*tok == ' ' || *tok == '\t')
+            tok++;
+
+        if(*tok == '\0')
             continue;
-        }
-        */
 
-        if(zoodis.redis_stat != REDIS_STAT_EXECUTED &&
-                zoodis.redis_stat != REDIS_STAT_OK &&
-                zoodis.redis_stat != REDIS_STAT_ABNORMAL)
+        val = strchr(tok, '=');
+        if(val == NULL)
         {
-            sleep(zoodis.redis_ping_interval);
-            continue;
+            log_err("Invalid instance spec, '%s' has no value. %s", tok, spec);
+            exit_proc(-1);
         }
 
-        res = redis_health_check();
+        key = tok;
+        *val++ = '\0';
 
-        if(!res)
-        {
-            // failed
-            zoodis.redis_fail_count++;
-            if(zoodis.redis_fail_count >= zoodis.redis_max_fail_count)
-            {
-                zoodis.redis_fail_count = 0;
-                zoodis.redis_stat = REDIS_STAT_ABNORMAL;
-                redis_kill();
-                zu_ephemeral_update(&zoodis);
-                exec_redis();
-            }
-        }else
+        if(strcmp(key, "name") == 0)
+            inst->name = mstr_alloc_dup(val, strlen(val));
+
+        else if(strcmp(key, "bin") == 0)
+            inst->redis_bin = check_redis_bin(val);
+
+        else if(strcmp(key, "conf") == 0)
+            inst->redis_conf = check_redis_conf(val);
+
+        else if(strcmp(key, "ip") == 0)
+            inst->redis_ip = mstr_alloc_dup(val, strlen(val));
+
+        else if(strcmp(key, "port") == 0)
+            inst->redis_port = check_option_int(val, DEFAULT_REDIS_PORT);
+
+        else if(strcmp(key, "socket") == 0)
+            inst->redis_socket = check_redis_socket(val);
+
+        else if(strcmp(key, "standby") == 0)
+            inst->redis_standby_port = check_option_int(val, 0);
+
+        else if(strcmp(key, "path") == 0)
+            inst->zoo_path = check_zoo_path(val);
+
+        else if(strcmp(key, "nodename") == 0)
+            inst->zoo_nodename = check_zoo_nodename(val);
+
+        else if(strcmp(key, "nodedata") == 0)
+            inst->zoo_nodedata = check_zoo_nodedata(val);
+
+        else if(strcmp(key, "proxy") == 0)
+            inst->proxy_listen = nalloc_duplen(val, strlen(val)+1);
+
+        else
         {
-            // success
-            zoodis.redis_fail_count = 0;
-            zoodis.redis_stat = REDIS_STAT_OK;
-            zu_ephemeral_update(&zoodis);
+            log_err("Invalid instance spec, unknown key '%s'. %s", key, spec);
+            exit_proc(-1);
         }
-        sleep(zoodis.redis_ping_interval);
     }
+
+    nalloc_free(buf);
+    return inst;
 }
 
-void exit_proc(int code)
+// One instance spec per line, blank lines and lines starting with '#' are skipped.
+int instance_load_file(struct zoodis *z, const char *path)
 {
+    FILE *fp;
+    char line[INSTANCE_SPEC_MAX];
+    char *p;
+    size_t len;
+    int count = 0;
+
+    fp = fopen(path, "r");
+    if(fp == NULL)
+    {
+        log_err("Cannot open instance file %s, %s", path, strerror(errno));
+        exit_proc(-1);
+    }
+
+    while(fgets(line, sizeof(line), fp) != NULL)
+    {
+        len = strlen(line);
+        while(len > 0 && (line[len-1] == '\n' || line[len-1] == '\r' || line[len-1] == ' ' || line[len-1] == '\t'))
+            line[--len] = '\0';
+
+        for(p = line; *p == ' ' || *p == '\t'; p++);
+
+        if(*p == '\0' || *p == '#')
+            continue;
+
+        instance_add(z, instance_parse(z, p));
+        count++;
+    }
+
+    fclose(fp);
+    log_info("Loaded %d instance(s) from %s", count, path);
+    return count;
+}
+
+static void instance_addr(struct instance *inst, char *buf, size_t size)
+{
+    if(inst->redis_socket != NULL)
+        snprintf(buf, size, "%s", (char*)inst->redis_socket->data);
+    else
+        snprintf(buf, size, "%s:%d", (char*)inst->redis_ip->data, inst->redis_port);
+}
+
+// a stat moved by more than PERCENT of its value, and by more than MIN
+// so that a stat around 0 does not flap.
+static int nodedata_moved(int64_t prev, int64_t cur, int percent, int64_t min)
+{
+    int64_t diff = cur > prev ? cur - prev : prev - cur;
+
+    if(diff <= min)
+        return 0;
+
+    return diff * 100 > (prev < 0 ? -prev : prev) * percent;
+}
+
+static int nodedata_changed(const struct nodedata_stats *prev, const struct nodedata_stats *cur, int percent)
+{
+    return strcmp(prev->role, cur->role) != 0 ||
+        strcmp(prev->addr, cur->addr) != 0 ||
+        prev->loading != cur->loading ||
+        nodedata_moved(prev->used_memory, cur->used_memory, percent, NODEDATA_MIN_MEMORY) ||
+        nodedata_moved(prev->connected_clients, cur->connected_clients, percent, NODEDATA_MIN_CLIENTS) ||
+        nodedata_moved(prev->ops_per_sec, cur->ops_per_sec, percent, NODEDATA_MIN_OPS) ||
+        nodedata_moved(prev->repl_offset, cur->repl_offset, percent, NODEDATA_MIN_OFFSET) ||
+        nodedata_moved(prev->p99, cur->p99, percent, NODEDATA_MIN_P99) ||
+        nodedata_moved(prev->loading_perc, cur->loading_perc, percent, 0);
+}
+
+// --zoo-nodedata-format=msgpack, a map of the stats led by its version.
+// Stats moving by less than --zoo-nodedata-threshold percent since the
+// data was built keep it as it is, the node is not written for noise.
+static void instance_nodedata_msgpack(struct zoodis *z, struct instance *inst)
+{
+    const struct redis_info *info = &inst->redis_info;
+    unsigned char buf[NODEDATA_MSGPACK_MAX + ZOO_NODEDATA_MAX];
+    struct nodedata_stats st;
+    struct mpack m;
+    struct hist h;
+
+    memset(&st, 0x00, sizeof(st));
+    memcpy(st.role, info->role, sizeof(st.role));
+    if(inst->standby != NULL)
+        instance_addr(inst, st.addr, sizeof(st.addr));
+    st.loading = inst->redis_stat == REDIS_STAT_LOADING;
+    st.used_memory = info->used_memory;
+    st.connected_clients = info->connected_clients;
+    st.ops_per_sec = info->instantaneous_ops_per_sec;
+    st.repl_offset = info->master_repl_offset;
+    hist_ring_merge(&inst->redis_latency, &h);
+    st.p99 = (int64_t)hist_percentile(&h, 0.99);
+    st.loading_perc = st.loading ? (int64_t)inst->redis_progress_perc : 0;
+
+    if(inst->zoo_data != NULL && !nodedata_changed(&inst->zoo_stats, &st, z->zoo_nodedata_threshold))
+        return;
+
+    mpack_init(&m, buf, sizeof(buf));
+    mpack_map(&m, 8 + (st.addr[0] != '\0') + st.loading * 2);
+    mpack_cstr(&m, "v");
+    mpack_int(&m, NODEDATA_VERSION);
+    mpack_cstr(&m, "data");
+    mpack_str(&m, inst->zoo_nodedata->data, inst->zoo_nodedata->len);
+    mpack_cstr(&m, "role");
+    mpack_cstr(&m, st.role);
+    mpack_cstr(&m, "used_memory");
+    mpack_int(&m, st.used_memory);
+    mpack_cstr(&m, "connected_clients");
+    mpack_int(&m, st.connected_clients);
+    mpack_cstr(&m, "ops_per_sec");
+    mpack_int(&m, st.ops_per_sec);
+    mpack_cstr(&m, "p99_usec");
+    mpack_int(&m, st.p99);
+    mpack_cstr(&m, "repl_offset");
+    mpack_int(&m, st.repl_offset);
+
+    // the endpoint moves to the standby port on a takeover.
+    if(st.addr[0] != '\0')
+    {
+        mpack_cstr(&m, "addr");
+        mpack_cstr(&m, st.addr);
+    }
+
+    if(st.loading)
+    {
+        mpack_cstr(&m, "loading");
+        mpack_double(&m, inst->redis_progress_perc);
+        mpack_cstr(&m, "eta");
+        mpack_int(&m, inst->redis_loading_eta);
+    }
+
+    // never left without data, the node is written from it.
+    if(m.error)
+    {
+        log_err("Zookeeper: msgpack node data exceeds %zu bytes. instance:%s", sizeof(buf), inst->name->data);
+        if(inst->zoo_data == NULL)
+            inst->zoo_data = mstr_alloc_dup(inst->zoo_nodedata->data, inst->zoo_nodedata->len);
+        return;
+    }
+
+    if(inst->zoo_data != NULL)
+        mstr_free_dup(inst->zoo_data);
+
+    inst->zoo_stats = st;
+    inst->zoo_data = mstr_alloc_dup((char*)buf, m.len);
+}
+
+// Build data of the zookeeper node, --zoo-nodedata followed by optional stats.
+void instance_nodedata(struct zoodis *z, struct instance *inst)
+{
+    char buf[256];
+    struct hist h;
+    int len;
+
+    if(z->zoo_nodedata_format == NODEDATA_MSGPACK)
+    {
+        instance_nodedata_msgpack(z, inst);
+        return;
+    }
+
+    if(inst->zoo_data != NULL)
+        mstr_free_dup(inst->zoo_data);
+
+    len = snprintf(buf, sizeof(buf), "%s", (char*)inst->zoo_nodedata->data);
+
+    if(z->zoo_nodedata_latency)
+    {
+        hist_ring_merge(&inst->redis_latency, &h);
+        len += snprintf(buf+len, sizeof(buf)-len, " p50=%"PRIu64" p99=%"PRIu64" p999=%"PRIu64" max=%"PRIu64,
+                hist_percentile(&h, 0.5), hist_percentile(&h, 0.99), hist_percentile(&h, 0.999), h.max);
+    }
+
+    // the endpoint moves to the standby port on a takeover.
+    if(inst->standby != NULL && len < (int)sizeof(buf))
+    {
+        len += snprintf(buf+len, sizeof(buf)-len, " addr=");
+        if(len < (int)sizeof(buf))
+        {
+            instance_addr(inst, buf+len, sizeof(buf)-len);
+            len += strlen(buf+len);
+        }
+    }
+
+    if(inst->redis_stat == REDIS_STAT_LOADING && len < (int)sizeof(buf))
+    {
+        len += snprintf(buf+len, sizeof(buf)-len, " loading=%.2f eta=%"PRId64,
+                inst->redis_progress_perc, inst->redis_loading_eta);
+    }
+
+    if(len >= (int)sizeof(buf))
+        len = sizeof(buf)-1;
+
+    inst->zoo_data = mstr_alloc_dup(buf, len);
+}
+
+struct instance* instance_find_pid(struct zoodis *z, pid_t pid)
+{
+    struct instance *inst;
+    int i;
+
+    for(i = 0; i < z->instance_count; i++)
+    {
+        inst = z->instances[i];
+        if(inst->redis_pid == pid)
+            return inst;
+        if(inst->standby != NULL && inst->standby->redis_pid == pid)
+            return inst->standby;
+    }
+
+    return NULL;
+}
+
+const char* check_pid_file(const char *pid_file)
+{
+    int fd, res;
+    pid_t pid = getpid();
+    struct flock flock;
+
+
+    zoodis.pid_fp = fopen(pid_file, "r+");
+    if(zoodis.pid_fp == NULL)
+    {
+        zoodis.pid_fp = fopen(pid_file, "w");
+        if(zoodis.pid_fp == NULL)
+        {
+            log_err("Cannot open pid file %s, %s", pid_file, strerror(errno));
+            exit_proc(-1);
+        }
+    }
+
+    fd = fileno(zoodis.pid_fp);
+
+    memset(&flock, 0x00, sizeof(struct flock));
+    flock.l_type = F_WRLCK;
+
+    res = fcntl(fd, F_SETLK, &flock);
+    if(res < 0)
+    {
+        log_err("Another zoodis process is running. PID:%s", pid_file);
+        fclose(zoodis.pid_fp);
+        exit_proc(-1);
+    }
+
+    log_info("PID file %s", pid_file);
+
+    fseek(zoodis.pid_fp, 0L, SEEK_SET);
+    res = fprintf(zoodis.pid_fp, "%d", pid);
+    res = ftruncate(fd, (off_t)ftell(zoodis.pid_fp));
+    fflush(zoodis.pid_fp);
+    return pid_file;
+}
+
+int check_zoo_options(struct zoodis *zoodis)
+{
+    struct instance *inst;
+    int i, j, used = 0;
+
+    for(i = 0; i < zoodis->instance_count; i++)
+    {
+        inst = zoodis->instances[i];
+        if(inst->zoo_path != NULL || inst->zoo_nodename != NULL)
+            used = 1;
+    }
+
+    if(!used && zoodis->zoo_host == NULL)
+        return 0;
+
+    for(i = 0; i < zoodis->instance_count; i++)
+    {
+        inst = zoodis->instances[i];
+        if(zoodis->zoo_host == NULL || inst->zoo_path == NULL || inst->zoo_nodename == NULL)
+        {
+            log_err("--zoo-host, --zoo-path and --zoo-nodename are mandatory for using zookeeper server. instance:%s", inst->name->data);
+            exit_proc(-1);
+        }
+
+        inst->zoo_nodepath = mstr_concat(3, inst->zoo_path->data, "/", inst->zoo_nodename->data);
+        if(zoodis->zoo_election)
+        {
+            inst->zoo_election_path = mstr_concat(2, inst->zoo_path->data, "/election");
+            inst->zoo_master_path = mstr_concat(2, inst->zoo_path->data, "/master");
+        }
+    }
+
+    for(i = 0; i < zoodis->instance_count; i++)
+    {
+        for(j = i+1; j < zoodis->instance_count; j++)
+        {
+            if(mstr_cmp(zoodis->instances[i]->zoo_nodepath, zoodis->instances[j]->zoo_nodepath) == 0)
+            {
+                log_err("Each instance needs its own zookeeper node. %s", zoodis->instances[j]->zoo_nodepath->data);
+                exit_proc(-1);
+            }
+        }
+    }
+
+    return 1;
+}
+
+void print_version(char **argv)
+{
+    printf("Zoodis ver %s\n", ZOODIS_VERSION_STRING);
+    exit(0);
+}
+
+
+void print_help(char **argv)
+{
+    printf("\n");
+    printf("Usage: %s --redis-bin=REDIS_SERVER_PATH --redis-conf=REDIS_CONF_PATH --redis-port=PORT [Options]\n", argv[0]);
+    printf("\n");
+    printf("    --redis-bin=PATH\n");
+    printf("                    Path of redis-server daemon.\n");
+    printf("    --redis-conf=PATH\n");
+    printf("                    Configure path of redis.\n");
+    printf("    --redis-port=PORT\n");
+    printf("                    Configure port of redis.\n");
+    printf("                    It's going to be used to health check.\n");
+    printf("                    port, bind and unixsocket of redis.conf take precedence,\n");
+    printf("                    requirepass of it is sent by AUTH.\n");
+    printf("Options\n");
+    printf("    --keepalive\n");
+    printf("                    Keep continue to restart redis-server when it's down.\n");
+    printf("    --keepalive-interval=SECOND\n");
+    printf("                    Restart interval time since catch down signal.\n");
+    printf("                    If not set this, default is 1 second.\n");
+    printf("                    Takes msec with 'ms' suffix, as 200ms.\n");
+    printf("                    This option works with keepalive option.\n");
+    printf("    --restart-backoff-max=SECONDS\n");
+    printf("                    Restarts in a row back off exponentially from\n");
+    printf("                    keepalive-interval up to this, then a random half to all\n");
+    printf("                    of it is waited. Default is 60.\n");
+    printf("    --restart-budget=N/SECONDS\n");
+    printf("                    Quarantine redis-server restarted N times in SECONDS,\n");
+    printf("                    <nodename>.quarantined node is created then. Default is 10/600,\n");
+    printf("                    0 for no limit.\n");
+    printf("    --restart-quarantine=SECONDS\n");
+    printf("                    Time until a quarantined redis-server is restarted. Default is 600.\n");
+    printf("    --redis-socket=PATH\n");
+    printf("                    Health check over the unix socket of redis\n");
+    printf("                    (unixsocket of redis.conf) instead of ip and port.\n");
+    printf("    --redis-ping-interval=SECONDS\n");
+    printf("                    Interval seconds while ping(health) check.\n");
+    printf("                    Takes msec with 'ms' suffix, as 500ms.\n");
+    printf("    --redis-ping-jitter=PERCENT\n");
+    printf("                    Randomize each ping interval by +-PERCENT, so probes\n");
+    printf("                    of instances do not fire in lockstep. Default is %d.\n", DEFAULT_REDIS_PING_JITTER);
+    printf("    --redis-ready-timeout=MSEC\n");
+    printf("                    redis-server is probed right after started, with backoff\n");
+    printf("                    from %d to %d msec. Failures are not counted in MSEC,\n", REDIS_READY_BACKOFF_MIN, REDIS_READY_BACKOFF_MAX);
+    printf("                    nor while it is loading the dataset. Default is %d.\n", DEFAULT_REDIS_READY_TIMEOUT);
+    printf("    --redis-loading-stall=SECONDS\n");
+    printf("                    While redis-server is loading the dataset, probes are not\n");
+    printf("                    counted as failures. It is restarted only when the load\n");
+    printf("                    makes no progress in SECONDS. Default is %d.\n", DEFAULT_REDIS_LOADING_STALL / 1000);
+    printf("    --redis-prewarm\n");
+    printf("                    Read the RDB or AOF of redis.conf (dir, dbfilename,\n");
+    printf("                    appendonly, appendfilename, appenddirname) into the page\n");
+    printf("                    cache before starting redis-server.\n");
+    printf("    --redis-prewarm-threads=COUNT\n");
+    printf("                    Threads reading the dataset in parallel. Default is %d.\n", DEFAULT_PREWARM_THREADS);
+    printf("    --redis-max-fail-count=COUNT\n");
+    printf("                    Threshold for judging redis failure.\n");
+    printf("    --failure-detector=count|phi\n");
+    printf("                    count restarts redis-server after --redis-max-fail-count\n");
+    printf("                    consecutive failures. phi restarts it when the phi accrual\n");
+    printf("                    suspicion of probe arrivals reaches --phi-threshold.\n");
+    printf("                    Default is count.\n");
+    printf("    --phi-threshold=PHI\n");
+    printf("                    Default is %.1f, phi 8 is a mistake of 1 in 10^8.\n", DEFAULT_PHI_THRESHOLD);
+    printf("    --redis-connect-timeout=MSEC\n");
+    printf("                    Deadline of connecting to redis-server. Default is 1000.\n");
+    printf("    --redis-write-timeout=MSEC\n");
+    printf("                    Deadline of sending ping to redis-server. Default is 1000.\n");
+    printf("    --redis-pong-timeout=MSEC\n");
+    printf("                    Deadline of receiving pong from redis-server. Default is 1000.\n");
+    printf("    --redis-probe=ping[,info[:SECTION]][,role]...\n");
+    printf("                    Commands pipelined in one health check round trip.\n");
+    printf("                    PING is always sent first. Default is ping.\n");
+    printf("    --redis-shutdown=[nosave|save|default]\n");
+    printf("                    Argument of SHUTDOWN sent to stop redis-server.\n");
+    printf("                    default saves as save points of redis.conf.\n");
+    printf("                    SIGTERM is sent when SHUTDOWN is refused.\n");
+    printf("    --redis-standby-port=PORT\n");
+    printf("                    Run a replica of redis-server on PORT as hot standby.\n");
+    printf("                    It is promoted when redis-server fails, and the node\n");
+    printf("                    data is pointed to it by addr=IP:PORT.\n");
+    printf("    --redis-announce-ip=IP\n");
+    printf("                    Address of redis-server for replicas of other hosts\n");
+    printf("                    with --zoo-election. Default is --redis-ip.\n");
+    printf("    --redis-stop-timeout=SECONDS\n");
+    printf("                    SIGKILL when redis-server is not stopped in it.\n");
+    printf("                    Default is 10 seconds, takes msec with 'ms' suffix.\n");
+    printf("    --instance=SPEC\n");
+    printf("                    Supervise one more redis-server in this process.\n");
+    printf("                    SPEC is comma separated KEY=VALUE, keys are\n");
+    printf("                    name, bin, conf, ip, port, socket, standby, path, nodename,\n");
+    printf("                    nodedata and proxy, as --proxy-listen of this instance.\n");
+    printf("                    Missing keys take --redis-*, --zoo-* option values.\n");
+    printf("                    Can be used several times.\n");
+    printf("    --instance-file=PATH\n");
+    printf("                    File of instance SPECs, one per line.\n");
+    printf("    --latency-window=SECONDS\n");
+    printf("                    Rolling window of probe latency percentiles.\n");
+    printf("                    Logged at INFO level every 1/%d of it. Default is %d.\n", HIST_RING, DEFAULT_LATENCY_WINDOW);
+    printf("    --zoo-host=ZOOKEEPERHOSTS\n");
+    printf("                    Connection string for zookeeper server.\n");
+    printf("    --zoo-path=NODEPATH\n");
+    printf("                    Parent zookeeper path.\n");
+    printf("                    This option works with zoo-host option.\n");
+    printf("    --zoo-nodename=NODENAME\n");
+    printf("                    Create node name what is guarrentee redis-server alive\n");
+    printf("                    This option works with zoo-host and zoo-path option.\n");
+    printf("    --zoo-nodedata=NODEDATA\n");
+    printf("                    What data string in the zoo-nodename node.\n");
+    printf("                    Default is \"1\", up to %d bytes.\n", ZOO_NODEDATA_MAX);
+    printf("                    This option works with zoo-host and zoo-path option.\n");
+    printf("    --zoo-retry-interval=MSEC\n");
+    printf("                    Retry interval of a failed node update. Default is %d.\n", DEFAULT_ZOO_CONNECT_WAIT_INTERVAL);
+    printf("    --zoo-nodedata-latency\n");
+    printf("                    Append probe latency (p50, p99, p999, max usec) of\n");
+    printf("                    the rolling window to the node data.\n");
+    printf("    --zoo-nodedata-loading\n");
+    printf("                    Register the node while redis-server is loading the\n");
+    printf("                    dataset, with its progress (percent) and ETA (sec)\n");
+    printf("                    appended to the node data, as \"1 loading=42.50 eta=30\".\n");
+    printf("    --zoo-nodedata-format=text|msgpack\n");
+    printf("                    text is --zoo-nodedata followed by optional stats.\n");
+    printf("                    msgpack is a map of v (version, %d), data (--zoo-nodedata),\n", NODEDATA_VERSION);
+    printf("                    role, used_memory, connected_clients, ops_per_sec,\n");
+    printf("                    p99_usec, repl_offset, and addr, loading and eta when\n");
+    printf("                    they apply. INFO is added to --redis-probe for it.\n");
+    printf("    --zoo-nodedata-threshold=PERCENT\n");
+    printf("                    msgpack node data is written again once a stat moves\n");
+    printf("                    by more than PERCENT. Default is %d, 0 for any change.\n", DEFAULT_NODEDATA_THRESHOLD);
+    printf("    --zoo-batch-window=MSEC\n");
+    printf("                    Node updates of the instances within MSEC are sent as\n");
+    printf("                    one zoo_multi transaction, the nodes of a new session\n");
+    printf("                    are created by one. Default is %d, 0 disables it.\n", DEFAULT_ZOO_BATCH_WINDOW);
+    printf("    --zoo-election\n");
+    printf("                    Elect the master of the instances of --zoo-path with\n");
+    printf("                    sequential nodes of <zoo-path>/election. The master is\n");
+    printf("                    sent REPLICAOF NO ONE and published in <zoo-path>/master\n");
+    printf("                    as IP:PORT, the others are sent REPLICAOF of it.\n");
+    printf("                    The candidate of the largest repl offset is elected, a\n");
+    printf("                    master far ahead of it is not made its replica.\n");
+    printf("    --zoo-session-file=PATH\n");
+    printf("                    Keep the zookeeper session id in PATH. zoodis restarted\n");
+    printf("                    within --zoo-timeout resumes the session, and its nodes\n");
+    printf("                    are not removed and created again. The session is not\n");
+    printf("                    closed on exit then.\n");
+    printf("    --proxy-listen=[IP:]PORT\n");
+    printf("                    Forward client connections on PORT to the redis-server,\n");
+    printf("                    or the master with --zoo-election, while it is healthy.\n");
+    printf("                    With --instance, use proxy= of the instance instead.\n");
+    printf("                    IP is %s when left out.\n", DEFAULT_PROXY_IP);
+    printf("    --pid-file=PATH\n");
+    printf("                    Pid file path.\n");
+    printf("    --log-level=[DEBUG|INFO|WARN|ERROR]\n");
+    printf("                    Set logging level.\n");
+    printf("                    Default is WARN\n");
+    printf("    --version\n");
+    printf("                    Print version.\n");
+    printf("    --help\n");
+    printf("                    This message.\n");
+    exit(0);
+}
+
+static void redis_prewarm_done(struct prewarm *pw)
+{
+    struct instance *inst = (struct instance*) pw->data;
+    utime_t elapsed = pw->end_time - pw->start_time;
+
+    log_info("Prewarm: instance:%s %d file(s) %"PRIu64" bytes in %"PRIu64" msec, %.1f MB/s",
+            inst->name->data, pw->file_count, pw->bytes, elapsed / 1000,
+            elapsed ? (double)pw->bytes / elapsed : 0.0);
+
+    // still wanted, zoodis may be stopping. While the previous daemon
+    // is being stopped, it is started when reaped.
+    if(inst->redis_stat == REDIS_STAT_NONE && !zoodis.stopping && !timer_pending(&inst->restart_timer))
+        exec_redis(inst);
+}
+
+// Returns 0 when the dataset is being read into the page cache,
+// exec_redis() is called when it is done.
+static int redis_prewarm_start(struct instance *inst)
+{
+    static char paths[PREWARM_FILES_MAX][PATH_MAX];
+    int count;
+
+    if(prewarm_active(&inst->redis_prewarm))
+        return 0;
+
+    timer_del(zoodis.tw, &inst->restart_timer);
+
+    // redis.conf may have been rewritten since the last start.
+    conf_init(&inst->redis_config);
+    conf_load(&inst->redis_config, inst->redis_conf->data);
+
+    count = prewarm_files(&inst->redis_config, paths, PREWARM_FILES_MAX);
+    if(prewarm_start(zoodis.el, &inst->redis_prewarm, paths, count, zoodis.redis_prewarm_threads, redis_prewarm_done, inst) < 0)
+    {
+        log_debug("Prewarm: nothing to warm. instance:%s", inst->name->data);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Start redis-server. With --redis-prewarm, its dataset is read into the
+// page cache first, while the previous daemon is still shutting down.
+void redis_start(struct instance *inst)
+{
+    // a standby is filled by its primary.
+    if(zoodis.redis_prewarm && inst->primary == NULL && redis_prewarm_start(inst) == 0)
+        return;
+
+    exec_redis(inst);
+}
+
+// redis.conf of the instance, with the endpoint when it is not that of
+// redis.conf, which is so for a standby and after a takeover.
+// A standby replicates its primary without persistence of its own.
+static void redis_exec_argv(struct instance *inst, char **argv, char buf[][PATH_MAX])
+{
+    struct redis_config *c = &inst->redis_config;
+    int argc = 0;
+
+    argv[argc++] = inst->redis_bin->data;
+    argv[argc++] = inst->redis_conf->data;
+
+    if(inst->redis_port != (c->port < 0 ? DEFAULT_REDIS_PORT : c->port))
+    {
+        argv[argc++] = "--port";
+        snprintf(buf[0], PATH_MAX, "%d", inst->redis_port);
+        argv[argc++] = buf[0];
+    }
+
+    if(inst->redis_socket != NULL && strcmp(inst->redis_socket->data, c->unixsocket) != 0)
+    {
+        argv[argc++] = "--unixsocket";
+        argv[argc++] = inst->redis_socket->data;
+    }
+
+    if(inst->primary != NULL)
+    {
+        argv[argc++] = "--replicaof";
+        argv[argc++] = inst->primary->redis_ip->data;
+        snprintf(buf[1], PATH_MAX, "%d", inst->primary->redis_port);
+        argv[argc++] = buf[1];
+        // the primary runs the same redis.conf
+        if(c->requirepass[0] != '\0')
+        {
+            argv[argc++] = "--masterauth";
+            argv[argc++] = c->requirepass;
+        }
+        argv[argc++] = "--save";
+        argv[argc++] = "";
+        argv[argc++] = "--appendonly";
+        argv[argc++] = "no";
+        argv[argc++] = "--dbfilename";
+        snprintf(buf[2], PATH_MAX, "standby-%d.rdb", inst->redis_port);
+        argv[argc++] = buf[2];
+        // nor does it replace the pidfile of the primary, or write its log.
+        if(c->pidfile[0] != '\0')
+        {
+            argv[argc++] = "--pidfile";
+            snprintf(buf[3], PATH_MAX, "%s.standby", c->pidfile);
+            argv[argc++] = buf[3];
+        }
+        if(c->logfile[0] != '\0')
+        {
+            argv[argc++] = "--logfile";
+            snprintf(buf[4], PATH_MAX, "%s.standby", c->logfile);
+            argv[argc++] = buf[4];
+        }
+    }
+
+    argv[argc] = NULL;
+}
+
+void exec_redis(struct instance *inst)
+{
+    char *argv[REDIS_EXEC_ARGS_MAX];
+    char buf[5][PATH_MAX];
+    pid_t pid;
+
+    timer_del(zoodis.tw, &inst->restart_timer);
+
+    // never reuse a connection to the previous daemon.
+    probe_close(zoodis.el, &inst->redis_probe);
+    phi_reset(&inst->redis_phi);
+
+    pid = fork();
+
+    if(pid < 0)
+    {
+        log_err("Redis: Failed forming process, %s", strerror(errno));
+        exit_proc(-1);
+    }
+
+    if(pid == 0)
+    {
+        // blocked for the signalfd of zoodis, not for redis-server.
+        signal_block(SIG_UNBLOCK);
+
+        redis_exec_argv(inst, argv, buf);
+        if(execv(argv[0], argv) < 0)
+        {
+            log_err("Redis: failed to execute redis daemon. %s", strerror(errno));
+        }
+        _exit(-1);
+    }else
+    {
+        inst->redis_pid = pid;
+        inst->redis_stat = REDIS_STAT_EXECUTED;
+        // probed right away, see redis_not_ready().
+        inst->redis_exec_time = utime_mono();
+        inst->redis_ready_backoff = REDIS_READY_BACKOFF_MIN;
+        inst->redis_standby_synced = 0;
+        inst->redis_master[0] = '\0';
+        inst->redis_replicaof_pending = 0;
+        inst->redis_replicating = 0;
+        memset(&inst->redis_info, 0x00, sizeof(struct redis_info));
+        timer_add(zoodis.tw, &inst->check_timer, REDIS_READY_BACKOFF_MIN);
+        log_info("Redis: started redis daemon. instance:%s PID:%d", inst->name->data, pid);
+    }
+
+    return;
+}
+
+static void redis_term(struct instance *inst)
+{
+    log_info("Redis: SIGTERM to daemon. instance:%s PID:%d", inst->name->data, inst->redis_pid);
+    kill(inst->redis_pid, SIGTERM);
+    inst->redis_term_time = utime_mono();
+}
+
+// Stop redis-server, it is never left running beside a new one.
+// SHUTDOWN is sent over the probe connection, SIGTERM when it is refused
+// or cannot be sent, and SIGKILL when it is not reaped in --redis-stop-timeout.
+// signal_sigchld() completes the stop, and starts it again when RESTART.
+void redis_stop(struct instance *inst, int restart)
+{
+    struct redis_req *r = &inst->redis_shutdown_req;
+
+    if(inst->redis_pid == 0)
+        return;
+
+    inst->redis_restart = restart;
+    if(inst->redis_stat == REDIS_STAT_KILLING)
+        return;
+
+    log_info("Redis: stopping daemon. instance:%s PID:%d", inst->name->data, inst->redis_pid);
+    inst->redis_stat = REDIS_STAT_KILLING;
+    inst->redis_stop_time = utime_mono();
+    inst->redis_term_time = 0;
+    inst->redis_kill_time = 0;
+    timer_del(zoodis.tw, &inst->check_timer);
+    timer_add(zoodis.tw, &inst->stop_timer, zoodis.redis_stop_timeout);
+    zu_ephemeral_update(&zoodis, inst);
+
+    // its dataset is read while it shuts down.
+    if(restart && zoodis.redis_prewarm && inst->primary == NULL)
+        redis_prewarm_start(inst);
+
+    // a probe in flight is dropped, a new connection has to be authenticated.
+    probe_close(zoodis.el, &inst->redis_probe);
+    inst->redis_req = r;
+    inst->redis_req_first = 0;
+    probe_start(zoodis.el, &inst->redis_probe, r->data->data, r->data->len, r->count);
+}
+
+// Stop with SIGKILL right away, a failed primary that is taken over.
+// It would save on SIGTERM and append to its AOF, in the dir that the
+// promoted standby persists to.
+static void redis_kill(struct instance *inst, int restart)
+{
+    if(inst->redis_pid == 0)
+        return;
+
+    inst->redis_restart = restart;
+    if(inst->redis_stat != REDIS_STAT_KILLING)
+    {
+        inst->redis_stat = REDIS_STAT_KILLING;
+        inst->redis_stop_time = utime_mono();
+        timer_del(zoodis.tw, &inst->check_timer);
+        timer_add(zoodis.tw, &inst->stop_timer, zoodis.redis_stop_timeout);
+        zu_ephemeral_update(&zoodis, inst);
+    }else if(inst->redis_kill_time != 0)
+    {
+        return;
+    }
+
+    log_warn("Redis: SIGKILL to daemon. instance:%s PID:%d", inst->name->data, inst->redis_pid);
+    probe_close(zoodis.el, &inst->redis_probe);
+    kill(inst->redis_pid, SIGKILL);
+    inst->redis_term_time = utime_mono();
+    inst->redis_kill_time = inst->redis_term_time;
+}
+
+// redis-server closes the connection when SHUTDOWN is accepted,
+// any reply is an error such as a failed save.
+static void redis_stop_reply(struct instance *inst, struct probe *p, enum probe_res res)
+{
+    if(inst->redis_term_time != 0)
+        return;
+
+    if(res == PROBE_RES_CLOSED)
+    {
+        inst->redis_term_time = utime_mono();
+        log_debug("Redis: SHUTDOWN accepted. instance:%s", inst->name->data);
+        return;
+    }
+
+    if(res == PROBE_RES_OK)
+    {
+        log_warn("Redis: SHUTDOWN refused, %.*s instance:%s", (int)p->buf_len, p->buf, inst->name->data);
+    }else
+    {
+        log_warn("Redis: SHUTDOWN failed, %s. instance:%s", probe_res_str(res), inst->name->data);
+    }
+
+    probe_close(zoodis.el, p);
+    redis_term(inst);
+}
+
+static void redis_stop_timer(struct timer_wheel *tw, struct timer *t)
+{
+    struct instance *inst = (struct instance*) t->data;
+
+    if(inst->redis_stat != REDIS_STAT_KILLING || inst->redis_pid == 0)
+        return;
+
+    log_warn("Redis: not stopped in %d msec, SIGKILL. instance:%s PID:%d",
+            zoodis.redis_stop_timeout, inst->name->data, inst->redis_pid);
+    kill(inst->redis_pid, SIGKILL);
+    inst->redis_kill_time = utime_mono();
+}
+
+#define SWAP(_t_, _a_, _b_) do { _t_ _tmp_ = (_a_); (_a_) = (_b_); (_b_) = _tmp_; } while(0)
+
+// Take over a failed instance by its standby, returns 0 when there is no
+// synced standby. The processes and endpoints of the two are swapped, so the
+// instance keeps its node. The standby kills what was the primary before it
+// is promoted, and is started again as a replica on its endpoint.
+int redis_takeover(struct instance *inst)
+{
+    struct instance *sb = inst->standby;
+
+    if(sb == NULL || zoodis.stopping || sb->redis_stat != REDIS_STAT_OK || !sb->redis_standby_synced)
+        return 0;
+
+    log_warn("Redis: taking over by standby PID:%d port:%d. instance:%s", sb->redis_pid, sb->redis_port, inst->name->data);
+    inst->redis_takeover_time = utime_mono();
+
+    timer_del(zoodis.tw, &inst->check_timer);
+    timer_del(zoodis.tw, &inst->restart_timer);
+    timer_del(zoodis.tw, &sb->check_timer);
+    probe_close(zoodis.el, &inst->redis_probe);
+    probe_close(zoodis.el, &sb->redis_probe);
+
+    SWAP(pid_t, inst->redis_pid, sb->redis_pid);
+    SWAP(int, inst->redis_port, sb->redis_port);
+    SWAP(struct mstr*, inst->redis_socket, sb->redis_socket);
+    SWAP(struct sockaddr_storage, inst->redis_addr, sb->redis_addr);
+    SWAP(socklen_t, inst->redis_addr_len, sb->redis_addr_len);
+    SWAP(struct redis_info, inst->redis_info, sb->redis_info);
+    redis_probe_setup(inst);
+    redis_probe_setup(sb);
+
+    // never two processes writing the dataset of redis.conf.
+    if(sb->redis_pid != 0)
+        redis_kill(sb, 1);
+
+    // not registered until promoted.
+    inst->redis_stat = REDIS_STAT_EXECUTED;
+    inst->redis_fail_count = 0;
+    phi_reset(&inst->redis_phi);
+    instance_nodedata(&zoodis, inst);
+    zu_ephemeral_update(&zoodis, inst);
+
+    inst->redis_promoting = 1;
+    inst->redis_req = &inst->redis_promote_req;
+    inst->redis_req_first = 0;
+    probe_start(zoodis.el, &inst->redis_probe, inst->redis_promote_req.data->data, inst->redis_promote_req.data->len, inst->redis_promote_req.count);
+
+    sb->redis_standby_synced = 0;
+    phi_reset(&sb->redis_phi);
+
+    // promoted by itself, --zoo-election sends REPLICAOF again.
+    inst->redis_master[0] = '\0';
+    inst->redis_replicaof_pending = 0;
+    inst->redis_replicating = 0;
+    if(sb->redis_pid == 0)
+    {
+        sb->redis_stat = REDIS_STAT_NONE;
+        redis_start(sb);
+    }
+
+    return 1;
+}
+
+// Reply of REPLICAOF NO ONE, the rest are logged when they fail.
+// The instance is restarted from its dataset when not promoted.
+static void redis_promote_done(struct instance *inst, struct probe *p, enum probe_res res)
+{
+    const struct redis_req *r = inst->redis_req;
+    struct resp_parser rp;
+    struct resp_token tok;
+    int i, promoted = 0;
+
+    inst->redis_promoting = 0;
+
+    if(res == PROBE_RES_OK)
+    {
+        resp_init(&rp);
+        resp_feed(&rp, p->buf, p->buf_len);
+        for(i = 0; i < r->count && resp_next(&rp, &tok) == RESP_OK; i++)
+        {
+            if(r->cmds[i] == REDIS_CMD_REPLICAOF)
+                promoted = tok.type == RESP_STRING && resp_str_eq(&tok, "OK");
+            else if(resp_is_error(&tok))
+                log_warn("Redis: promote command %d failed, %.*s instance:%s", i, (int)tok.str.len, (char*)tok.str.data, inst->name->data);
+        }
+    }
+
+    if(!promoted)
+    {
+        log_err("Redis: standby not promoted, %s. instance:%s", probe_res_str(res), inst->name->data);
+        inst->redis_stat = REDIS_STAT_ABNORMAL;
+        redis_stop(inst, 1);
+        return;
+    }
+
+    log_info("Redis: took over in %"PRIu64" msec, port:%d. instance:%s",
+            (utime_mono() - inst->redis_takeover_time) / 1000, inst->redis_port, inst->name->data);
+    inst->redis_stat = REDIS_STAT_OK;
+    zu_ephemeral_update(&zoodis, inst);
+    timer_add(zoodis.tw, &inst->check_timer, redis_ping_delay(zoodis.redis_ping_interval));
+}
+
+// --zoo-election, HOST NULL when INST is the master. Sent over the probe
+// connection once no probe is in flight, a failed one after the next
+// successful probe.
+void redis_replicaof(struct instance *inst, const char *host, int port)
+{
+    const char *pass = inst->redis_config.requirepass;
+    const char *argv[4];
+    struct redis_req r;
+    char master[sizeof(inst->redis_master)];
+    char buf[16];
+
+    if(host == NULL)
+        snprintf(master, sizeof(master), "NO ONE");
+    else
+        snprintf(master, sizeof(master), "%s %d", host, port);
+
+    if(strcmp(master, inst->redis_master) == 0)
+        return;
+
+    snprintf(inst->redis_master, sizeof(inst->redis_master), "%s", master);
+    log_warn("Redis: REPLICAOF %s, elected. instance:%s", master, inst->name->data);
+
+    if(inst->redis_replicaof_req.data != NULL)
+        mstr_free_dup(inst->redis_replicaof_req.data);
+
+    memset(&r, 0x00, sizeof(struct redis_req));
+
+    // masters of the group share the requirepass of redis.conf
+    if(host != NULL && pass[0] != '\0')
+    {
+        argv[0] = "CONFIG";
+        argv[1] = "SET";
+        argv[2] = "masterauth";
+        argv[3] = pass;
+        redis_probe_append(&r, REDIS_CMD_CONFIG, 4, argv);
+    }
+
+    argv[0] = "REPLICAOF";
+    if(host == NULL)
+    {
+        argv[1] = "NO";
+        argv[2] = "ONE";
+    }else
+    {
+        snprintf(buf, sizeof(buf), "%d", port);
+        argv[1] = host;
+        argv[2] = buf;
+    }
+    redis_probe_append(&r, REDIS_CMD_REPLICAOF, 3, argv);
+
+    redis_req_auth(&inst->redis_replicaof_req, &r, pass);
+    if(pass[0] != '\0')
+        mstr_free_dup(r.data);
+
+    inst->redis_replicaof_pending = 1;
+    if(redis_probing(inst) && !probe_in_flight(&inst->redis_probe))
+        redis_replicaof_send(inst);
+}
+
+static void redis_replicaof_send(struct instance *inst)
+{
+    const struct redis_req *r = &inst->redis_replicaof_req;
+    size_t skip = 0;
+
+    inst->redis_replicaof_pending = 0;
+    inst->redis_replicating = 1;
+
+    // a kept connection is already authenticated
+    inst->redis_req = r;
+    inst->redis_req_first = 0;
+    if(r->auth_len > 0 && probe_is_open(&inst->redis_probe))
+    {
+        skip = r->auth_len;
+        inst->redis_req_first = 1;
+    }
+
+    probe_start(zoodis.el, &inst->redis_probe, (char*)r->data->data + skip, r->data->len - skip, r->count - inst->redis_req_first);
+}
+
+static void redis_replicaof_done(struct instance *inst, struct probe *p, enum probe_res res)
+{
+    const struct redis_req *r = inst->redis_req;
+    struct resp_parser rp;
+    struct resp_token tok;
+    int i, ok = 0;
+
+    inst->redis_replicating = 0;
+
+    if(res == PROBE_RES_OK)
+    {
+        resp_init(&rp);
+        resp_feed(&rp, p->buf, p->buf_len);
+        for(i = inst->redis_req_first; i < r->count && resp_next(&rp, &tok) == RESP_OK; i++)
+        {
+            if(r->cmds[i] == REDIS_CMD_REPLICAOF)
+                ok = tok.type == RESP_STRING && resp_str_eq(&tok, "OK");
+            else if(resp_is_error(&tok))
+                break;
+            if(!tok.last && resp_skip(&rp) != RESP_OK)
+                break;
+        }
+    }
+
+    if(!ok)
+    {
+        log_err("Redis: REPLICAOF %s failed, %s. instance:%s", inst->redis_master, probe_res_str(res), inst->name->data);
+        inst->redis_replicaof_pending = 1;
+        return;
+    }
+
+    log_info("Redis: REPLICAOF %s done. instance:%s", inst->redis_master, inst->name->data);
+}
+
+// Number of redis-server processes, standbys included.
+static int redis_alive(void)
+{
+    struct instance *inst;
+    int i, alive = 0;
+
+    for(i = 0; i < zoodis.instance_count; i++)
+    {
+        inst = zoodis.instances[i];
+        if(inst->redis_pid != 0)
+            alive++;
+        if(inst->standby != NULL && inst->standby->redis_pid != 0)
+            alive++;
+    }
+
+    return alive;
+}
+
+// The child of a stop sequence is reaped.
+static void redis_stopped(struct instance *inst, int stat)
+{
+    utime_t now = utime_mono();
+    utime_t term = inst->redis_term_time ? inst->redis_term_time : now;
+
+    timer_del(zoodis.tw, &inst->stop_timer);
+    probe_close(zoodis.el, &inst->redis_probe);
+
+    log_info("Redis: stopped in %"PRIu64" msec, shutdown:%"PRIu64" msec exit:%"PRIu64" msec%s status:%d. instance:%s",
+            (now - inst->redis_stop_time) / 1000, (term - inst->redis_stop_time) / 1000, (now - term) / 1000,
+            inst->redis_kill_time ? " killed" : "", WIFSIGNALED(stat) ? -WTERMSIG(stat) : WEXITSTATUS(stat),
+            inst->name->data);
+
+    inst->redis_pid = 0;
+    inst->redis_stat = REDIS_STAT_NONE;
+    zu_ephemeral_update(&zoodis, inst);
+
+    if(zoodis.stopping)
+    {
+        if(redis_alive() == 0)
+            exit_proc(0);
+        return;
+    }
+
+    if(inst->redis_restart)
+        redis_restart(inst, 0);
+}
+
+// Every redis-server is stopped before zoodis exits.
+// Once more and the daemons being stopped are killed.
+static void redis_suspend(struct instance *inst)
+{
+    timer_del(zoodis.tw, &inst->restart_timer);
+    if(inst->redis_pid == 0)
+        return;
+
+    if(zoodis.stopping && inst->redis_kill_time == 0)
+    {
+        log_warn("Redis: SIGKILL to daemon. instance:%s PID:%d", inst->name->data, inst->redis_pid);
+        kill(inst->redis_pid, SIGKILL);
+        inst->redis_kill_time = utime_mono();
+    }else
+    {
+        redis_stop(inst, 0);
+    }
+}
+
+void signal_sigint(int sig)
+{
+    struct instance *inst;
+    int i;
+
+    log_debug("Signal: Received shutdown singal, NO:%d", sig);
+    log_info("Suspending zoodis,", sig);
+    zoodis.keepalive = 0;
+
+    for(i = 0; i < zoodis.instance_count; i++)
+    {
+        inst = zoodis.instances[i];
+        redis_suspend(inst);
+        if(inst->standby != NULL)
+            redis_suspend(inst->standby);
+    }
+
+    zoodis.stopping = 1;
+    if(redis_alive() == 0)
+        exit_proc(0);
+}
+
+void signal_sigchld(int sig)
+{
+    struct instance *inst;
+    int stat, pid;
+
+    while((pid = waitpid(-1, &stat, WNOHANG)) > 0)
+    {
+        inst = instance_find_pid(&zoodis, pid);
+        log_debug("Signal: received SIGCHLD PID:%d, instance:%s", pid, inst == NULL ? "-" : inst->name->data);
+        if(inst == NULL)
+            continue;
+
+        if(inst->redis_stat == REDIS_STAT_KILLING)
+        {
+            redis_stopped(inst, stat);
+            continue;
+        }
+
+        inst->redis_pid = 0;
+        inst->redis_stat = REDIS_STAT_NONE;
+        timer_del(zoodis.tw, &inst->check_timer);
+        zu_ephemeral_update(&zoodis, inst);
+
+        if(WIFSIGNALED(stat))
+        {
+            log_err("Redis: daemon has been down by signal %d. Please check redis log file. instance:%s", WTERMSIG(stat), inst->name->data);
+        }else
+        {
+            log_err("Redis: daemon has been down, exit %d. Please check redis log file. instance:%s", WEXITSTATUS(stat), inst->name->data);
+        }
+
+        if(redis_takeover(inst))
+            continue;
+
+        if(zoodis.keepalive)
+        {
+            redis_restart(inst, zoodis.keepalive_interval);
+            continue;
+        }
+
+        if(redis_alive() == 0)
+            exit(-1);
+    }
+}
+
+static void signal_set(sigset_t *set)
+{
+    sigemptyset(set);
+    sigaddset(set, SIGCHLD);
+    sigaddset(set, SIGINT);
+    sigaddset(set, SIGPIPE);
+    sigaddset(set, SIGTERM);
+    sigaddset(set, SIGTSTP);
+    sigaddset(set, SIGHUP);
+}
+
+// SIG_BLOCK before any thread is created, so every thread inherits it.
+// SIG_UNBLOCK in a forked child before exec.
+void signal_block(int how)
+{
+    sigset_t set;
+
+    signal_set(&set);
+    sigprocmask(how, &set, NULL);
+}
+
+static void signal_event(struct event_loop *el, struct event *ev, uint32_t mask)
+{
+    struct signalfd_siginfo si;
+
+    while(read(ev->fd, &si, sizeof(si)) == sizeof(si))
+    {
+        // EPIPE of splice() in the proxy, which has no MSG_NOSIGNAL
+        if(si.ssi_signo == SIGPIPE)
+            continue;
+
+        if(si.ssi_signo == SIGCHLD)
+            signal_sigchld(si.ssi_signo);
+        else
+            signal_sigint(si.ssi_signo);
+    }
+}
+
+// Signals are handled in the main loop, never in a signal handler.
+// No restart runs in the middle of another, and a child exit is caught
+// as soon as the loop wakes up.
+int signal_init(struct zoodis *z)
+{
+    sigset_t set;
+    int fd;
+
+    signal_set(&set);
+    fd = signalfd(-1, &set, SFD_NONBLOCK|SFD_CLOEXEC);
+    if(fd < 0)
+    {
+        log_err("Cannot create signalfd. %s", strerror(errno));
+        return -1;
+    }
+
+    event_init(&z->sig_ev, fd, signal_event, z);
+    if(event_add(z->el, &z->sig_ev, EVENT_READ) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return 0;
+}
+
+int redis_probing(struct instance *inst)
+{
+    return inst->redis_stat == REDIS_STAT_EXECUTED ||
+        inst->redis_stat == REDIS_STAT_LOADING ||
+        inst->redis_stat == REDIS_STAT_OK ||
+        inst->redis_stat == REDIS_STAT_ABNORMAL;
+}
+
+// PING is refused with -LOADING until the dataset is loaded, which takes
+// minutes for a large one. Failed probes are not counted then, only
+// a load that makes no progress for --redis-loading-stall is a failure.
+void redis_loading(struct instance *inst)
+{
+    struct redis_info *info = &inst->redis_info;
+    utime_t now = utime_mono();
+    double rate;
+    int64_t eta;
+    int delay;
+
+    if(inst->redis_stat != REDIS_STAT_LOADING)
+    {
+        log_info("Redis: loading dataset. instance:%s", inst->name->data);
+        inst->redis_stat = REDIS_STAT_LOADING;
+        inst->redis_fail_count = 0;
+        inst->redis_loading_time = now;
+        inst->redis_progress_time = now;
+        inst->redis_progress_perc = info->loading_loaded_perc;
+        inst->redis_loading_rate = 0;
+    }else if(info->loading_loaded_perc > inst->redis_progress_perc)
+    {
+        rate = (info->loading_loaded_perc - inst->redis_progress_perc) * 1000000 / (now - inst->redis_progress_time);
+        inst->redis_loading_rate = inst->redis_loading_rate == 0 ? rate : inst->redis_loading_rate * 0.7 + rate * 0.3;
+        inst->redis_progress_perc = info->loading_loaded_perc;
+        inst->redis_progress_time = now;
+    }else if(now - inst->redis_progress_time >= (utime_t)zoodis.redis_loading_stall * 1000)
+    {
+        log_err("Redis: loading stalled at %.2f%% for %d msec. instance:%s",
+                inst->redis_progress_perc, zoodis.redis_loading_stall, inst->name->data);
+        inst->redis_stat = REDIS_STAT_ABNORMAL;
+        redis_stop(inst, 1);
+        return;
+    }
+
+    eta = info->loading_eta_seconds;
+    if(eta <= 0 && inst->redis_loading_rate > 0)
+        eta = (int64_t)((100.0 - inst->redis_progress_perc) / inst->redis_loading_rate);
+
+    log_info("Redis: loading %.2f%% %.2f%%/sec eta:%"PRId64"sec instance:%s",
+            inst->redis_progress_perc, inst->redis_loading_rate, eta, inst->name->data);
+    inst->redis_loading_eta = eta;
+
+    instance_nodedata(&zoodis, inst);
+    zu_ephemeral_update(&zoodis, inst);
+
+    // sooner when it is about to finish, the node is registered right after.
+    delay = eta > 0 && eta * 1000 < zoodis.redis_ping_interval ? (int)eta * 1000 : zoodis.redis_ping_interval;
+    if(delay < REDIS_READY_BACKOFF_MAX)
+        delay = REDIS_READY_BACKOFF_MAX;
+
+    timer_add(zoodis.tw, &inst->check_timer, delay);
+}
+
+// Judge the instance failed after a failed probe. The phi detector decides
+// once it has history of the instance, consecutive failures are counted
+// before that and with --failure-detector=count.
+int redis_failure_detected(struct instance *inst)
+{
+    double phi;
+
+    if(zoodis.failure_detector == FAILURE_DETECTOR_PHI && phi_ready(&inst->redis_phi))
+    {
+        phi = phi_value(&inst->redis_phi, utime_mono());
+        log_warn("Redis: phi:%.2f threshold:%.2f instance:%s", phi, zoodis.phi_threshold, inst->name->data);
+        return phi >= zoodis.phi_threshold;
+    }
+
+    return inst->redis_fail_count >= zoodis.redis_max_fail_count;
+}
+
+// Readiness phase right after exec. A failed probe is retried with
+// exponential backoff, and not counted as a failure while redis-server is
+// within --redis-ready-timeout of exec. Returns 1 then.
+int redis_not_ready(struct instance *inst)
+{
+    if(inst->redis_stat != REDIS_STAT_EXECUTED)
+        return 0;
+
+    timer_add(zoodis.tw, &inst->check_timer, inst->redis_ready_backoff);
+
+    inst->redis_ready_backoff *= 2;
+    if(inst->redis_ready_backoff > REDIS_READY_BACKOFF_MAX)
+        inst->redis_ready_backoff = REDIS_READY_BACKOFF_MAX;
+
+    return utime_mono() - inst->redis_exec_time < (utime_t)zoodis.redis_ready_timeout * 1000;
+}
+
+// Interval of probes with +-redis_ping_jitter percent applied.
+int redis_ping_delay(int msec)
+{
+    int jitter = (int)((int64_t)msec * zoodis.redis_ping_jitter / 100);
+
+    if(jitter > 0)
+        msec += (int)(random() % (2 * jitter + 1)) - jitter;
+
+    return msec > 0 ? msec : 1;
+}
+
+static void redis_check_timer(struct timer_wheel *tw, struct timer *t)
+{
+    struct instance *inst = (struct instance*) t->data;
+
+    // armed again by exec_redis.
+    if(!redis_probing(inst))
+        return;
+
+    // in readiness phase and loading, armed by redis_probe_done.
+    if(inst->redis_stat == REDIS_STAT_OK || inst->redis_stat == REDIS_STAT_ABNORMAL)
+        timer_add(tw, t, redis_ping_delay(zoodis.redis_ping_interval));
+
+    if(!probe_in_flight(&inst->redis_probe))
+        redis_health_check(inst);
+}
+
+static void redis_restart_timer(struct timer_wheel *tw, struct timer *t)
+{
+    struct instance *inst = (struct instance*) t->data;
+
+    if(inst->redis_stat == REDIS_STAT_QUARANTINED)
+    {
+        log_info("Redis: quarantine is over, restarting. instance:%s", inst->name->data);
+        memset(inst->redis_restarts, 0x00, sizeof(inst->redis_restarts));
+        inst->redis_crash_count = 0;
+        inst->redis_stat = REDIS_STAT_NONE;
+        zu_ephemeral_update(&zoodis, inst);
+    }
+
+    if(inst->redis_stat == REDIS_STAT_NONE)
+        redis_start(inst);
+}
+
+static void redis_quarantine(struct instance *inst)
+{
+    log_err("Redis: restarted %d times in %d sec, quarantined for %d sec. instance:%s",
+            zoodis.restart_budget, zoodis.restart_budget_window / 1000, zoodis.restart_quarantine / 1000, inst->name->data);
+    inst->redis_stat = REDIS_STAT_QUARANTINED;
+    zu_ephemeral_update(&zoodis, inst);
+    timer_add(zoodis.tw, &inst->restart_timer, zoodis.restart_quarantine);
+}
+
+// Every restart after an exit or a failure goes through here, DELAY in msec.
+// Restarts in a row back off exponentially from --keepalive-interval up to
+// --restart-backoff-max, then jittered down to half, so that instances do
+// not restart in lockstep. More than --restart-budget restarts in its window quarantine it.
+void redis_restart(struct instance *inst, int delay)
+{
+    utime_t now = utime_mono();
+    int64_t backoff;
+    int i, count = 0;
+
+    // up for the longest backoff, it was not in a crash loop.
+    if(now - inst->redis_exec_time >= (utime_t)zoodis.restart_backoff_max * 1000)
+        inst->redis_crash_count = 0;
+
+    if(zoodis.restart_budget > 0)
+    {
+        for(i = 0; i < RESTART_BUDGET_MAX; i++)
+        {
+            if(inst->redis_restarts[i] != 0 && now - inst->redis_restarts[i] < (utime_t)zoodis.restart_budget_window * 1000)
+                count++;
+        }
+
+        if(count >= zoodis.restart_budget)
+        {
+            redis_quarantine(inst);
+            return;
+        }
+    }
+
+    inst->redis_restarts[inst->redis_restart_pos] = now;
+    inst->redis_restart_pos = (inst->redis_restart_pos + 1) % RESTART_BUDGET_MAX;
+
+    if(inst->redis_crash_count > 0)
+    {
+        backoff = (int64_t)zoodis.keepalive_interval << (inst->redis_crash_count < 20 ? inst->redis_crash_count : 20);
+        if(backoff > zoodis.restart_backoff_max)
+            backoff = zoodis.restart_backoff_max;
+        // after the clamp, instances saturated at the max stay spread.
+        backoff = backoff / 2 + random() % (backoff / 2 + 1);
+        if(backoff > delay)
+            delay = (int)backoff;
+
+        log_warn("Redis: restart %d in a row, back off %d msec. instance:%s", inst->redis_crash_count + 1, delay, inst->name->data);
+    }
+    inst->redis_crash_count++;
+
+    // a prewarm in progress starts it when done.
+    if(delay > 0)
+        timer_add(zoodis.tw, &inst->restart_timer, delay);
+    else if(!prewarm_active(&inst->redis_prewarm))
+        exec_redis(inst);
+}
+
+static void redis_latency_timer(struct timer_wheel *tw, struct timer *t)
+{
+    struct instance *inst = (struct instance*) t->data;
+
+    redis_latency_tick(inst, utime_mono());
+    timer_add(tw, t, (uint64_t)inst->redis_latency.period * 1000);
+}
+
+void redis_health_check(struct instance *inst)
+{
+    // progress of loading is in INFO persistence, even if --redis-probe has no INFO.
+    const struct redis_req *r;
+    size_t skip = 0;
+
+    if(inst->redis_stat == REDIS_STAT_LOADING)
+        r = &inst->redis_loading_req;
+    else
+        r = &inst->redis_probe_req;
+
+    // a kept connection is already authenticated
+    inst->redis_req = r;
+    inst->redis_req_first = 0;
+    if(r->auth_len > 0 && probe_is_open(&inst->redis_probe))
+    {
+        skip = r->auth_len;
+        inst->redis_req_first = 1;
+    }
+
+    probe_start(zoodis.el, &inst->redis_probe, (char*)r->data->data + skip, r->data->len - skip, r->count - inst->redis_req_first);
+}
+
+// Walk the replies of the pipelined probe in order of its commands.
+// Returns 1 when PING was answered by PONG.
+static int redis_probe_replies(struct instance *inst, struct probe *p)
+{
+    const struct redis_req *r = inst->redis_req;
+    struct resp_parser rp;
+    struct resp_token tok;
+    int i, alive = 0;
+
+    resp_init(&rp);
+    resp_feed(&rp, p->buf, p->buf_len);
+
+    for(i = inst->redis_req_first; i < r->count; i++)
+    {
+        if(resp_next(&rp, &tok) != RESP_OK)
+            break;
+
+        if(resp_is_error(&tok))
+        {
+            // PING is refused while the dataset is being loaded.
+            if(r->cmds[i] == REDIS_CMD_PING && tok.str.len >= 7 && strncmp(tok.str.data, "LOADING", 7) == 0)
+                inst->redis_info.loading = 1;
+            else if(r->cmds[i] == REDIS_CMD_AUTH)
+            {
+                log_warn("Redis: AUTH failed, requirepass of %s, %.*s", inst->redis_conf->data, (int)tok.str.len, (char*)tok.str.data);
+            }else
+            {
+                log_warn("Redis: probe command %d failed, %.*s", i, (int)tok.str.len, (char*)tok.str.data);
+            }
+        }else
+        {
+            switch(r->cmds[i])
+            {
+            case REDIS_CMD_PING:
+                if(tok.type == RESP_STRING && resp_str_eq(&tok, "PONG"))
+                {
+                    alive = 1;
+                    inst->redis_info.loading = 0;
+                }
+                break;
+
+            case REDIS_CMD_INFO:
+                // RESP3 verbatim string starts with "txt:"
+                if(tok.type == RESP_VERBATIM && tok.str.len >= 4)
+                    info_parse(&inst->redis_info, (char*)tok.str.data + 4, tok.str.len - 4);
+                else if(tok.type == RESP_BULK)
+                    info_parse(&inst->redis_info, tok.str.data, tok.str.len);
+                break;
+
+            case REDIS_CMD_ROLE:
+                if(!tok.last && resp_next(&rp, &tok) == RESP_OK && tok.type == RESP_BULK)
+                    info_set_role(&inst->redis_info, &tok.str);
+                break;
+
+            case REDIS_CMD_AUTH:
+            case REDIS_CMD_SHUTDOWN:
+            case REDIS_CMD_REPLICAOF:
+            case REDIS_CMD_CONFIG:
+                break;
+            }
+        }
+
+        if(r->cmds[i] == REDIS_CMD_PING && !alive && !inst->redis_info.loading)
+            log_warn("Redis: test failed, responsed not PONG, %.*s", (int)tok.str.len, (char*)tok.str.data);
+
+        if(!tok.last && resp_skip(&rp) != RESP_OK)
+            break;
+    }
+
+    return alive;
+}
+
+// Log the rolling window when a period of it has been closed.
+void redis_latency_tick(struct instance *inst, utime_t now)
+{
+    if(hist_ring_rotate(&inst->redis_latency, now))
+        redis_latency_report(inst);
+}
+
+void redis_latency_report(struct instance *inst)
+{
+    struct hist h;
+
+    hist_ring_merge(&inst->redis_latency, &h);
+    if(h.count == 0 && inst->redis_probe_failed == 0)
+        return;
+
+    log_info("Latency: instance:%s window:%dsec count:%"PRIu64" failed:%"PRIu64" p50:%"PRIu64" p99:%"PRIu64" p999:%"PRIu64" max:%"PRIu64" usec",
+            inst->name->data, inst->redis_latency.period * HIST_RING, h.count, inst->redis_probe_failed,
+            hist_percentile(&h, 0.5), hist_percentile(&h, 0.99), hist_percentile(&h, 0.999), h.max);
+    inst->redis_probe_failed = 0;
+
+    if(zoodis.zookeeper && zoodis.zoo_nodedata_latency)
+    {
+        instance_nodedata(&zoodis, inst);
+        if(inst->redis_stat == REDIS_STAT_OK)
+            zu_ephemeral_update(&zoodis, inst);
+    }
+}
+
+void redis_probe_done(struct probe *p, enum probe_res res)
+{
+    struct instance *inst = (struct instance*) p->data;
+
+    if(inst->redis_stat == REDIS_STAT_KILLING)
+    {
+        redis_stop_reply(inst, p, res);
+        return;
+    }
+
+    if(inst->redis_promoting)
+    {
+        redis_promote_done(inst, p, res);
+        return;
+    }
+
+    if(inst->redis_replicating)
+    {
+        redis_replicaof_done(inst, p, res);
+        return;
+    }
+
+    // died or killed while the probe was in flight.
+    if(!redis_probing(inst))
+        return;
+
+    redis_latency_tick(inst, p->recv_time ? p->recv_time : utime_mono());
+
+    if(res == PROBE_RES_OK && redis_probe_replies(inst, p))
+    {
+        hist_record(&inst->redis_latency.slot[inst->redis_latency.cur], probe_rtt(p));
+        phi_heartbeat(&inst->redis_phi, p->recv_time, probe_rtt(p));
+        log_info("Redis: test successed. instance:%s Elapsed %"PRIu64" usec", inst->name->data, probe_rtt(p));
+        // never promoted with data of a link that went down since.
+        if(inst->primary != NULL && inst->redis_info.master_link_up != inst->redis_standby_synced)
+        {
+            if(inst->redis_info.master_link_up)
+            {
+                log_info("Redis: standby synced. instance:%s", inst->name->data);
+            }else
+            {
+                log_warn("Redis: standby lost its master link. instance:%s", inst->name->data);
+            }
+            inst->redis_standby_synced = inst->redis_info.master_link_up;
+        }
+        if(zoodis.redis_probe_req.count > 1)
+        {
+            log_info("Redis: instance:%s role:%s clients:%"PRId64" used_memory:%"PRId64" ops/sec:%"PRId64" repl_offset:%"PRId64,
+                    inst->name->data, inst->redis_info.role, inst->redis_info.connected_clients, inst->redis_info.used_memory,
+                    inst->redis_info.instantaneous_ops_per_sec, inst->redis_info.master_repl_offset);
+        }
+
+        if(inst->redis_stat == REDIS_STAT_EXECUTED || inst->redis_stat == REDIS_STAT_LOADING)
+        {
+            if(inst->redis_stat == REDIS_STAT_LOADING)
+                log_info("Redis: dataset loaded in %"PRIu64" sec. instance:%s", (p->recv_time - inst->redis_loading_time) / 1000000, inst->name->data);
+
+            log_info("Redis: ready in %"PRIu64" msec. instance:%s", (p->recv_time - inst->redis_exec_time) / 1000, inst->name->data);
+            timer_add(zoodis.tw, &inst->check_timer, redis_ping_delay(zoodis.redis_ping_interval));
+        }
+
+        // success
+        inst->redis_fail_count = 0;
+        inst->redis_stat = REDIS_STAT_OK;
+        instance_nodedata(&zoodis, inst);
+        zu_ephemeral_update(&zoodis, inst);
+        if(inst->redis_replicaof_pending && !probe_in_flight(&inst->redis_probe))
+            redis_replicaof_send(inst);
+        return;
+    }else if(res != PROBE_RES_OK)
+    {
+        if(inst->redis_stat == REDIS_STAT_EXECUTED)
+        {
+            log_debug("Redis: not ready, %s. instance:%s", probe_res_str(res), inst->name->data);
+        }else
+        {
+            log_warn("Redis: test failed, %s. instance:%s", probe_res_str(res), inst->name->data);
+        }
+    }
+
+    if(inst->redis_info.loading || inst->redis_stat == REDIS_STAT_LOADING)
+    {
+        redis_loading(inst);
+        return;
+    }
+
+    if(redis_not_ready(inst))
+        return;
+
+    // failed
+    inst->redis_probe_failed++;
+    inst->redis_fail_count++;
+    if(redis_failure_detected(inst))
+    {
+        inst->redis_fail_count = 0;
+        inst->redis_stat = REDIS_STAT_ABNORMAL;
+        if(!redis_takeover(inst))
+            redis_stop(inst, 1);
+    }
+}
+
+// The proxy of INST forwards to it, to the standby that took over as
+// well, or with --zoo-election to the master it is elected or follows.
+// Paused while INST is not OK, other instances hold other datasets.
+static void redis_proxy_follow(struct zoodis *z, struct instance *inst)
+{
+    struct sockaddr_storage addr;
+    socklen_t addr_len = 0;
+    char host[sizeof(inst->redis_master)];
+    int port;
+
+    proxy_reap(&inst->proxy);
+
+    if(inst->redis_stat != REDIS_STAT_OK)
+    {
+        // no target, the listener is paused
+    }else if(!z->zoo_election || inst->zoo_role == ZU_ROLE_MASTER)
+    {
+        memcpy(&addr, &inst->redis_addr, inst->redis_addr_len);
+        addr_len = inst->redis_addr_len;
+    }else if(inst->zoo_role == ZU_ROLE_REPLICA && sscanf(inst->redis_master, "%127s %d", host, &port) == 2)
+    {
+        if(proxy_addr(host, port, &addr, &addr_len) < 0)
+            addr_len = 0;
+    }
+
+    proxy_target(&inst->proxy, addr_len != 0 ? (struct sockaddr*)&addr : NULL, addr_len);
+}
+
+// Single main loop for every instance. Probes, restarts and retries of
+// all the instances are timers of zoodis.tw, fired by the event loop.
+// The proxies follow what they changed.
+void redis_health()
+{
+    int i;
+
+    while(1)
+    {
+        event_poll(zoodis.el, -1);
+        for(i = 0; i < zoodis.instance_count; i++)
+        {
+            if(zoodis.instances[i]->proxy_listen != NULL)
+                redis_proxy_follow(&zoodis, zoodis.instances[i]);
+        }
+    }
+}
+
+void exit_proc(int code)
+{
+    // ephemeral nodes go with the session, ops still in flight are moot.
+    // With --zoo-session-file the session is left to the next zoodis.
+    if(zoodis.zh != NULL)
+    {
+        if(zoodis.zoo_session_file != NULL)
+            zu_drain(&zoodis, zoodis.zoo_timeout);
+        else
+            zookeeper_close(zoodis.zh);
+    }
+
     if(code == 0)
     {
         log_msg("Bye.");
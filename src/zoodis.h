@@ -3,41 +3,114 @@
 
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <signal.h>
+#include <sys/un.h>
 #include <arpa/inet.h>
 #include <zookeeper/zookeeper.h>
 
 #include "logging.h"
 #include "mstr.h"
-//#include "zookeeper_util.h"
+#include "utime.h"
+#include "event.h"
+#include "timer.h"
+#include "probe.h"
+#include "info.h"
+#include "hist.h"
+#include "phi.h"
+#include "conf.h"
+#include "prewarm.h"
+#include "mpack.h"
+#include "proxy.h"
+#include "zookeeper_util.h"
 
-#define DEFAULT_KEEPALIVE_INTERVAL      1
+#define DEFAULT_KEEPALIVE_INTERVAL      1000 // msec
 #define DEFAULT_ZOO_NODEDATA            "1"
+#define ZOO_NODEDATA_MAX                128 // and stats, within ZU_DATA_MAX
 #define DEFAULT_ZOO_TIMEOUT             5000 // msec
-#define DEFAULT_ZOO_CONNECT_WAIT_INTERVAL   5 // sec
+#define DEFAULT_ZOO_CONNECT_WAIT_INTERVAL   5000 // msec
+#define DEFAULT_ZOO_BATCH_WINDOW        10   // msec
 #define DEFAULT_REDIS_PORT              6379
 #define DEFAULT_REDIS_IP                "127.0.0.1"
-#define DEFAULT_REDIS_PING_INTERVAL     5   // sec
-#define DEFAULT_REDIS_PING              "PING\r\n"
+#define DEFAULT_REDIS_PING_INTERVAL     5000 // msec
+#define DEFAULT_REDIS_PING_JITTER       10  // percent of interval
+#define DEFAULT_REDIS_PROBE             "ping"
 #define DEFAULT_REDIS_PONG              "+PONG\r\n"
-#define DEFAULT_REDIS_PONG_TIMEOUT_SEC  1
-#define DEFAULT_REDIS_PONG_TIMEOUT_USEC 0
+#define REDIS_PROBE_MAX                 16
+#define DEFAULT_REDIS_LOADING_STALL     60000 // msec
+#define DEFAULT_LATENCY_WINDOW          60  // sec
+#define DEFAULT_REDIS_CONNECT_TIMEOUT   1000 // msec
+#define DEFAULT_REDIS_WRITE_TIMEOUT     1000 // msec
+#define DEFAULT_REDIS_PONG_TIMEOUT      1000 // msec
 #define DEFAULT_REDIS_MAX_FAIL_COUNT    2
+#define DEFAULT_PHI_THRESHOLD           8.0
+#define DEFAULT_PHI_MIN_STD             50  // msec
+#define DEFAULT_REDIS_SHUTDOWN          ""  // SHUTDOWN saves as save points of redis.conf
+#define DEFAULT_REDIS_STOP_TIMEOUT      10000 // msec
 
-#define DEFAULT_REDIS_SLEEP_AFTER_EXEC  5
+// crash loop, restarts back off from --keepalive-interval
+#define DEFAULT_RESTART_BACKOFF_MAX     60000 // msec
+#define DEFAULT_RESTART_BUDGET          10    // restarts in the window
+#define DEFAULT_RESTART_BUDGET_WINDOW   600000 // msec
+#define DEFAULT_RESTART_QUARANTINE      600000 // msec
+#define RESTART_BUDGET_MAX              64
 
-#define ZU_RETURN_PRINT(x)      zu_return_print(__FILE__, __LINE__, x)
+// readiness phase after exec, probed with exponential backoff
+#define DEFAULT_REDIS_READY_TIMEOUT     5000 // msec
+#define REDIS_READY_BACKOFF_MIN         5    // msec
+#define REDIS_READY_BACKOFF_MAX         500  // msec
 
-enum zoo_stat
+// --zoo-nodedata-format=msgpack, written again once a stat moves by more
+#define DEFAULT_NODEDATA_THRESHOLD      10  // percent
+#define NODEDATA_VERSION                1
+#define NODEDATA_MSGPACK_MAX            384 // besides --zoo-nodedata
+// and by more than these, whatever the threshold
+#define NODEDATA_MIN_MEMORY             (1024*1024)
+#define NODEDATA_MIN_CLIENTS            10
+#define NODEDATA_MIN_OPS                100
+#define NODEDATA_MIN_OFFSET             (1024*1024)
+#define NODEDATA_MIN_P99                1000 // usec
+
+#define INSTANCE_SPEC_MAX               4096
+#define REDIS_EXEC_ARGS_MAX             24
+
+// judges a redis-server failed, --failure-detector
+enum failure_detector
+{
+    FAILURE_DETECTOR_COUNT,
+    FAILURE_DETECTOR_PHI,
+};
+
+// data of the zookeeper node, --zoo-nodedata-format
+enum nodedata_format
 {
-    ZOO_STAT_NOT_CONNECTED,
-    ZOO_STAT_CONNECTIONG,
-    ZOO_STAT_CONNECTED,
+    NODEDATA_TEXT,
+    NODEDATA_MSGPACK,
 };
 
-enum zoo_res
+// Stats of the msgpack node data as last built.
+struct nodedata_stats
 {
-    ZOO_RES_OK,
-    ZOO_RES_ERROR,
+    char role[INFO_ROLE_SIZE];
+    char addr[128];
+    int loading;
+    int64_t used_memory;
+    int64_t connected_clients;
+    int64_t ops_per_sec;
+    int64_t repl_offset;
+    int64_t p99;            // usec
+    int64_t loading_perc;   // percent
+};
+
+// commands of a pipelined probe
+enum redis_cmd
+{
+    REDIS_CMD_PING,
+    REDIS_CMD_INFO,
+    REDIS_CMD_ROLE,
+    REDIS_CMD_AUTH,
+    REDIS_CMD_SHUTDOWN,
+    REDIS_CMD_REPLICAOF,
+    REDIS_CMD_CONFIG,
 };
 
 enum redis_stat
@@ -49,49 +122,272 @@ enum redis_stat
     // after fork process
     REDIS_STAT_EXECUTED,
 
+    // PING is answered by -LOADING, dataset is being loaded
+    REDIS_STAT_LOADING,
+
     // after received OK to check ping with redis-server
     REDIS_STAT_OK,
 
     // when failed ping check
     REDIS_STAT_ABNORMAL,
 
-    // after send kill signal to redis-server
+    // after SHUTDOWN or a kill signal is sent, until the child is reaped
     REDIS_STAT_KILLING,
+
+    // restart budget is exhausted, not restarted until the quarantine ends
+    REDIS_STAT_QUARANTINED,
 };
 
-struct zoodis
+// Pipelined commands of a probe, and what each of them is.
+struct redis_req
 {
-    int log_level;
+    struct mstr *data;
+    enum redis_cmd cmds[REDIS_PROBE_MAX];
+    int count;
 
-    int keepalive;
-    int keepalive_interval;
+    // bytes of the leading AUTH, only sent on a new connection
+    size_t auth_len;
+};
 
-    int redis_sock;
+// One supervised redis-server.
+// Every instance shares the zookeeper handle and the main loop of zoodis.
+struct instance
+{
+    struct mstr *name;
+
+    struct probe redis_probe;
     int redis_port;
     struct mstr *redis_ip;
-    struct sockaddr_in redis_addr;
+    struct mstr *redis_socket;
+    struct sockaddr_storage redis_addr;
+    socklen_t redis_addr_len;
     struct mstr *redis_bin;
     struct mstr *redis_conf;
+    struct redis_config redis_config;
+    struct prewarm redis_prewarm;
     enum redis_stat redis_stat;
     pid_t redis_pid;
     int redis_fail_count;
+    struct redis_info redis_info;
+
+    // round trip time of successful probes, usec
+    struct hist_ring redis_latency;
+    uint64_t redis_probe_failed;
+
+    // arrivals of successful probes, for FAILURE_DETECTOR_PHI
+    struct phi redis_phi;
+
+    // readiness phase, while redis_stat is REDIS_STAT_EXECUTED
+    utime_t redis_exec_time;
+    int redis_ready_backoff;
+
+    // REDIS_STAT_LOADING, progress is loading_loaded_perc of INFO
+    utime_t redis_loading_time;
+    utime_t redis_progress_time;
+    double redis_progress_perc;
+    double redis_loading_rate; // percent per sec
+    int64_t redis_loading_eta; // sec
+
+    // requests of zoodis, led by AUTH when redis.conf has requirepass
+    struct redis_req redis_probe_req;
+    struct redis_req redis_loading_req;
+    struct redis_req redis_shutdown_req;
+
+    // stop sequence, while redis_stat is REDIS_STAT_KILLING.
+    // SHUTDOWN, SIGTERM when refused, SIGKILL at --redis-stop-timeout.
+    utime_t redis_stop_time;
+    utime_t redis_term_time;  // SHUTDOWN accepted or SIGTERM sent
+    utime_t redis_kill_time;  // 0 unless SIGKILL was sent
+    int redis_restart;        // start again once reaped
+
+    // crash loop, restart times in a ring and restarts in a row
+    utime_t redis_restarts[RESTART_BUDGET_MAX];
+    int redis_restart_pos;
+    int redis_crash_count;
+
+    // hot standby, a replica on a second endpoint which takes over when
+    // this fails. The standby itself is an instance with primary set.
+    struct instance *standby;
+    struct instance *primary;
+    int redis_standby_port;
+    int redis_standby_synced;  // master link up as of the last probe
+
+    // REPLICAOF NO ONE and persistence of redis.conf, sent on takeover
+    struct redis_req redis_promote_req;
+    int redis_promoting;
+    utime_t redis_takeover_time;
+
+    // --zoo-election, REPLICAOF of the master elected. redis_master is
+    // what it was sent for, "" until elected or once restarted.
+    struct redis_req redis_replicaof_req;
+    int redis_replicaof_pending;
+    int redis_replicating;
+    char redis_master[128];
+
+    // proxy= of the spec, or --proxy-listen of the only instance. Clients
+    // are forwarded to this instance, see redis_proxy_follow().
+    const char *proxy_listen;
+    struct proxy proxy;
+
+    // request of the probe in flight, and its first command sent
+    const struct redis_req *redis_req;
+    int redis_req_first;
+
+    // scheduled on zoodis.tw
+    struct timer check_timer;
+    struct timer restart_timer;
+    struct timer latency_timer;
+    struct timer zoo_timer;
+    struct timer stop_timer;
+
+    struct mstr *zoo_path;
+    struct mstr *zoo_nodepath;
+    struct mstr *zoo_nodename;
+    struct mstr *zoo_nodedata;
+
+    // data of the node, zoo_nodedata with stats appended
+    struct mstr *zoo_data;
+
+    // zoo_nodepath with ".quarantined", while REDIS_STAT_QUARANTINED
+    struct mstr *zoo_quarantine_path;
+    int zoo_quarantined;
+
+    // an op of zu_ephemeral_update() in flight, and an update meanwhile
+    int zoo_busy;
+    int zoo_dirty;
+
+    // waiting for zoodis.zoo_batch_timer, busy meanwhile
+    int zoo_batched;
+
+    // stats of the msgpack data, compared to --zoo-nodedata-threshold
+    struct nodedata_stats zoo_stats;
+
+    // our node as last seen or written, until a watch or the session
+    // invalidates it. zoo_cache_gen counts the invalidations.
+    enum zu_cache zoo_cache;
+    int zoo_cache_gen;
+    int zoo_cache_version;
+    struct mstr *zoo_cache_data;
+
+    // node of a session resumed by --zoo-session-file, kept while starting
+    int zoo_resumed;
+
+    // --zoo-election, our sequential node of zoo_election_path while
+    // redis_stat is OK. The lowest one is the master, and publishes
+    // zoo_election_addr in zoo_master_path. An op in flight at most.
+    struct mstr *zoo_election_path;
+    struct mstr *zoo_master_path;
+    struct mstr *zoo_election_addr;
+    struct mstr *zoo_candidate;
+    enum zu_role zoo_role;
+    int zoo_elect_busy;
+    int zoo_elect_dirty;
+    int64_t zoo_elect_offset;       // repl offset in the data of zoo_candidate
+    int64_t zoo_claim_zxid;         // mzxid of our claim, 0 until written
+    int64_t zoo_elect_pzxid;        // pzxid of the children last read
+    struct mstr *zoo_survey;        // candidates read before publishing
+    size_t zoo_survey_pos;
+    int zoo_survey_stale;           // a claim older than zoo_elect_pzxid read
+    int zoo_survey_waits;
+    struct mstr *zoo_survey_addrs;  // " host:port " of each one read
+    struct mstr *zoo_leader;        // host:port of the lowest candidate
+    int64_t zoo_leader_offset;      // and the repl offset it claims
+    int zoo_elect_refused;          // REPLICAOF of the lowest refused
+};
+
+struct zoodis
+{
+    int log_level;
+
+    int keepalive;
+    int keepalive_interval;  // msec
+
+    // defaults of instances, set by --redis-* and --zoo-* options
+    // port 0 and ip NULL are taken from redis.conf
+    int redis_port;
+    struct mstr *redis_ip;
+    struct mstr *redis_socket;
+    struct mstr *redis_bin;
+    struct mstr *redis_conf;
     int redis_max_fail_count;
-    int redis_ping_interval;
-    int redis_pong_timeout_sec;
-    int redis_pong_timeout_usec;
+    enum failure_detector failure_detector;
+    double phi_threshold;
+    int redis_ping_interval; // msec
+    int redis_ping_jitter;   // percent
+    int redis_ready_timeout; // msec
+    int redis_prewarm;
+    int redis_prewarm_threads;
+    int redis_connect_timeout;
+    int redis_write_timeout;
+    int redis_pong_timeout;
+
+    // pipelined probe request, PING is always the first command
+    struct redis_req redis_probe_req;
+
+    // probe request while loading, PING and INFO persistence
+    struct redis_req redis_loading_req;
+
+    // SHUTDOWN [NOSAVE|SAVE] of the stop sequence, --redis-shutdown
+    struct redis_req redis_shutdown_req;
+    int redis_stop_timeout; // msec
+
+    // crash loop, --restart-backoff-max, --restart-budget, --restart-quarantine
+    int restart_backoff_max;   // msec
+    int restart_budget;        // 0 for no limit
+    int restart_budget_window; // msec
+    int restart_quarantine;    // msec
+
+    // --redis-standby-port, probe and shutdown of standbys
+    int redis_standby_port;
+    struct redis_req redis_standby_req;
+    struct redis_req redis_standby_shutdown_req;
+
+    // zoodis exits once every redis-server is reaped
+    int stopping;
+    int redis_loading_stall; // msec
+
+    // rolling window of latency histograms, sec
+    int latency_window;
+
+    struct instance **instances;
+    int instance_count;
+
+    struct event_loop *el;
+    struct timer_wheel *tw;
+    struct event sig_ev;
 
     int zookeeper;
     int zoo_timeout;
-    int zoo_connect_wait_interval;
+    int zoo_connect_wait_interval; // msec
     enum zoo_stat zoo_stat;
     struct mstr *zoo_host;
     struct mstr *zoo_path;
-    struct mstr *zoo_nodepath;
     struct mstr *zoo_nodename;
     struct mstr *zoo_nodedata;
+    int zoo_nodedata_latency;
+    int zoo_nodedata_loading;
+    enum nodedata_format zoo_nodedata_format;
+    int zoo_nodedata_threshold; // percent
+
+    // instances of a --zoo-path elect their master, see zu_election_update()
+    int zoo_election;
+    struct mstr *redis_announce_ip;
+
+    // --proxy-listen, of the only instance
+    const char *proxy_listen;
+
+    // node updates within the window are sent by one zoo_multi, 0 disables
+    int zoo_batch_window; // msec
+    struct timer zoo_batch_timer;
 
     zhandle_t           *zh;
-    const clientid_t    *zid;
+    clientid_t          zid;    // client_id 0 until connected
+    int                 zoo_handle_gen; // of zh, advanced by zu_reconnect()
+
+    // --zoo-session-file, zid is read from it and resumed
+    const char          *zoo_session_file;
+    int                 zoo_session_loaded;
+    struct zu_queue     zoo_queue;
 
     FILE *pid_fp;
     const char *pid_file;
@@ -101,32 +397,57 @@ struct zoodis
 void print_version(char **argv);
 void print_help(char **argv);
 void set_logging(char *optarg);
-int check_redis_options(struct zoodis *zoodis);
+int check_redis_options(struct instance *inst);
 struct mstr* check_redis_bin(char *optarg);
 struct mstr* check_redis_conf(char *optarg);
+struct mstr* check_redis_socket(char *optarg);
 struct mstr* check_zoo_host(char *optarg);
 struct mstr* check_zoo_path(char *optarg);
 struct mstr* check_zoo_nodename(char *optarg);
 struct mstr* check_zoo_nodedata(char *optarg);
 int check_zoo_options(struct zoodis *zoodis);
 int check_option_int(char *optarg, int def);
+int check_option_msec(char *optarg, int def, int unit);
+int check_redis_probe(struct zoodis *zoodis, const char *optarg);
+int check_redis_shutdown(struct zoodis *zoodis, const char *optarg);
+int check_restart_budget(struct zoodis *zoodis, const char *optarg);
+enum failure_detector check_failure_detector(const char *optarg);
+enum nodedata_format check_nodedata_format(const char *optarg);
+
+struct instance* instance_alloc(struct zoodis *z);
+struct instance* instance_add(struct zoodis *z, struct instance *inst);
+void instance_endpoint(struct instance *inst);
+struct instance* instance_standby(struct instance *inst);
+void instance_init(struct zoodis *z, struct instance *inst);
+struct instance* instance_parse(struct zoodis *z, char *spec);
+int instance_load_file(struct zoodis *z, const char *path);
+struct instance* instance_find_pid(struct zoodis *z, pid_t pid);
+void instance_nodedata(struct zoodis *z, struct instance *inst);
 
-void zu_con_watcher(zhandle_t *zh, int type, int state, const char *path, void *data);
-void zu_set_log_stream(FILE *fd);
-void zu_set_log_level(int level);
-void zu_return_print(const char *f, int l, int ret);
-enum zoo_res zu_connect(struct zoodis *z);
-enum zoo_res zu_create_ephemeral(struct zoodis *z);
-enum zoo_res zu_remove_ephemeral(struct zoodis *z);
+void redis_latency_tick(struct instance *inst, utime_t now);
+void redis_latency_report(struct instance *inst);
 
-void exec_redis();
+void redis_start(struct instance *inst);
+void exec_redis(struct instance *inst);
+void redis_stop(struct instance *inst, int restart);
+int redis_takeover(struct instance *inst);
+void redis_replicaof(struct instance *inst, const char *host, int port);
+void redis_restart(struct instance *inst, int delay);
+void redis_health_check(struct instance *inst);
+void redis_probe_done(struct probe *p, enum probe_res res);
+int redis_failure_detected(struct instance *inst);
+int redis_not_ready(struct instance *inst);
+int redis_probing(struct instance *inst);
+void redis_loading(struct instance *inst);
+int redis_ping_delay(int msec);
+void signal_block(int how);
+int signal_init(struct zoodis *z);
 void signal_sigchld(int sig);
 void signal_sigint(int sig);
 void redis_health();
 
 const char* check_pid_file(const char *pid_file);
 void exit_proc(int code);
-enum zoo_res zu_ephemeral_update();
 
 #endif // _ZOODIS_H_
 
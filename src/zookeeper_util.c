@@ -0,0 +1,1897 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <limits.h>
+#include <inttypes.h>
+#include <sys/eventfd.h>
+
+#include "zoodis.h"
+#include "nalloc.h"
+
+static void zu_queue_event(struct event_loop *el, struct event *ev, uint32_t mask);
+static void zu_node_watcher(zhandle_t *zh, int type, int state, const char *path, void *data);
+static void zu_cache_invalidate(struct instance *inst);
+static void zu_node_done(struct zoodis *z, struct instance *inst, int rc);
+static void zu_get_done(struct zu_op *op);
+static void zu_set_done(struct zu_op *op);
+static void zu_replace_done(struct zu_op *op);
+static void zu_create_done(struct zu_op *op);
+static void zu_watch_done(struct zu_op *op);
+static void zu_remove_done(struct zu_op *op);
+static void zu_quarantine_done(struct zu_op *op);
+static void zu_batch_timer(struct timer_wheel *tw, struct timer *t);
+static void zu_batch_flush(struct zoodis *z);
+static void zu_batch_done(struct zu_op *bop);
+static void zu_election_watcher(zhandle_t *zh, int type, int state, const char *path, void *data);
+static void zu_election_reset(struct instance *inst);
+static void zu_candidate_done(struct zu_op *op);
+static void zu_publish_done(struct zu_op *op);
+static void zu_leader_done(struct zu_op *op);
+static void zu_withdraw_done(struct zu_op *op);
+static void zu_unpublish_done(struct zu_op *op);
+static void zu_children_done(struct zu_op *op);
+static void zu_survey_next(struct zoodis *z, struct instance *inst);
+static void zu_survey_done(struct zu_op *op);
+static void zu_claim_done(struct zu_op *op);
+static void zu_defer_done(struct zu_op *op);
+static void zu_refresh_done(struct zu_op *op);
+static void zu_master_done(struct zu_op *op);
+static void zu_master_wait_done(struct zu_op *op);
+static void zu_holder_done(struct zu_op *op);
+
+// what zu_ephemeral_update() does next for an instance
+enum zu_step
+{
+    ZU_STEP_NONE,
+    ZU_STEP_GET,
+    ZU_STEP_SET,
+    ZU_STEP_CREATE,
+    ZU_STEP_DELETE,
+};
+
+int zu_queue_init(struct zoodis *z)
+{
+    struct zu_queue *q = &z->zoo_queue;
+
+    // ops are allocated by the zookeeper thread as well.
+    nalloc_thread_safe(1);
+
+    pthread_mutex_init(&q->lock, NULL);
+    q->head = NULL;
+    q->tail = &q->head;
+
+    timer_init(&z->zoo_batch_timer, zu_batch_timer, z);
+
+    event_init(&q->ev, eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC), zu_queue_event, z);
+    if(q->ev.fd < 0 || event_add(z->el, &q->ev, EVENT_READ) < 0)
+    {
+        log_err("Zookeeper: cannot create eventfd. %s", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+// The threads of a handle start after zoo_handle_gen is advanced, and
+// are joined by zookeeper_close() before, so they read it as of theirs.
+static struct zu_op* zu_op_alloc(struct zoodis *z, struct instance *inst, zu_op_proc proc)
+{
+    struct zu_op *op = ncalloc(sizeof(struct zu_op));
+
+    op->proc = proc;
+    op->z = z;
+    op->inst = inst;
+    op->handle_gen = z->zoo_handle_gen;
+    return op;
+}
+
+// an op issued by the main loop, against the cache as it is now.
+static struct zu_op* zu_op_issue(struct zoodis *z, struct instance *inst, zu_op_proc proc)
+{
+    struct zu_op *op = zu_op_alloc(z, inst, proc);
+
+    op->gen = inst->zoo_cache_gen;
+    return op;
+}
+
+static void zu_batch_free(struct zu_batch *batch)
+{
+    nalloc_free(batch->ops);
+    nalloc_free(batch->multi);
+    nalloc_free(batch->results);
+    nalloc_free(batch);
+}
+
+static void zu_op_free(struct zu_op *op)
+{
+    if(op->batch != NULL)
+        zu_batch_free(op->batch);
+    if(op->children != NULL)
+        mstr_free_dup(op->children);
+    nalloc_free(op);
+}
+
+// Called on the zookeeper thread.
+static void zu_queue_push(struct zu_op *op)
+{
+    struct zu_queue *q = &op->z->zoo_queue;
+    uint64_t one = 1;
+
+    pthread_mutex_lock(&q->lock);
+    *q->tail = op;
+    q->tail = &op->next;
+    pthread_mutex_unlock(&q->lock);
+
+    if(write(q->ev.fd, &one, sizeof(one)) < 0)
+        log_err("Zookeeper: cannot notify main loop. %s", strerror(errno));
+}
+
+static struct zu_op* zu_queue_take(struct zu_queue *q)
+{
+    struct zu_op *op;
+
+    pthread_mutex_lock(&q->lock);
+    op = q->head;
+    q->head = NULL;
+    q->tail = &q->head;
+    pthread_mutex_unlock(&q->lock);
+
+    return op;
+}
+
+static void zu_queue_event(struct event_loop *el, struct event *ev, uint32_t mask)
+{
+    struct zoodis *z = (struct zoodis*) ev->data;
+    struct zu_op *op, *next;
+    uint64_t value;
+
+    if(read(ev->fd, &value, sizeof(value)) < 0)
+        return;
+
+    // a proc may reconnect, the results of the old handle taken along are
+    // dropped then, as zu_reconnect() drops those still queued.
+    for(op = zu_queue_take(&z->zoo_queue); op != NULL; op = next)
+    {
+        next = op->next;
+        if(op->handle_gen == z->zoo_handle_gen)
+            op->proc(op);
+        zu_op_free(op);
+    }
+}
+
+// completions of zookeeper_mt, results are copied into the op.
+static void zu_void_completion(int rc, const void *data)
+{
+    struct zu_op *op = (struct zu_op*) data;
+
+    op->rc = rc;
+    zu_queue_push(op);
+}
+
+static void zu_stat_completion(int rc, const struct Stat *stat, const void *data)
+{
+    struct zu_op *op = (struct zu_op*) data;
+
+    op->rc = rc;
+    if(rc == ZOK && stat != NULL)
+        op->stat = *stat;
+    zu_queue_push(op);
+}
+
+static void zu_data_completion(int rc, const char *value, int value_len, const struct Stat *stat, const void *data)
+{
+    struct zu_op *op = (struct zu_op*) data;
+
+    op->rc = rc;
+    if(rc == ZOK)
+    {
+        if(stat != NULL)
+            op->stat = *stat;
+
+        // cut at ZU_DATA_MAX, it differs from ours anyway then.
+        op->data_len = value_len < ZU_DATA_MAX ? value_len : ZU_DATA_MAX;
+        if(value != NULL && op->data_len > 0)
+            memcpy(op->data, value, op->data_len);
+        else
+            op->data_len = 0;
+    }
+    zu_queue_push(op);
+}
+
+static void zu_string_completion(int rc, const char *value, const void *data)
+{
+    zu_void_completion(rc, data);
+}
+
+// the path created, with the sequence of ZOO_SEQUENCE appended.
+static void zu_path_completion(int rc, const char *value, const void *data)
+{
+    struct zu_op *op = (struct zu_op*) data;
+
+    op->rc = rc;
+    if(rc == ZOK && value != NULL)
+    {
+        snprintf(op->data, ZU_DATA_MAX, "%s", value);
+        op->data_len = strlen(op->data);
+    }
+    zu_queue_push(op);
+}
+
+// ZOO_SEQUENCE appends 10 digits, compared as strings.
+static const char* zu_sequence(const char *name)
+{
+    size_t len = strlen(name);
+
+    return len >= 10 ? name + len - 10 : NULL;
+}
+
+// the child of the lowest sequence, none when op->data_len is 0,
+// and all of them in op->children. op->stat is of the parent.
+static void zu_children_completion(int rc, const struct String_vector *strings, const struct Stat *stat, const void *data)
+{
+    struct zu_op *op = (struct zu_op*) data;
+    const char *min = NULL;
+    size_t len = 0;
+    char *buf;
+    int i;
+
+    op->rc = rc;
+    if(rc == ZOK && stat != NULL)
+        op->stat = *stat;
+    if(rc == ZOK && strings != NULL)
+    {
+        for(i = 0; i < strings->count; i++)
+        {
+            if(zu_sequence(strings->data[i]) == NULL)
+                continue;
+            if(min == NULL || strcmp(zu_sequence(strings->data[i]), zu_sequence(min)) < 0)
+                min = strings->data[i];
+            len += strlen(strings->data[i]) + 1;
+        }
+
+        if(min != NULL)
+        {
+            snprintf(op->data, ZU_DATA_MAX, "%s", min);
+            op->data_len = strlen(op->data);
+
+            buf = nalloc(len);
+            op->children = mstr_alloc(buf, len);
+            for(i = 0; i < strings->count; i++)
+            {
+                if(zu_sequence(strings->data[i]) == NULL)
+                    continue;
+                strcpy(buf, strings->data[i]);
+                buf += strlen(buf) + 1;
+            }
+        }
+    }
+    zu_queue_push(op);
+}
+
+// --zoo-session-file, "<client id> <password>" in hex. A restarted zoodis
+// resumes the session within --zoo-timeout, with the nodes it holds.
+void zu_session_load(struct zoodis *z)
+{
+    char passwd[sizeof(z->zid.passwd) * 2 + 1];
+    unsigned int byte;
+    uint64_t id;
+    FILE *fp;
+    int i;
+
+    if(z->zoo_session_file == NULL)
+        return;
+
+    fp = fopen(z->zoo_session_file, "r");
+    if(fp == NULL)
+    {
+        if(errno != ENOENT)
+            log_warn("Zookeeper: cannot read session file %s. %s", z->zoo_session_file, strerror(errno));
+        return;
+    }
+
+    if(fscanf(fp, "%"SCNx64" %32s", &id, passwd) != 2 || strlen(passwd) != sizeof(passwd) - 1)
+    {
+        log_warn("Zookeeper: invalid session file %s, a new session is created.", z->zoo_session_file);
+        fclose(fp);
+        return;
+    }
+    fclose(fp);
+
+    for(i = 0; i < (int)sizeof(z->zid.passwd); i++)
+    {
+        if(sscanf(passwd + i * 2, "%2x", &byte) != 1)
+        {
+            log_warn("Zookeeper: invalid session file %s, a new session is created.", z->zoo_session_file);
+            return;
+        }
+        z->zid.passwd[i] = (char)byte;
+    }
+
+    z->zid.client_id = (int64_t)id;
+    z->zoo_session_loaded = 1;
+    log_info("Zookeeper: resuming session 0x%"PRIx64" of %s", id, z->zoo_session_file);
+}
+
+// written to a temporary file and renamed, the password is kept 0600.
+static void zu_session_save(struct zoodis *z)
+{
+    char tmp[PATH_MAX];
+    FILE *fp;
+    int fd, i;
+
+    if(z->zoo_session_file == NULL)
+        return;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", z->zoo_session_file);
+    fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0600);
+    if(fd < 0 || (fp = fdopen(fd, "w")) == NULL)
+    {
+        log_err("Zookeeper: cannot write session file %s. %s", tmp, strerror(errno));
+        if(fd >= 0)
+            close(fd);
+        return;
+    }
+
+    fprintf(fp, "%"PRIx64" ", (uint64_t)z->zid.client_id);
+    for(i = 0; i < (int)sizeof(z->zid.passwd); i++)
+        fprintf(fp, "%02x", (unsigned char)z->zid.passwd[i]);
+    fprintf(fp, "\n");
+
+    if(fclose(fp) != 0 || rename(tmp, z->zoo_session_file) < 0)
+        log_err("Zookeeper: cannot write session file %s. %s", z->zoo_session_file, strerror(errno));
+}
+
+static void zu_election_reset(struct instance *inst)
+{
+    if(inst->zoo_candidate != NULL)
+        mstr_free_dup(inst->zoo_candidate);
+    inst->zoo_candidate = NULL;
+    if(inst->zoo_survey != NULL)
+        mstr_free_dup(inst->zoo_survey);
+    inst->zoo_survey = NULL;
+    inst->zoo_survey_waits = 0;
+    if(inst->zoo_survey_addrs != NULL)
+        mstr_free_dup(inst->zoo_survey_addrs);
+    inst->zoo_survey_addrs = NULL;
+    if(inst->zoo_leader != NULL)
+        mstr_free_dup(inst->zoo_leader);
+    inst->zoo_leader = NULL;
+    inst->zoo_claim_zxid = 0;
+    inst->zoo_role = ZU_ROLE_NONE;
+    inst->zoo_elect_dirty = 0;
+}
+
+static void zu_session_connected(struct zoodis *z)
+{
+    const clientid_t *id = zoo_client_id(z->zh);
+    int resumed = z->zid.client_id != 0 && z->zid.client_id == id->client_id;
+    struct instance *inst;
+    int i;
+
+    log_info("Zookeeper: connected. session:0x%"PRIx64"%s", (uint64_t)id->client_id, resumed ? " resumed" : "");
+    z->zoo_stat = ZOO_STAT_CONNECTED;
+
+    if(!resumed)
+    {
+        z->zid = *id;
+        zu_session_save(z);
+    }
+
+    for(i = 0; i < z->instance_count; i++)
+    {
+        inst = z->instances[i];
+
+        // nodes of the previous zoodis are ours again.
+        if(z->zoo_session_loaded && resumed)
+            inst->zoo_resumed = 1;
+
+        // a candidate is gone with its session, and runs again.
+        if(!resumed)
+            zu_election_reset(inst);
+        inst->zoo_elect_dirty = 1;
+
+        // updates deferred while disconnected. A new session has none of
+        // our nodes, they are created without reading them first, all in
+        // one zoo_multi. A node of someone else fails it, and it is read.
+        zu_cache_invalidate(inst);
+        if(!resumed)
+            inst->zoo_cache = ZU_CACHE_ABSENT;
+        zu_ephemeral_update(z, inst);
+    }
+
+    z->zoo_session_loaded = 0;
+}
+
+static void zu_session_event(struct zu_op *op)
+{
+    struct zoodis *z = op->z;
+
+    log_info("Zookeeper: Connection status changed. type:%d state:%d", op->type, op->state);
+
+    if(op->type != ZOO_SESSION_EVENT)
+        return;
+
+    if(op->state == ZOO_CONNECTED_STATE)
+    {
+        zu_session_connected(z);
+    }else if(op->state == ZOO_CONNECTING_STATE)
+    {
+        z->zoo_stat = ZOO_STAT_CONNECTIONG;
+    }else if(op->state == ZOO_EXPIRED_SESSION_STATE)
+    {
+        // the handle is dead and our ephemeral nodes are gone with the
+        // session, they are registered again with a new one right away.
+        log_warn("Zookeeper: session 0x%"PRIx64" expired, registering nodes again.", (uint64_t)z->zid.client_id);
+        zu_reconnect(z);
+    }else if(op->state == ZOO_AUTH_FAILED_STATE)
+    {
+        log_err("Zookeeper: authentication failed.");
+    }
+}
+
+void zu_con_watcher(zhandle_t *zh, int type, int state, const char *path, void *data)
+{
+    struct zu_op *op = zu_op_alloc((struct zoodis*) data, NULL, zu_session_event);
+
+    op->type = type;
+    op->state = state;
+    zu_queue_push(op);
+}
+
+enum zoo_res zu_connect(struct zoodis *z)
+{
+    const clientid_t *zid = z->zid.client_id != 0 ? &z->zid : NULL;
+    zhandle_t *zh = zookeeper_init(z->zoo_host->data, zu_con_watcher, z->zoo_timeout, zid, z, 0);
+    z->zoo_stat = ZOO_STAT_CONNECTIONG;
+
+    log_info("Zookeeper: Trying to connect to zookeeper %s", z->zoo_host->data);
+
+    if(!zh)
+    {
+        log_err("Zookeeper: Cannot initialize zhandle.");
+        log_err("Zookeeper: -- %s", strerror(errno));
+        z->zoo_stat = ZOO_STAT_NOT_CONNECTED;
+        return ZOO_RES_ERROR;
+    }
+
+    z->zh = zh;
+
+    return ZOO_RES_OK;
+}
+
+// The handle is of no use any more. Results of it still queued are
+// dropped, every node is updated again once the new one is connected.
+void zu_reconnect(struct zoodis *z)
+{
+    struct zu_op *op, *next;
+    struct instance *inst;
+    int i;
+
+    log_warn("Zookeeper: error, trying to re-connect.");
+
+    if(z->zh != NULL)
+        zookeeper_close(z->zh);
+    z->zh = NULL;
+    z->zoo_handle_gen++;
+    memset(&z->zid, 0x00, sizeof(clientid_t));
+    z->zoo_session_loaded = 0;
+    z->zoo_stat = ZOO_STAT_NOT_CONNECTED;
+
+    for(op = zu_queue_take(&z->zoo_queue); op != NULL; op = next)
+    {
+        next = op->next;
+        zu_op_free(op);
+    }
+
+    timer_del(z->tw, &z->zoo_batch_timer);
+
+    for(i = 0; i < z->instance_count; i++)
+    {
+        inst = z->instances[i];
+        inst->zoo_busy = 0;
+        inst->zoo_dirty = 0;
+        inst->zoo_batched = 0;
+        inst->zoo_resumed = 0;
+        inst->zoo_elect_busy = 0;
+        zu_election_reset(inst);
+        zu_cache_invalidate(inst);
+    }
+
+    zu_connect(z);
+}
+
+static int zu_busy(struct zoodis *z)
+{
+    int i;
+
+    for(i = 0; i < z->instance_count; i++)
+        if(z->instances[i]->zoo_busy)
+            return 1;
+    return 0;
+}
+
+// Ops in flight are completed within MSEC. For exit without closing the
+// session, a removal not sent yet would be kept by the next zoodis.
+void zu_drain(struct zoodis *z, int msec)
+{
+    struct pollfd pfd = { .fd = z->zoo_queue.ev.fd, .events = POLLIN };
+    utime_t end = utime_mono() + (utime_t)msec * 1000;
+    utime_t now;
+
+    // updates waiting for the window are sent right away.
+    if(timer_pending(&z->zoo_batch_timer))
+    {
+        timer_del(z->tw, &z->zoo_batch_timer);
+        zu_batch_flush(z);
+    }
+
+    while(zu_busy(z))
+    {
+        now = utime_mono();
+        if(now >= end)
+        {
+            log_warn("Zookeeper: node updates still in flight at exit.");
+            break;
+        }
+
+        if(poll(&pfd, 1, (int)((end - now) / 1000) + 1) > 0)
+            zu_queue_event(z->el, &z->zoo_queue.ev, EVENT_READ);
+    }
+}
+
+void zu_set_log_stream(FILE *fd)
+{
+    zoo_set_log_stream(fd);
+}
+
+void zu_set_log_level(int level)
+{
+    // the level of logging.h is kept per file.
+    log_level(level);
+
+    switch(level)
+    {
+    case _LOG_DEBUG:
+        zoo_set_debug_level(ZOO_LOG_LEVEL_DEBUG);
+        break;
+    case _LOG_INFO:
+        zoo_set_debug_level(ZOO_LOG_LEVEL_INFO);
+        break;
+    case _LOG_WARN:
+        zoo_set_debug_level(ZOO_LOG_LEVEL_WARN);
+        break;
+    case _LOG_ERR:
+        zoo_set_debug_level(ZOO_LOG_LEVEL_ERROR);
+        break;
+    default:
+        zoo_set_debug_level(ZOO_LOG_LEVEL_INFO);
+        break;
+    }
+}
+
+void zu_return_print(const char *f, int l, int ret)
+{
+    switch(ret)
+    {
+    case ZOK:
+        log_info("%s(%d) Zookeeper: OK.", f, l);
+        break;
+
+    case ZSYSTEMERROR:
+        log_err("%s(%d) Zookeeper: System error.", f, l);
+        break;
+
+    case ZRUNTIMEINCONSISTENCY:
+        log_err("%s(%d) Zookeeper: A runtime inconsistency was found.", f, l);
+        break;
+
+    case ZDATAINCONSISTENCY:
+        log_err("%s(%d) Zookeeper: A data inconsistency was found.", f, l);
+        break;
+
+    case ZCONNECTIONLOSS:
+        log_err("%s(%d) Zookeeper: Connection to the server has been lost.", f, l);
+        break;
+
+    case ZMARSHALLINGERROR:
+        log_err("%s(%d) Zookeeper: Error while marshalling or unmarshalling data.", f, l);
+        break;
+
+    case ZUNIMPLEMENTED:
+        log_err("%s(%d) Zookeeper: Operation is unimplemented.", f, l);
+        break;
+
+    case ZOPERATIONTIMEOUT:
+        log_err("%s(%d) Zookeeper: Operation timeout.", f, l);
+        break;
+
+    case ZBADARGUMENTS:
+        log_err("%s(%d) Zookeeper: Invalid arguments.", f, l);
+        break;
+
+    case ZINVALIDSTATE:
+        log_err("%s(%d) Zookeeper: Invliad zhandle state.", f, l);
+        break;
+
+    case ZAPIERROR:
+        log_err("%s(%d) Zookeeper: API errors.", f, l);
+        break;
+
+    case ZNONODE:
+        log_err("%s(%d) Zookeeper: Node does not exist.", f, l);
+        break;
+
+    case ZNOAUTH:
+        log_err("%s(%d) Zookeeper: Not authenticated.", f, l);
+        break;
+
+    case ZBADVERSION:
+        log_err("%s(%d) Zookeeper: Version conflict.", f, l);
+        break;
+
+    case ZNOCHILDRENFOREPHEMERALS:
+        log_err("%s(%d) Zookeeper: Ephemeral nodes may not have children.", f, l);
+        break;
+
+    case ZNODEEXISTS:
+        log_err("%s(%d) Zookeeper: The node already exists.", f, l);
+        break;
+
+    case ZNOTEMPTY:
+        log_err("%s(%d) Zookeeper: The node has children.", f, l);
+        break;
+
+    case ZSESSIONEXPIRED:
+        log_err("%s(%d) Zookeeper: The session has been expired by the server.", f, l);
+        break;
+
+    case ZINVALIDCALLBACK:
+        log_err("%s(%d) Zookeeper: Invalid callback specified.", f, l);
+        break;
+
+    case ZINVALIDACL:
+        log_err("%s(%d) Zookeeper: Invalid ACL specifie.", f, l);
+        break;
+
+    case ZAUTHFAILED:
+        log_err("%s(%d) Zookeeper: Client authentication faile.", f, l);
+        break;
+
+    case ZCLOSING:
+        log_err("%s(%d) Zookeeper: ZooKeeper is closin.", f, l);
+        break;
+
+    case ZNOTHING:
+        log_err("%s(%d) Zookeeper: (not error) no server responses to process.", f, l);
+        break;
+
+    case ZSESSIONMOVED:
+        log_err("%s(%d) Zookeeper: Session moved to another server, so operation is ignored.", f, l);
+        break;
+
+    default:
+        log_err("%s(%d) Zookeeper: Unknown error(%d)", f, l, ret);
+    }
+}
+
+// Calls issuing an op for INST. On an error the completion is never
+// called, the op is freed and the error returned.
+static int zu_awget(struct zoodis *z, struct instance *inst, zu_op_proc proc)
+{
+    struct zu_op *op = zu_op_issue(z, inst, proc);
+    int rc;
+
+    rc = zoo_awget(z->zh, inst->zoo_nodepath->data, zu_node_watcher, inst, zu_data_completion, op);
+    if(rc != ZOK)
+        nalloc_free(op);
+    return rc;
+}
+
+static int zu_awexists(struct zoodis *z, struct instance *inst, zu_op_proc proc)
+{
+    struct zu_op *op = zu_op_issue(z, inst, proc);
+    int rc;
+
+    rc = zoo_awexists(z->zh, inst->zoo_nodepath->data, zu_node_watcher, inst, zu_stat_completion, op);
+    if(rc != ZOK)
+        nalloc_free(op);
+    return rc;
+}
+
+// data written is kept in the op, it is what the cache holds then.
+static int zu_aset(struct zoodis *z, struct instance *inst, int version, zu_op_proc proc)
+{
+    struct zu_op *op = zu_op_issue(z, inst, proc);
+    int rc;
+
+    op->data_len = inst->zoo_data->len;
+    memcpy(op->data, inst->zoo_data->data, op->data_len);
+
+    rc = zoo_aset(z->zh, inst->zoo_nodepath->data, op->data, op->data_len, version, zu_stat_completion, op);
+    if(rc != ZOK)
+        nalloc_free(op);
+    return rc;
+}
+
+static int zu_acreate(struct zoodis *z, struct instance *inst, const char *path, const char *data, int len, int flags, zu_op_proc proc)
+{
+    struct zu_op *op = zu_op_issue(z, inst, proc);
+    int rc;
+
+    op->data_len = len;
+    memcpy(op->data, data, len);
+
+    rc = zoo_acreate(z->zh, path, op->data, op->data_len, &ZOO_READ_ACL_UNSAFE, flags,
+            (flags & ZOO_SEQUENCE) ? zu_path_completion : zu_string_completion, op);
+    if(rc != ZOK)
+        nalloc_free(op);
+    return rc;
+}
+
+static int zu_aget(struct zoodis *z, struct instance *inst, const char *path, zu_op_proc proc)
+{
+    struct zu_op *op = zu_op_issue(z, inst, proc);
+    int rc;
+
+    rc = zoo_aget(z->zh, path, 0, zu_data_completion, op);
+    if(rc != ZOK)
+        nalloc_free(op);
+    return rc;
+}
+
+static int zu_awget_children(struct zoodis *z, struct instance *inst, const char *path, zu_op_proc proc)
+{
+    struct zu_op *op = zu_op_issue(z, inst, proc);
+    int rc;
+
+    rc = zoo_awget_children2(z->zh, path, zu_election_watcher, inst, zu_children_completion, op);
+    if(rc != ZOK)
+        nalloc_free(op);
+    return rc;
+}
+
+// watched by zu_election_watcher, the read of zoo_master_path leaves a
+// watch only if it exists, zu_awexists_master if not.
+static int zu_awget_master(struct zoodis *z, struct instance *inst, zu_op_proc proc)
+{
+    struct zu_op *op = zu_op_issue(z, inst, proc);
+    int rc;
+
+    rc = zoo_awget(z->zh, inst->zoo_master_path->data, zu_election_watcher, inst, zu_data_completion, op);
+    if(rc != ZOK)
+        nalloc_free(op);
+    return rc;
+}
+
+static int zu_awexists_master(struct zoodis *z, struct instance *inst, zu_op_proc proc)
+{
+    struct zu_op *op = zu_op_issue(z, inst, proc);
+    int rc;
+
+    rc = zoo_awexists(z->zh, inst->zoo_master_path->data, zu_election_watcher, inst, zu_stat_completion, op);
+    if(rc != ZOK)
+        nalloc_free(op);
+    return rc;
+}
+
+static int zu_aset_path(struct zoodis *z, struct instance *inst, const char *path, const char *data, int len, zu_op_proc proc)
+{
+    struct zu_op *op = zu_op_issue(z, inst, proc);
+    int rc;
+
+    op->data_len = len;
+    memcpy(op->data, data, len);
+
+    rc = zoo_aset(z->zh, path, op->data, op->data_len, -1, zu_stat_completion, op);
+    if(rc != ZOK)
+        nalloc_free(op);
+    return rc;
+}
+
+static int zu_adelete(struct zoodis *z, struct instance *inst, const char *path, int version, zu_op_proc proc)
+{
+    struct zu_op *op = zu_op_issue(z, inst, proc);
+    int rc;
+
+    rc = zoo_adelete(z->zh, path, version, zu_void_completion, op);
+    if(rc != ZOK)
+        nalloc_free(op);
+    return rc;
+}
+
+static int zu_node_wanted(struct zoodis *z, struct instance *inst)
+{
+    return inst->redis_stat == REDIS_STAT_OK ||
+        (inst->redis_stat == REDIS_STAT_LOADING && z->zoo_nodedata_loading);
+}
+
+// A node left by a session resumed from --zoo-session-file is kept while
+// the instance starts, clients watching it see no delete and create.
+// Until it is wanted, or the first start fails.
+static int zu_node_kept(struct instance *inst)
+{
+    if(inst->zoo_resumed && inst->redis_crash_count == 0 &&
+            (inst->redis_stat == REDIS_STAT_NONE ||
+             inst->redis_stat == REDIS_STAT_EXECUTED ||
+             inst->redis_stat == REDIS_STAT_LOADING))
+        return 1;
+
+    inst->zoo_resumed = 0;
+    return 0;
+}
+
+// Cached view of the node. A result fills it in only if nothing
+// invalidated it since the op was issued, a watch firing meanwhile wins.
+static void zu_cache_invalidate(struct instance *inst)
+{
+    inst->zoo_cache = ZU_CACHE_UNKNOWN;
+    inst->zoo_cache_gen++;
+}
+
+static void zu_cache_set(struct instance *inst, struct zu_op *op, enum zu_cache cache)
+{
+    if(op->gen != inst->zoo_cache_gen)
+        return;
+
+    inst->zoo_cache = cache;
+    if(cache != ZU_CACHE_PRESENT)
+        return;
+
+    if(inst->zoo_cache_data != NULL)
+        mstr_free_dup(inst->zoo_cache_data);
+    inst->zoo_cache_data = mstr_alloc_dup(op->data, op->data_len);
+    inst->zoo_cache_version = op->stat.version;
+}
+
+static int zu_cache_fresh(struct instance *inst)
+{
+    // binary with --zoo-nodedata-format=msgpack, mstr_cmp() stops at a NUL.
+    return inst->zoo_cache == ZU_CACHE_PRESENT && inst->zoo_cache_data->len == inst->zoo_data->len &&
+        memcmp(inst->zoo_cache_data->data, inst->zoo_data->data, inst->zoo_data->len) == 0;
+}
+
+// Our node was changed or deleted, or the watch is gone with the session.
+static void zu_node_event(struct zu_op *op)
+{
+    struct instance *inst = op->inst;
+
+    log_debug("Zookeeper: node event. type:%d state:%d instance:%s", op->type, op->state, inst->name->data);
+
+    if(op->type == ZOO_SESSION_EVENT && op->state != ZOO_EXPIRED_SESSION_STATE)
+        return;
+
+    zu_cache_invalidate(inst);
+    zu_ephemeral_update(op->z, inst);
+}
+
+static void zu_node_watcher(zhandle_t *zh, int type, int state, const char *path, void *data)
+{
+    struct zu_op *op = zu_op_alloc((struct zoodis*) zoo_get_context(zh), (struct instance*) data, zu_node_event);
+
+    op->type = type;
+    op->state = state;
+    zu_queue_push(op);
+}
+
+// Next step for the node of INST, as far as its cache tells.
+static enum zu_step zu_node_step(struct zoodis *z, struct instance *inst)
+{
+    if(zu_node_wanted(z, inst))
+    {
+        inst->zoo_resumed = 0;
+        if(zu_cache_fresh(inst))
+            return ZU_STEP_NONE;
+
+        if(inst->zoo_cache == ZU_CACHE_PRESENT)
+            return ZU_STEP_SET;
+        else if(inst->zoo_cache == ZU_CACHE_ABSENT)
+            return ZU_STEP_CREATE;
+        else
+            return ZU_STEP_GET;
+    }
+
+    if(inst->zoo_cache == ZU_CACHE_ABSENT || zu_node_kept(inst))
+        return ZU_STEP_NONE;
+
+    return ZU_STEP_DELETE;
+}
+
+// A step decided by the cache alone may go into a zoo_multi. A delete of
+// a node not known to exist would fail all of it.
+static int zu_step_batched(struct instance *inst, enum zu_step step)
+{
+    return step == ZU_STEP_SET || step == ZU_STEP_CREATE ||
+        (step == ZU_STEP_DELETE && inst->zoo_cache == ZU_CACHE_PRESENT);
+}
+
+static int zu_node_issue(struct zoodis *z, struct instance *inst, enum zu_step step)
+{
+    int rc;
+
+    switch(step)
+    {
+    case ZU_STEP_SET:
+        rc = zu_aset(z, inst, inst->zoo_cache_version, zu_set_done);
+        break;
+
+    case ZU_STEP_CREATE:
+        rc = zu_acreate(z, inst, inst->zoo_nodepath->data, inst->zoo_data->data, inst->zoo_data->len, ZOO_EPHEMERAL, zu_create_done);
+        break;
+
+    case ZU_STEP_GET:
+        rc = zu_awget(z, inst, zu_get_done);
+        break;
+
+    case ZU_STEP_DELETE:
+        rc = zu_adelete(z, inst, inst->zoo_nodepath->data, -1, zu_remove_done);
+        break;
+
+    default:
+        rc = ZOK;
+        zu_node_done(z, inst, rc);
+        return rc;
+    }
+
+    if(rc != ZOK)
+        zu_node_done(z, inst, rc);
+    return rc;
+}
+
+// Brings the node of INST to what redis_stat wants, one asynchronous
+// step after another, so a slow ensemble never holds up the probes.
+// A single op is in flight per instance, an update meanwhile marks it
+// dirty and it runs again once the op completes. The node is only read
+// when its cache is invalidated, a probe finding nothing changed costs
+// no request at all. Writes wait --zoo-batch-window for the others.
+enum zoo_res zu_ephemeral_update(struct zoodis *z, struct instance *inst)
+{
+    enum zu_step step;
+
+    // a standby has no node, its primary has.
+    if(!z->zookeeper || inst->primary != NULL)
+        return ZOO_RES_OK;
+
+    zu_election_update(z, inst);
+
+    if(inst->zoo_busy)
+    {
+        inst->zoo_dirty = 1;
+        return ZOO_RES_OK;
+    }
+
+    if(z->zoo_stat != ZOO_STAT_CONNECTED)
+    {
+        log_err("Zookeeper: not connected yet. STAT:%d", z->zoo_stat);
+        if(z->zh == NULL)
+            zu_connect(z);
+
+        // retry on its own, a down instance has no probe to do it.
+        timer_add(z->tw, &inst->zoo_timer, z->zoo_connect_wait_interval);
+        return ZOO_RES_ERROR;
+    }
+
+    inst->zoo_busy = 1;
+    inst->zoo_dirty = 0;
+
+    step = zu_node_step(z, inst);
+    if(z->zoo_batch_window > 0 && zu_step_batched(inst, step))
+    {
+        inst->zoo_batched = 1;
+        if(!timer_pending(&z->zoo_batch_timer))
+            timer_add(z->tw, &z->zoo_batch_timer, z->zoo_batch_window);
+        return ZOO_RES_OK;
+    }
+
+    return zu_node_issue(z, inst, step) == ZOK ? ZOO_RES_OK : ZOO_RES_ERROR;
+}
+
+static void zu_batch_timer(struct timer_wheel *tw, struct timer *t)
+{
+    zu_batch_flush((struct zoodis*) t->data);
+}
+
+// Sends the updates gathered since the window opened. Steps are decided
+// again, the instances changed meanwhile. A batch of one is issued alone,
+// the watch of a create is set the same way then.
+static void zu_batch_flush(struct zoodis *z)
+{
+    struct zu_batch *batch;
+    struct instance *inst;
+    struct zu_op *bop, *op;
+    enum zu_step step;
+    int i, n, rc;
+
+    for(i = 0, n = 0; i < z->instance_count; i++)
+        n += z->instances[i]->zoo_batched;
+    if(n == 0)
+        return;
+
+    batch = ncalloc(sizeof(struct zu_batch));
+    batch->ops = ncalloc(sizeof(struct zu_op) * n);
+    batch->multi = ncalloc(sizeof(zoo_op_t) * n);
+    batch->results = ncalloc(sizeof(zoo_op_result_t) * n);
+
+    for(i = 0; i < z->instance_count; i++)
+    {
+        inst = z->instances[i];
+        if(!inst->zoo_batched)
+            continue;
+
+        inst->zoo_batched = 0;
+        inst->zoo_dirty = 0;
+
+        step = zu_node_step(z, inst);
+        if(!zu_step_batched(inst, step))
+        {
+            zu_node_issue(z, inst, step);
+            continue;
+        }
+
+        op = &batch->ops[batch->count];
+        op->z = z;
+        op->inst = inst;
+        op->gen = inst->zoo_cache_gen;
+
+        if(step == ZU_STEP_DELETE)
+        {
+            op->proc = zu_remove_done;
+            zoo_delete_op_init(&batch->multi[batch->count], inst->zoo_nodepath->data, -1);
+        }else
+        {
+            op->data_len = inst->zoo_data->len;
+            memcpy(op->data, inst->zoo_data->data, op->data_len);
+
+            if(step == ZU_STEP_SET)
+            {
+                op->proc = zu_set_done;
+                zoo_set_op_init(&batch->multi[batch->count], inst->zoo_nodepath->data, op->data, op->data_len,
+                        inst->zoo_cache_version, &op->stat);
+            }else
+            {
+                op->proc = zu_create_done;
+                zoo_create_op_init(&batch->multi[batch->count], inst->zoo_nodepath->data, op->data, op->data_len,
+                        &ZOO_READ_ACL_UNSAFE, ZOO_EPHEMERAL, NULL, 0);
+            }
+        }
+
+        batch->count++;
+    }
+
+    if(batch->count <= 1)
+    {
+        if(batch->count == 1)
+            zu_node_issue(z, batch->ops[0].inst, zu_node_step(z, batch->ops[0].inst));
+        zu_batch_free(batch);
+        return;
+    }
+
+    log_debug("Zookeeper: %d node updates in one multi.", batch->count);
+
+    bop = zu_op_alloc(z, NULL, zu_batch_done);
+    bop->batch = batch;
+
+    rc = zoo_amulti(z->zh, batch->count, batch->multi, batch->results, zu_void_completion, bop);
+    if(rc != ZOK)
+    {
+        bop->rc = rc;
+        zu_batch_done(bop);
+        zu_op_free(bop);
+    }
+}
+
+// The multi is all or nothing. Done, each instance goes on as if its op
+// completed alone. Failed on a node, say of someone else, none of them
+// is trusted and each one is read and updated alone.
+static void zu_batch_done(struct zu_op *bop)
+{
+    struct zu_batch *batch = bop->batch;
+    struct zoodis *z = bop->z;
+    struct instance *inst;
+    struct zu_op *op;
+    int i;
+
+    if(bop->rc != ZOK)
+    {
+        log_warn("Zookeeper: multi of %d node updates failed, updating them one by one.", batch->count);
+        ZU_RETURN_PRINT(bop->rc);
+    }
+
+    // the handle is gone, all of them are updated again anyway.
+    if(bop->rc == ZINVALIDSTATE)
+    {
+        zu_reconnect(z);
+        return;
+    }
+
+    for(i = 0; i < batch->count; i++)
+    {
+        op = &batch->ops[i];
+        inst = op->inst;
+
+        if(bop->rc == ZOK)
+        {
+            op->rc = ZOK;
+            op->proc(op);
+        }else if(bop->rc == ZNONODE || bop->rc == ZNODEEXISTS || bop->rc == ZBADVERSION ||
+                bop->rc == ZRUNTIMEINCONSISTENCY)
+        {
+            zu_cache_invalidate(inst);
+            zu_node_issue(z, inst, zu_node_step(z, inst));
+        }else
+        {
+            zu_cache_invalidate(inst);
+            inst->zoo_busy = 0;
+            timer_add(z->tw, &inst->zoo_timer, z->zoo_connect_wait_interval);
+        }
+    }
+}
+
+// <node>.quarantined exists while the instance is quarantined, the node
+// itself is removed then.
+static int zu_quarantine_update(struct zoodis *z, struct instance *inst)
+{
+    char data[64];
+    int len;
+
+    if(inst->zoo_quarantine_path == NULL)
+        inst->zoo_quarantine_path = mstr_concat(2, inst->zoo_nodepath->data, ".quarantined");
+
+    if(inst->redis_stat == REDIS_STAT_QUARANTINED)
+    {
+        len = snprintf(data, sizeof(data), "restarts=%d window=%d", z->restart_budget, z->restart_budget_window / 1000);
+        return zu_acreate(z, inst, inst->zoo_quarantine_path->data, data, len, ZOO_EPHEMERAL, zu_quarantine_done);
+    }
+
+    return zu_adelete(z, inst, inst->zoo_quarantine_path->data, -1, zu_quarantine_done);
+}
+
+// The last op of an update completed, or failed to be issued.
+static void zu_node_done(struct zoodis *z, struct instance *inst, int rc)
+{
+    if(rc == ZOK && inst->zoo_quarantined != (inst->redis_stat == REDIS_STAT_QUARANTINED))
+    {
+        rc = zu_quarantine_update(z, inst);
+        if(rc == ZOK)
+            return;
+    }
+
+    inst->zoo_busy = 0;
+
+    if(rc != ZOK)
+    {
+        ZU_RETURN_PRINT(rc);
+        zu_cache_invalidate(inst);
+        if(rc == ZINVALIDSTATE)
+        {
+            zu_reconnect(z);
+            return;
+        }
+
+        timer_add(z->tw, &inst->zoo_timer, z->zoo_connect_wait_interval);
+        return;
+    }
+
+    timer_del(z->tw, &inst->zoo_timer);
+
+    if(inst->zoo_dirty)
+        zu_ephemeral_update(z, inst);
+}
+
+static void zu_get_done(struct zu_op *op)
+{
+    struct zoodis *z = op->z;
+    struct instance *inst = op->inst;
+    int rc = op->rc;
+
+    if(rc == ZOK)
+    {
+        // a node of someone else, it is created again.
+        if(op->stat.ephemeralOwner != zoo_client_id(z->zh)->client_id)
+        {
+            rc = zu_adelete(z, inst, inst->zoo_nodepath->data, -1, zu_replace_done);
+        }else
+        {
+            // the watch is set, the cache holds until it fires.
+            zu_cache_set(inst, op, ZU_CACHE_PRESENT);
+            if(zu_cache_fresh(inst))
+            {
+                zu_node_done(z, inst, ZOK);
+                return;
+            }
+
+            rc = zu_aset(z, inst, op->stat.version, zu_set_done);
+        }
+    }else if(rc == ZNONODE)
+    {
+        rc = zu_acreate(z, inst, inst->zoo_nodepath->data, inst->zoo_data->data, inst->zoo_data->len, ZOO_EPHEMERAL, zu_create_done);
+    }
+
+    if(rc != ZOK)
+        zu_node_done(z, inst, rc);
+}
+
+static void zu_set_done(struct zu_op *op)
+{
+    struct instance *inst = op->inst;
+    int rc = op->rc;
+
+    if(rc == ZOK)
+    {
+        zu_cache_set(inst, op, ZU_CACHE_PRESENT);
+    }else
+    {
+        ZU_RETURN_PRINT(rc);
+        zu_cache_invalidate(inst);
+        rc = zu_adelete(op->z, inst, inst->zoo_nodepath->data, -1, zu_replace_done);
+        if(rc == ZOK)
+            return;
+    }
+
+    zu_node_done(op->z, inst, rc);
+}
+
+// a node of someone else, or one failed to be set, is created again.
+static void zu_replace_done(struct zu_op *op)
+{
+    struct instance *inst = op->inst;
+    int rc = op->rc;
+
+    if(rc == ZOK || rc == ZNONODE)
+    {
+        rc = zu_acreate(op->z, inst, inst->zoo_nodepath->data, inst->zoo_data->data, inst->zoo_data->len, ZOO_EPHEMERAL, zu_create_done);
+        if(rc == ZOK)
+            return;
+    }
+
+    zu_node_done(op->z, inst, rc);
+}
+
+// A created node has no watch yet, zoo_awexists sets it.
+static void zu_create_done(struct zu_op *op)
+{
+    struct instance *inst = op->inst;
+    int rc = op->rc;
+
+    if(rc == ZOK)
+    {
+        zu_cache_set(inst, op, ZU_CACHE_PRESENT);
+        rc = zu_awexists(op->z, inst, zu_watch_done);
+        if(rc == ZOK)
+            return;
+    }
+
+    zu_node_done(op->z, inst, rc);
+}
+
+static void zu_watch_done(struct zu_op *op)
+{
+    struct instance *inst = op->inst;
+
+    if(op->rc == ZOK && op->gen == inst->zoo_cache_gen)
+    {
+        inst->zoo_cache_version = op->stat.version;
+    }else
+    {
+        // gone already, so it is created again.
+        zu_cache_invalidate(inst);
+        inst->zoo_dirty = 1;
+    }
+
+    zu_node_done(op->z, inst, op->rc == ZNONODE ? ZOK : op->rc);
+}
+
+static void zu_remove_done(struct zu_op *op)
+{
+    if(op->rc == ZOK || op->rc == ZNONODE)
+        zu_cache_set(op->inst, op, ZU_CACHE_ABSENT);
+
+    zu_node_done(op->z, op->inst, op->rc == ZNONODE ? ZOK : op->rc);
+}
+
+static void zu_quarantine_done(struct zu_op *op)
+{
+    struct instance *inst = op->inst;
+    int rc = op->rc;
+
+    if(rc == ZOK || rc == ZNODEEXISTS || rc == ZNONODE)
+    {
+        inst->zoo_quarantined = !inst->zoo_quarantined;
+        rc = ZOK;
+    }
+
+    zu_node_done(op->z, inst, rc);
+}
+
+static void zu_election_done(struct zoodis *z, struct instance *inst, int rc)
+{
+    inst->zoo_elect_busy = 0;
+
+    if(rc != ZOK)
+    {
+        ZU_RETURN_PRINT(rc);
+        if(rc == ZINVALIDSTATE)
+        {
+            zu_reconnect(z);
+            return;
+        }
+
+        // run again by the next probe, or by zu_retry_timer.
+        inst->zoo_elect_dirty = 1;
+        timer_add(z->tw, &inst->zoo_timer, z->zoo_connect_wait_interval);
+        return;
+    }
+
+    if(inst->zoo_elect_dirty)
+        zu_election_update(z, inst);
+}
+
+static void zu_election_step_done(struct zu_op *op)
+{
+    int rc = op->rc;
+
+    // ZBADVERSION, the node was replaced by that of another master
+    if(rc == ZNONODE || rc == ZNODEEXISTS || rc == ZBADVERSION)
+        rc = ZOK;
+    zu_election_done(op->z, op->inst, rc);
+}
+
+// A child of zoo_election_path came or went, or the watch is gone with
+// the session.
+static void zu_election_event(struct zu_op *op)
+{
+    if(op->type == ZOO_SESSION_EVENT && op->state != ZOO_EXPIRED_SESSION_STATE)
+        return;
+
+    op->inst->zoo_elect_dirty = 1;
+    zu_election_update(op->z, op->inst);
+}
+
+static void zu_election_watcher(zhandle_t *zh, int type, int state, const char *path, void *data)
+{
+    struct zu_op *op = zu_op_alloc((struct zoodis*) zoo_get_context(zh), (struct instance*) data, zu_election_event);
+
+    op->type = type;
+    op->state = state;
+    zu_queue_push(op);
+}
+
+// Data of a candidate, "host:port offset", the repl offset it claims.
+static int zu_election_claim(struct instance *inst, char *data, size_t size)
+{
+    inst->zoo_elect_offset = inst->redis_info.master_repl_offset;
+    return snprintf(data, size, "%s %"PRId64, (char*)inst->zoo_election_addr->data, inst->zoo_elect_offset);
+}
+
+// The offset claimed by candidate data, -1 for none. data is cut at the
+// space, to the address.
+static int64_t zu_election_offset(char *data)
+{
+    char *sp = strchr(data, ' ');
+
+    if(sp == NULL)
+        return -1;
+    *sp = '\0';
+    return strtoll(sp + 1, NULL, 10);
+}
+
+// --zoo-election. Instances of a --zoo-path, on any host, compete with a
+// ZOO_SEQUENCE node of <zoo-path>/election while their redis-server is
+// OK. The lowest one is the master, it publishes its address in
+// <zoo-path>/master and is sent REPLICAOF NO ONE, the others REPLICAOF
+// of it. Candidates watch the children, so a master gone with its
+// session is replaced within --zoo-timeout.
+//
+// Sequence alone would elect a redis-server that lost writes. Candidates
+// claim their repl offset again on every change of the children, and the
+// lowest one reads the claims of the others before publishing, those of
+// a later mzxid than the pzxid of the children only. It yields to any
+// larger one, by a candidate of the next sequence, so the largest claim
+// is elected. The others follow it once it published. A redis-server
+// that is master of a dataset more than ZU_ELECTION_SLACK ahead of the
+// elected one is never made its replica.
+void zu_election_update(struct zoodis *z, struct instance *inst)
+{
+    char path[PATH_MAX];
+    char data[ZU_DATA_MAX];
+    int want, len, rc;
+
+    if(!z->zoo_election || inst->primary != NULL || z->zoo_stat != ZOO_STAT_CONNECTED)
+        return;
+
+    if(inst->zoo_elect_busy)
+    {
+        inst->zoo_elect_dirty = 1;
+        return;
+    }
+
+    want = inst->redis_stat == REDIS_STAT_OK;
+    if(!want && inst->zoo_candidate == NULL)
+        return;
+    if(want && inst->zoo_candidate != NULL && inst->zoo_role != ZU_ROLE_NONE && !inst->zoo_elect_dirty)
+        return;
+
+    inst->zoo_elect_busy = 1;
+    inst->zoo_elect_dirty = 0;
+
+    if(!want)
+    {
+        log_info("Zookeeper: withdrawing candidate %s. instance:%s", inst->zoo_candidate->data, inst->name->data);
+        rc = zu_adelete(z, inst, inst->zoo_candidate->data, -1, zu_withdraw_done);
+    }else if(inst->zoo_candidate == NULL)
+    {
+        snprintf(path, sizeof(path), "%s/%s_", (char*)inst->zoo_election_path->data, (char*)inst->zoo_nodename->data);
+        len = zu_election_claim(inst, data, sizeof(data));
+        rc = zu_acreate(z, inst, path, data, len, ZOO_EPHEMERAL|ZOO_SEQUENCE, zu_candidate_done);
+    }else
+    {
+        rc = zu_awget_children(z, inst, inst->zoo_election_path->data, zu_children_done);
+    }
+
+    if(rc != ZOK)
+        zu_election_done(z, inst, rc);
+}
+
+static void zu_candidate_done(struct zu_op *op)
+{
+    struct zoodis *z = op->z;
+    struct instance *inst = op->inst;
+    int rc = op->rc;
+
+    if(rc == ZOK)
+    {
+        inst->zoo_candidate = mstr_alloc_dup(op->data, op->data_len);
+        log_info("Zookeeper: candidate %s. instance:%s", inst->zoo_candidate->data, inst->name->data);
+
+        rc = zu_awget_children(z, inst, inst->zoo_election_path->data, zu_children_done);
+    }else if(rc == ZNONODE)
+    {
+        // the first candidate of --zoo-path creates the parent.
+        inst->zoo_elect_dirty = 1;
+        rc = zu_acreate(z, inst, inst->zoo_election_path->data, "", 0, 0, zu_election_step_done);
+    }
+
+    if(rc != ZOK)
+        zu_election_done(z, inst, rc);
+}
+
+static void zu_children_done(struct zu_op *op)
+{
+    struct zoodis *z = op->z;
+    struct instance *inst = op->inst;
+    const char *ours;
+    char path[PATH_MAX];
+    char data[ZU_DATA_MAX];
+    int len, rc = op->rc;
+
+    if(rc != ZOK)
+    {
+        zu_election_done(z, inst, rc);
+        return;
+    }
+
+    // not even ours is there, it is created again.
+    if(op->data_len == 0 || inst->zoo_candidate == NULL)
+    {
+        zu_election_reset(inst);
+        inst->zoo_elect_dirty = 1;
+        zu_election_done(z, inst, ZOK);
+        return;
+    }
+
+    // a claim written before is of an older set of candidates.
+    inst->zoo_elect_pzxid = op->stat.pzxid;
+
+    ours = strrchr(inst->zoo_candidate->data, '/') + 1;
+    if(strcmp(op->data, ours) == 0)
+    {
+        if(inst->zoo_role != ZU_ROLE_MASTER)
+        {
+            if(inst->zoo_survey != NULL)
+                mstr_free_dup(inst->zoo_survey);
+            inst->zoo_survey = op->children;
+            inst->zoo_survey_pos = 0;
+            inst->zoo_survey_stale = 0;
+            if(inst->zoo_survey_addrs != NULL)
+                mstr_free_dup(inst->zoo_survey_addrs);
+            inst->zoo_survey_addrs = mstr_alloc_dup(" ", 1);
+            op->children = NULL;
+            zu_survey_next(z, inst);
+            return;
+        }
+
+        if(inst->zoo_elect_offset == inst->redis_info.master_repl_offset)
+        {
+            zu_election_done(z, inst, ZOK);
+            return;
+        }
+
+        // a new candidate is compared to the offset of now.
+        len = zu_election_claim(inst, data, sizeof(data));
+        rc = zu_aset_path(z, inst, inst->zoo_candidate->data, data, len, zu_claim_done);
+    }else if(inst->zoo_claim_zxid < inst->zoo_elect_pzxid)
+    {
+        // claimed again before following, the lowest trusts no older one.
+        inst->zoo_survey_waits = 0;
+        len = zu_election_claim(inst, data, sizeof(data));
+        rc = zu_aset_path(z, inst, inst->zoo_candidate->data, data, len, zu_refresh_done);
+    }else
+    {
+        inst->zoo_survey_waits = 0;
+        snprintf(path, sizeof(path), "%s/%s", (char*)inst->zoo_election_path->data, op->data);
+        rc = zu_aget(z, inst, path, zu_leader_done);
+    }
+
+    if(rc != ZOK)
+        zu_election_done(z, inst, rc);
+}
+
+// Our claim is written, the children are read again for the lowest.
+static void zu_refresh_done(struct zu_op *op)
+{
+    struct zoodis *z = op->z;
+    struct instance *inst = op->inst;
+    int rc = op->rc;
+
+    if(rc == ZOK)
+    {
+        inst->zoo_claim_zxid = op->stat.mzxid;
+        rc = zu_awget_children(z, inst, inst->zoo_election_path->data, zu_children_done);
+        if(rc == ZOK)
+            return;
+    }else if(rc == ZNONODE)
+    {
+        // ours is gone, created again.
+        zu_election_reset(inst);
+        inst->zoo_elect_dirty = 1;
+        rc = ZOK;
+    }
+
+    zu_election_done(z, inst, rc);
+}
+
+// Reads the claim of the next candidate of zoo_survey, other than ours.
+// Once all are read, ours is claimed again with the offset of now, and
+// the master node created. If a claim was older than the last change of
+// candidates, all are read again after ZU_ELECTION_WAIT_MSEC instead.
+static void zu_survey_next(struct zoodis *z, struct instance *inst)
+{
+    const char *ours = strrchr(inst->zoo_candidate->data, '/') + 1;
+    const char *name;
+    char path[PATH_MAX];
+    char data[ZU_DATA_MAX];
+    int len, rc;
+
+    while(inst->zoo_survey_pos < inst->zoo_survey->len)
+    {
+        name = (char*)inst->zoo_survey->data + inst->zoo_survey_pos;
+        inst->zoo_survey_pos += strlen(name) + 1;
+        if(strcmp(name, ours) == 0)
+            continue;
+
+        snprintf(path, sizeof(path), "%s/%s", (char*)inst->zoo_election_path->data, name);
+        rc = zu_aget(z, inst, path, zu_survey_done);
+        if(rc != ZOK)
+            zu_election_done(z, inst, rc);
+        return;
+    }
+
+    mstr_free_dup(inst->zoo_survey);
+    inst->zoo_survey = NULL;
+
+    if(inst->zoo_survey_stale)
+    {
+        // run again by zu_retry_timer, or by the watch.
+        inst->zoo_survey_waits++;
+        inst->zoo_elect_dirty = 1;
+        inst->zoo_elect_busy = 0;
+        timer_add(z->tw, &inst->zoo_timer, ZU_ELECTION_WAIT_MSEC);
+        return;
+    }
+
+    len = zu_election_claim(inst, data, sizeof(data));
+    rc = zu_aset_path(z, inst, inst->zoo_candidate->data, data, len, zu_claim_done);
+    if(rc != ZOK)
+        zu_election_done(z, inst, rc);
+}
+
+static void zu_survey_done(struct zu_op *op)
+{
+    struct zoodis *z = op->z;
+    struct instance *inst = op->inst;
+    struct mstr *addrs;
+    int64_t offset;
+    int rc = op->rc;
+
+    // gone meanwhile, or dropped by zu_election_reset.
+    if(inst->zoo_survey == NULL || rc == ZNONODE)
+    {
+        if(inst->zoo_survey == NULL)
+            zu_election_done(z, inst, ZOK);
+        else
+            zu_survey_next(z, inst);
+        return;
+    }
+
+    if(rc != ZOK)
+    {
+        zu_election_done(z, inst, rc);
+        return;
+    }
+
+    op->data[op->data_len < ZU_DATA_MAX ? op->data_len : ZU_DATA_MAX - 1] = '\0';
+    offset = zu_election_offset(op->data);
+
+    addrs = mstr_concat(3, inst->zoo_survey_addrs->data, op->data, " ");
+    mstr_free_dup(inst->zoo_survey_addrs);
+    inst->zoo_survey_addrs = addrs;
+
+    // claimed before the master, or another candidate, was gone. It is
+    // claimed again by that candidate shortly, unless its zoodis hangs.
+    if(op->stat.mzxid < inst->zoo_elect_pzxid)
+    {
+        if(inst->zoo_survey_waits < ZU_ELECTION_WAITS)
+            inst->zoo_survey_stale = 1;
+        else
+            log_warn("Zookeeper: ignoring candidate %s, not claimed since the last change. instance:%s",
+                    op->data, inst->name->data);
+        zu_survey_next(z, inst);
+        return;
+    }
+
+    if(offset <= inst->redis_info.master_repl_offset)
+    {
+        zu_survey_next(z, inst);
+        return;
+    }
+
+    log_warn("Zookeeper: yielding to candidate %s of repl offset %"PRId64", ours is %"PRId64". instance:%s",
+            op->data, offset, inst->redis_info.master_repl_offset, inst->name->data);
+    rc = zu_adelete(z, inst, inst->zoo_candidate->data, -1, zu_defer_done);
+    if(rc != ZOK)
+        zu_election_done(z, inst, rc);
+}
+
+// Our candidate is gone, a new one is created after all others.
+static void zu_defer_done(struct zu_op *op)
+{
+    int rc = op->rc;
+
+    if(rc == ZOK || rc == ZNONODE)
+    {
+        zu_election_reset(op->inst);
+        op->inst->zoo_elect_dirty = 1;
+        rc = ZOK;
+    }
+
+    zu_election_done(op->z, op->inst, rc);
+}
+
+static void zu_claim_done(struct zu_op *op)
+{
+    struct zoodis *z = op->z;
+    struct instance *inst = op->inst;
+    int rc = op->rc;
+
+    if(rc == ZOK)
+        inst->zoo_claim_zxid = op->stat.mzxid;
+
+    if(rc == ZOK && inst->zoo_role != ZU_ROLE_MASTER)
+    {
+        rc = zu_acreate(z, inst, inst->zoo_master_path->data, inst->zoo_election_addr->data, inst->zoo_election_addr->len,
+                ZOO_EPHEMERAL, zu_publish_done);
+        if(rc == ZOK)
+            return;
+    }else if(rc == ZNONODE)
+    {
+        // ours is gone, created again.
+        zu_election_reset(inst);
+        inst->zoo_elect_dirty = 1;
+        rc = ZOK;
+    }
+
+    zu_election_done(z, inst, rc);
+}
+
+static void zu_publish_done(struct zu_op *op)
+{
+    struct zoodis *z = op->z;
+    struct instance *inst = op->inst;
+    int rc = op->rc;
+
+    if(rc == ZOK)
+    {
+        log_warn("Zookeeper: elected master of %s, %s. instance:%s",
+                inst->zoo_path->data, inst->zoo_election_addr->data, inst->name->data);
+        inst->zoo_role = ZU_ROLE_MASTER;
+        inst->zoo_survey_waits = 0;
+        redis_replicaof(inst, NULL, 0);
+    }else if(rc == ZNODEEXISTS)
+    {
+        // of the previous master, until its session expires.
+        rc = zu_awget_master(z, inst, zu_holder_done);
+        if(rc == ZOK)
+            return;
+    }
+
+    zu_election_done(z, inst, rc);
+}
+
+// The master node is deleted at the version read, if it is ours or its
+// candidate was not among those surveyed. Another candidate deletes its
+// own, and the watch fires then.
+static void zu_holder_done(struct zu_op *op)
+{
+    struct zoodis *z = op->z;
+    struct instance *inst = op->inst;
+    char holder[ZU_DATA_MAX + 2];
+    int rc = op->rc;
+
+    if(rc == ZOK)
+    {
+        op->data[op->data_len < ZU_DATA_MAX ? op->data_len : ZU_DATA_MAX - 1] = '\0';
+        snprintf(holder, sizeof(holder), " %s ", op->data);
+        if(strcmp(op->data, inst->zoo_election_addr->data) != 0 &&
+                inst->zoo_survey_addrs != NULL && strstr(inst->zoo_survey_addrs->data, holder) != NULL)
+        {
+            log_debug("Zookeeper: waiting for candidate %s to unpublish %s. instance:%s",
+                    op->data, inst->zoo_master_path->data, inst->name->data);
+            inst->zoo_elect_dirty = 1;
+            inst->zoo_elect_busy = 0;
+            return;
+        }
+
+        inst->zoo_elect_dirty = 1;
+        rc = zu_adelete(z, inst, inst->zoo_master_path->data, op->stat.version, zu_election_step_done);
+        if(rc == ZOK)
+            return;
+    }else if(rc == ZNONODE)
+    {
+        // gone meanwhile, created again.
+        inst->zoo_elect_dirty = 1;
+        rc = ZOK;
+    }
+
+    zu_election_done(z, inst, rc);
+}
+
+// data of a candidate is host:port offset, the port after the last colon.
+// The lowest is followed only once it published the master node, it may
+// yet yield to a larger claim.
+static void zu_leader_done(struct zu_op *op)
+{
+    struct instance *inst = op->inst;
+    int64_t offset;
+    int rc = op->rc;
+
+    if(rc == ZOK)
+    {
+        op->data[op->data_len < ZU_DATA_MAX ? op->data_len : ZU_DATA_MAX - 1] = '\0';
+        offset = zu_election_offset(op->data);
+        if(strrchr(op->data, ':') != NULL)
+        {
+            if(inst->zoo_leader != NULL)
+                mstr_free_dup(inst->zoo_leader);
+            inst->zoo_leader = mstr_alloc_dup(op->data, strlen(op->data));
+            inst->zoo_leader_offset = offset;
+
+            rc = zu_awget_master(op->z, inst, zu_master_done);
+            if(rc == ZOK)
+                return;
+        }else
+        {
+            log_err("Zookeeper: invalid candidate data %s of %s.", op->data, inst->zoo_path->data);
+        }
+    }else if(rc == ZNONODE)
+    {
+        // gone meanwhile, the watch fires as well.
+        inst->zoo_elect_dirty = 1;
+        rc = ZOK;
+    }
+
+    zu_election_done(op->z, inst, rc);
+}
+
+// The master node is watched. Until it holds the address of the lowest,
+// that of zoo_leader, the previous master is followed still.
+static void zu_master_done(struct zu_op *op)
+{
+    struct instance *inst = op->inst;
+    char *leader, *colon;
+    int rc = op->rc;
+
+    if(rc == ZOK)
+    {
+        op->data[op->data_len < ZU_DATA_MAX ? op->data_len : ZU_DATA_MAX - 1] = '\0';
+        leader = inst->zoo_leader != NULL ? (char*)inst->zoo_leader->data : NULL;
+        colon = leader != NULL ? strrchr(leader, ':') : NULL;
+        if(colon == NULL || strcmp(op->data, leader) != 0)
+        {
+            zu_election_done(op->z, inst, ZOK);
+            return;
+        }
+
+        if(inst->zoo_leader_offset >= 0 && inst->zoo_role != ZU_ROLE_REPLICA &&
+                strcmp(inst->redis_info.role, "master") == 0 &&
+                inst->redis_info.master_repl_offset > inst->zoo_leader_offset + ZU_ELECTION_SLACK)
+        {
+            // tried again by the next probe, not to lose the writes.
+            if(!inst->zoo_elect_refused)
+                log_err("Zookeeper: refusing to replicate master %s of repl offset %"PRId64", ours is %"PRId64". instance:%s",
+                        leader, inst->zoo_leader_offset, inst->redis_info.master_repl_offset, inst->name->data);
+            inst->zoo_elect_refused = 1;
+            inst->zoo_elect_dirty = 1;
+            inst->zoo_elect_busy = 0;
+            return;
+        }
+
+        inst->zoo_elect_refused = 0;
+        if(inst->zoo_role != ZU_ROLE_REPLICA)
+            log_info("Zookeeper: following master %s of %s. instance:%s", leader, inst->zoo_path->data, inst->name->data);
+        inst->zoo_role = ZU_ROLE_REPLICA;
+        *colon = '\0';
+        redis_replicaof(inst, leader, atoi(colon + 1));
+        *colon = ':';
+    }else if(rc == ZNONODE)
+    {
+        // not published yet, watched until it is.
+        rc = zu_awexists_master(op->z, inst, zu_master_wait_done);
+        if(rc == ZOK)
+            return;
+    }
+
+    zu_election_done(op->z, inst, rc);
+}
+
+static void zu_master_wait_done(struct zu_op *op)
+{
+    int rc = op->rc;
+
+    // published meanwhile, read again.
+    if(rc == ZOK)
+        op->inst->zoo_elect_dirty = 1;
+    zu_election_done(op->z, op->inst, rc == ZNONODE ? ZOK : rc);
+}
+
+// The master node is removed only if it is ours, a new master may have
+// replaced it already.
+static void zu_withdraw_done(struct zu_op *op)
+{
+    struct zoodis *z = op->z;
+    struct instance *inst = op->inst;
+    int rc = op->rc;
+    int master = inst->zoo_role == ZU_ROLE_MASTER;
+
+    if(rc == ZOK || rc == ZNONODE)
+    {
+        zu_election_reset(inst);
+        rc = ZOK;
+        if(master)
+        {
+            rc = zu_aget(z, inst, inst->zoo_master_path->data, zu_unpublish_done);
+            if(rc == ZOK)
+                return;
+        }
+    }
+
+    zu_election_done(z, inst, rc);
+}
+
+static void zu_unpublish_done(struct zu_op *op)
+{
+    struct zoodis *z = op->z;
+    struct instance *inst = op->inst;
+    int rc = op->rc;
+
+    // of the version read, a new master may recreate it meanwhile.
+    if(rc == ZOK && op->stat.ephemeralOwner == zoo_client_id(z->zh)->client_id)
+    {
+        rc = zu_adelete(z, inst, inst->zoo_master_path->data, op->stat.version, zu_election_step_done);
+        if(rc == ZOK)
+            return;
+    }
+
+    zu_election_done(z, inst, rc == ZNONODE ? ZOK : rc);
+}
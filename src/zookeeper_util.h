@@ -0,0 +1,120 @@
+#ifndef _ZOOKEEPER_UTIL_H_
+#define _ZOOKEEPER_UTIL_H_
+
+#include <stdio.h>
+#include <pthread.h>
+#include <zookeeper/zookeeper.h>
+
+#include "event.h"
+
+#define ZU_RETURN_PRINT(x)      zu_return_print(__FILE__, __LINE__, x)
+
+// node data read back by zoo_aget, instance_nodedata() builds less
+#define ZU_DATA_MAX             512
+
+// --zoo-election, a redis-server holding its own dataset is not made a
+// replica of a master whose repl offset is more than this behind.
+#define ZU_ELECTION_SLACK       (1024*1024)
+
+// --zoo-election, the lowest candidate waits this many times for the others
+// to claim their offset after a change of candidates, then ignores them.
+#define ZU_ELECTION_WAITS       10
+#define ZU_ELECTION_WAIT_MSEC   100
+
+enum zoo_stat
+{
+    ZOO_STAT_NOT_CONNECTED,
+    ZOO_STAT_CONNECTIONG,
+    ZOO_STAT_CONNECTED,
+};
+
+enum zoo_res
+{
+    ZOO_RES_OK,
+    ZOO_RES_ERROR,
+};
+
+// what the node of an instance is known to be, kept by watches
+enum zu_cache
+{
+    ZU_CACHE_UNKNOWN,
+    ZU_CACHE_ABSENT,
+    ZU_CACHE_PRESENT,
+};
+
+// --zoo-election, what the instance was elected
+enum zu_role
+{
+    ZU_ROLE_NONE,
+    ZU_ROLE_MASTER,
+    ZU_ROLE_REPLICA,
+};
+
+struct zoodis;
+struct instance;
+struct mstr;
+struct zu_op;
+struct zu_batch;
+
+typedef void (*zu_op_proc)(struct zu_op *op);
+
+// An asynchronous call or a watcher event. The completion runs on the
+// thread of zookeeper_mt, it only copies the result in and queues it,
+// proc is called by the main loop.
+struct zu_op
+{
+    struct zu_op *next;
+    zu_op_proc proc;
+    struct zoodis *z;
+    struct instance *inst;
+    int gen;        // zoo_cache_gen of inst when issued
+    int handle_gen; // zoo_handle_gen when issued
+
+    int rc;
+    int type;
+    int state;
+    struct Stat stat;
+    char data[ZU_DATA_MAX];
+    int data_len;
+
+    // children of zu_awget_children(), NUL separated
+    struct mstr *children;
+
+    // zoo_amulti of zu_batch_flush(), freed with the op
+    struct zu_batch *batch;
+};
+
+// Updates gathered within --zoo-batch-window and committed by one
+// zoo_amulti. ops are per instance, as if issued alone, multi is what
+// is sent of them.
+struct zu_batch
+{
+    int count;
+    struct zu_op *ops;
+    zoo_op_t *multi;
+    zoo_op_result_t *results;
+};
+
+// Results handed from the zookeeper thread to the main loop, which is
+// woken up by an eventfd.
+struct zu_queue
+{
+    pthread_mutex_t lock;
+    struct zu_op *head;
+    struct zu_op **tail;
+    struct event ev;
+};
+
+int zu_queue_init(struct zoodis *z);
+void zu_con_watcher(zhandle_t *zh, int type, int state, const char *path, void *data);
+void zu_set_log_stream(FILE *fd);
+void zu_set_log_level(int level);
+void zu_return_print(const char *f, int l, int ret);
+enum zoo_res zu_connect(struct zoodis *z);
+void zu_reconnect(struct zoodis *z);
+void zu_session_load(struct zoodis *z);
+void zu_drain(struct zoodis *z, int msec);
+enum zoo_res zu_ephemeral_update(struct zoodis *z, struct instance *inst);
+void zu_election_update(struct zoodis *z, struct instance *inst);
+
+#endif // _ZOOKEEPER_UTIL_H_